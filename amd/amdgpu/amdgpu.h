@@ -88,6 +88,9 @@ extern int amdgpu_disp_priority;
 extern int amdgpu_hw_i2c;
 extern int amdgpu_pcie_gen2;
 extern int amdgpu_msi;
+extern int amdgpu_ih_budget;
+extern int amdgpu_ih_rings;
+extern int amdgpu_fence_poll_us;
 extern int amdgpu_lockup_timeout;
 extern int amdgpu_dpm;
 extern int amdgpu_fw_load_type;
@@ -102,9 +105,12 @@ extern int amdgpu_vm_fragment_size;
 extern int amdgpu_vm_fault_stop;
 extern int amdgpu_vm_debug;
 extern int amdgpu_vm_update_mode;
+extern int amdgpu_vm_update_cpu_max;
 extern int amdgpu_dc;
 extern int amdgpu_sched_jobs;
 extern int amdgpu_sched_hw_submission;
+extern int amdgpu_sched_policy;
+extern int amdgpu_sched_batch;
 extern int amdgpu_no_evict;
 extern int amdgpu_direct_gma_size;
 extern int amdgpu_ssg_enabled;
@@ -117,6 +123,7 @@ extern char *amdgpu_disable_cu;
 extern char *amdgpu_virtual_display;
 extern unsigned amdgpu_pp_feature_mask;
 extern int amdgpu_vram_page_split;
+extern int amdgpu_vram_buddy;
 extern int amdgpu_ngg;
 extern int amdgpu_prim_buf_per_se;
 extern int amdgpu_pos_buf_per_se;
@@ -350,6 +357,7 @@ struct amdgpu_gart_funcs {
 struct amdgpu_ih_funcs {
 	/* ring read/write ptr handling, called from interrupt context */
 	u32 (*get_wptr)(struct amdgpu_device *adev);
+	bool (*prescreen_iv)(struct amdgpu_device *adev);
 	void (*decode_iv)(struct amdgpu_device *adev,
 			  struct amdgpu_iv_entry *entry);
 	void (*set_rptr)(struct amdgpu_device *adev);
@@ -809,6 +817,9 @@ struct amdgpu_bo_list_entry {
 	uint32_t			priority;
 	struct page			**user_pages;
 	int				user_invalidated;
+	/* BO is still validated as long as its move count is unchanged */
+	bool				resident;
+	u64				move_count;
 };
 
 struct amdgpu_bo_list {
@@ -1123,6 +1134,9 @@ struct amdgpu_cs_parser {
 #define AMDGPU_PREAMBLE_IB_PRESENT_FIRST    (1 << 1) /* bit set means preamble IB is first presented in belonging context */
 #define AMDGPU_HAVE_CTX_SWITCH              (1 << 2) /* bit set means context switch occured */
 
+/* max number of dependencies the scheduler waits for with one callback */
+#define AMDGPU_JOB_MAX_MERGED_DEPS	16
+
 struct amdgpu_job {
 	struct amd_sched_job    base;
 	struct amdgpu_device	*adev;
@@ -1131,6 +1145,9 @@ struct amdgpu_job {
 	struct amdgpu_sync	sync;
 	struct amdgpu_sync	dep_sync;
 	struct amdgpu_sync	sched_sync;
+	/* dependencies left over when they couldn't be merged */
+	struct dma_fence	*deps[AMDGPU_JOB_MAX_MERGED_DEPS];
+	unsigned		num_deps;
 	struct amdgpu_ib	*ibs;
 	struct dma_fence	*fence; /* the hw fence */
 	uint32_t		preamble_status;
@@ -1149,6 +1166,7 @@ struct amdgpu_job {
 	uint64_t		uf_sequence;
 
 };
+
 #define to_amdgpu_job(sched_job)		\
 		container_of((sched_job), struct amdgpu_job, base)
 
@@ -1236,12 +1254,15 @@ struct amdgpu_firmware {
  * Benchmarking
  */
 void amdgpu_benchmark(struct amdgpu_device *adev, int test_number);
+void amdgpu_benchmark_software(struct seq_file *m);
+int amdgpu_benchmark_debugfs_init(struct amdgpu_device *adev);
 
 
 /*
  * Testing
  */
 void amdgpu_test_moves(struct amdgpu_device *adev);
+void amdgpu_test_pte_plan(void);
 
 /*
  * Debugfs
@@ -1578,6 +1599,15 @@ struct amdgpu_device {
 		s64			accum_us; /* accumulated microseconds */
 		s64			accum_us_vis; /* for visible VRAM */
 		u32			log2_max_MBps;
+
+		/* blit throughput measured by amdgpu_move_blit, the rate
+		 * follows it when the moverate is auto
+		 */
+		bool			learn_rate;
+		spinlock_t		blit_lock;
+		ktime_t			last_blit_end;
+		u32			blit_MBps[AMDGPU_MOVE_NUM_DIRS];
+		u64			blit_samples[AMDGPU_MOVE_NUM_DIRS];
 	} mm_stats;
 
 	/* display */
@@ -1977,6 +2007,12 @@ static inline void amdgpu_acpi_fini(struct amdgpu_device *adev) { }
 int amdgpu_cs_find_mapping(struct amdgpu_cs_parser *parser,
 			   uint64_t addr, struct amdgpu_bo **bo,
 			   struct amdgpu_bo_va_mapping **mapping);
+void amdgpu_cs_find_mappings(struct amdgpu_cs_parser *parser,
+			     const uint64_t *addrs, unsigned count,
+			     struct amdgpu_bo_va_mapping **mappings);
+int amdgpu_cs_bind_mapping(struct amdgpu_cs_parser *parser,
+			   struct amdgpu_bo_va_mapping *mapping,
+			   struct amdgpu_bo **bo);
 
 #if defined(CONFIG_DRM_AMD_DC)
 int amdgpu_dm_display_resume(struct amdgpu_device *adev );
@@ -23,20 +23,50 @@
  */
 #include <drm/drmP.h>
 #include <drm/amdgpu_drm.h>
+#include <linux/seq_file.h>
+#include <linux/random.h>
 #include "amdgpu.h"
 
 #define AMDGPU_BENCHMARK_ITERATIONS 1024
 #define AMDGPU_BENCHMARK_COMMON_MODES_N 17
 
-static int amdgpu_benchmark_do_move(struct amdgpu_device *adev, unsigned size,
+/* Size sweeps go from 4KB to 1GB, moving about 256MB for each size */
+#define AMDGPU_BENCHMARK_SWEEP_MIN	(4ULL << 10)
+#define AMDGPU_BENCHMARK_SWEEP_MAX	(1ULL << 30)
+#define AMDGPU_BENCHMARK_SWEEP_BYTES	(256ULL << 20)
+
+/* Copy packets emitted into one IB by the software benchmark */
+#define AMDGPU_BENCHMARK_SW_PACKETS	64
+
+static const char *amdgpu_benchmark_domain(unsigned domain)
+{
+	switch (domain) {
+	case AMDGPU_GEM_DOMAIN_VRAM:
+		return "vram";
+	case AMDGPU_GEM_DOMAIN_GTT:
+		return "gtt";
+	case AMDGPU_GEM_DOMAIN_CPU:
+		return "cpu";
+	default:
+		return "-";
+	}
+}
+
+static unsigned amdgpu_benchmark_sweep_count(u64 size)
+{
+	return clamp_t(u64, div64_u64(AMDGPU_BENCHMARK_SWEEP_BYTES, size), 1,
+		       AMDGPU_BENCHMARK_ITERATIONS);
+}
+
+static s64 amdgpu_benchmark_do_move(struct amdgpu_device *adev, unsigned size,
 				    uint64_t saddr, uint64_t daddr, int n)
 {
-	unsigned long start_jiffies;
-	unsigned long end_jiffies;
 	struct dma_fence *fence = NULL;
-	int i, r;
+	ktime_t start;
+	s64 r;
+	int i;
 
-	start_jiffies = jiffies;
+	start = ktime_get();
 	for (i = 0; i < n; i++) {
 		struct amdgpu_ring *ring = adev->mman.buffer_funcs_ring;
 		r = amdgpu_copy_buffer(ring, saddr, daddr, size, NULL, &fence,
@@ -47,9 +77,9 @@ static int amdgpu_benchmark_do_move(struct amdgpu_device *adev, unsigned size,
 		if (r)
 			goto exit_do_move;
 		dma_fence_put(fence);
+		fence = NULL;
 	}
-	end_jiffies = jiffies;
-	r = jiffies_to_msecs(end_jiffies - start_jiffies);
+	r = ktime_us_delta(ktime_get(), start);
 
 exit_do_move:
 	if (fence)
@@ -58,28 +88,52 @@ exit_do_move:
 }
 
 
-static void amdgpu_benchmark_log_results(int n, unsigned size,
-					 unsigned int time,
+/*
+ * Results go to the kernel log, or as CSV line into @m when the benchmark is
+ * run through debugfs. Throughput is in MB/s, @size is per operation and
+ * zero for operations which don't move data.
+ */
+static void amdgpu_benchmark_log_results(struct seq_file *m, int n,
+					 u64 size, s64 time_us,
 					 unsigned sdomain, unsigned ddomain,
-					 char *kind)
+					 const char *kind)
 {
-	unsigned int throughput = (n * (size >> 10)) / time;
-	DRM_INFO("amdgpu: %s %u bo moves of %u kB from"
-		 " %d to %d in %u ms, throughput: %u Mb/s or %u MB/s\n",
-		 kind, n, size >> 10, sdomain, ddomain, time,
-		 throughput * 8, throughput);
+	u64 throughput = 0, ns_per_op = 0;
+
+	if (time_us > 0) {
+		throughput = div64_u64(n * size, time_us);
+		ns_per_op = div64_u64(time_us * 1000, n);
+	}
+
+	if (m) {
+		seq_printf(m, "%s,%s,%s,%llu,%d,%lld,%llu,%llu\n", kind,
+			   amdgpu_benchmark_domain(sdomain),
+			   amdgpu_benchmark_domain(ddomain),
+			   size, n, time_us, throughput, ns_per_op);
+		return;
+	}
+
+	if (size)
+		DRM_INFO("amdgpu: %s %u bo moves of %llu kB from"
+			 " %s to %s in %lld us, throughput: %llu Mb/s or %llu MB/s\n",
+			 kind, n, size >> 10, amdgpu_benchmark_domain(sdomain),
+			 amdgpu_benchmark_domain(ddomain), time_us,
+			 throughput * 8, throughput);
+	else
+		DRM_INFO("amdgpu: %s %u operations in %lld us, %llu ns each\n",
+			 kind, n, time_us, ns_per_op);
 }
 
-static void amdgpu_benchmark_move(struct amdgpu_device *adev, unsigned size,
-				  unsigned sdomain, unsigned ddomain)
+static int amdgpu_benchmark_move(struct amdgpu_device *adev,
+				 struct seq_file *m, unsigned size, int n,
+				 unsigned sdomain, unsigned ddomain)
 {
 	struct amdgpu_bo *dobj = NULL;
 	struct amdgpu_bo *sobj = NULL;
 	uint64_t saddr, daddr;
-	int r, n;
-	int time;
+	s64 time;
+	int r, err;
 
-	n = AMDGPU_BENCHMARK_ITERATIONS;
 	r = amdgpu_bo_create(adev, size, PAGE_SIZE, true, sdomain, 0, NULL,
 			     NULL, 0, &sobj);
 	if (r) {
@@ -109,15 +163,17 @@ static void amdgpu_benchmark_move(struct amdgpu_device *adev, unsigned size,
 
 	if (adev->mman.buffer_funcs) {
 		time = amdgpu_benchmark_do_move(adev, size, saddr, daddr, n);
-		if (time < 0)
+		if (time < 0) {
+			r = time;
 			goto out_cleanup;
-		if (time > 0)
-			amdgpu_benchmark_log_results(n, size, time,
-						     sdomain, ddomain, "dma");
+		}
+		amdgpu_benchmark_log_results(m, n, size, time,
+					     sdomain, ddomain, "dma");
 	}
 
 out_cleanup:
 	/* Check error value now. The value can be overwritten when clean up.*/
+	err = r;
 	if (r) {
 		DRM_ERROR("Error while benchmarking BO move.\n");
 	}
@@ -138,9 +194,1108 @@ out_cleanup:
 		}
 		amdgpu_bo_unref(&dobj);
 	}
+	return err;
 }
 
-void amdgpu_benchmark(struct amdgpu_device *adev, int test_number)
+static struct amdgpu_bo *amdgpu_benchmark_create_pinned(struct amdgpu_device *adev,
+							 u64 size,
+							 unsigned domain)
+{
+	struct amdgpu_bo *bo = NULL;
+	int r;
+
+	r = amdgpu_bo_create(adev, size, PAGE_SIZE, true, domain, 0, NULL,
+			     NULL, 0, &bo);
+	if (r)
+		return ERR_PTR(r);
+
+	r = amdgpu_bo_reserve(bo, false);
+	if (unlikely(r != 0))
+		goto error_unref;
+
+	r = amdgpu_bo_pin(bo, domain, NULL);
+	amdgpu_bo_unreserve(bo);
+	if (r)
+		goto error_unref;
+
+	return bo;
+
+error_unref:
+	amdgpu_bo_unref(&bo);
+	return ERR_PTR(r);
+}
+
+static void amdgpu_benchmark_free_pinned(struct amdgpu_bo *bo)
+{
+	if (likely(amdgpu_bo_reserve(bo, true) == 0)) {
+		amdgpu_bo_unpin(bo);
+		amdgpu_bo_unreserve(bo);
+	}
+	amdgpu_bo_unref(&bo);
+}
+
+static int amdgpu_benchmark_fill(struct amdgpu_device *adev,
+				 struct seq_file *m, u64 size, int n,
+				 unsigned domain)
+{
+	struct dma_fence *fence;
+	struct amdgpu_bo *bo;
+	ktime_t start;
+	int i, r = 0;
+
+	bo = amdgpu_benchmark_create_pinned(adev, size, domain);
+	if (IS_ERR(bo)) {
+		DRM_ERROR("Error while benchmarking BO fill.\n");
+		return PTR_ERR(bo);
+	}
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		r = amdgpu_fill_buffer(bo, 0, NULL, &fence);
+		if (r)
+			break;
+		r = dma_fence_wait(fence, false);
+		dma_fence_put(fence);
+		if (r)
+			break;
+	}
+
+	if (r)
+		DRM_ERROR("Error while benchmarking BO fill.\n");
+	else
+		amdgpu_benchmark_log_results(m, n, size,
+					     ktime_us_delta(ktime_get(), start),
+					     0, domain, "fill");
+
+	amdgpu_benchmark_free_pinned(bo);
+	return r;
+}
+
+/* Rebind the pages of a pinned GTT BO to measure GART updates */
+static int amdgpu_benchmark_gart(struct amdgpu_device *adev,
+				 struct seq_file *m, u64 size, int n)
+{
+	struct ttm_dma_tt *dma;
+	struct amdgpu_bo *bo;
+	uint64_t offset, flags;
+	struct ttm_tt *ttm;
+	ktime_t start;
+	int i, r = 0;
+
+	bo = amdgpu_benchmark_create_pinned(adev, size,
+					    AMDGPU_GEM_DOMAIN_GTT);
+	if (IS_ERR(bo)) {
+		DRM_ERROR("Error while benchmarking GART binding.\n");
+		return PTR_ERR(bo);
+	}
+
+	ttm = bo->tbo.ttm;
+	dma = container_of(ttm, struct ttm_dma_tt, ttm);
+	offset = (u64)bo->tbo.mem.start << PAGE_SHIFT;
+	flags = amdgpu_ttm_tt_pte_flags(adev, ttm, &bo->tbo.mem);
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		r = amdgpu_gart_unbind(adev, offset, ttm->num_pages);
+		if (r)
+			break;
+		r = amdgpu_gart_bind(adev, offset, ttm->num_pages, ttm->pages,
+				     dma->dma_address, flags);
+		if (r)
+			break;
+	}
+
+	if (r)
+		DRM_ERROR("Error while benchmarking GART binding.\n");
+	else
+		amdgpu_benchmark_log_results(m, n, size,
+					     ktime_us_delta(ktime_get(), start),
+					     0, AMDGPU_GEM_DOMAIN_GTT, "gart");
+
+	amdgpu_benchmark_free_pinned(bo);
+	return r;
+}
+
+static void amdgpu_benchmark_sweep(struct amdgpu_device *adev,
+				   struct seq_file *m, unsigned test,
+				   unsigned sdomain, unsigned ddomain)
+{
+	u64 size;
+	int r;
+
+	for (size = AMDGPU_BENCHMARK_SWEEP_MIN;
+	     size <= AMDGPU_BENCHMARK_SWEEP_MAX; size <<= 1) {
+		unsigned n = amdgpu_benchmark_sweep_count(size);
+
+		switch (test) {
+		case 10:
+			r = amdgpu_benchmark_move(adev, m, size, n,
+						  sdomain, ddomain);
+			break;
+		case 11:
+			r = amdgpu_benchmark_fill(adev, m, size, n, ddomain);
+			break;
+		default:
+			r = amdgpu_benchmark_gart(adev, m, size, n);
+			break;
+		}
+
+		/* Bigger sizes won't fit either */
+		if (r)
+			break;
+	}
+}
+
+static const char *amdgpu_benchmark_fence_name(struct dma_fence *f)
+{
+	return "amdgpu_benchmark";
+}
+
+static bool amdgpu_benchmark_fence_signaling(struct dma_fence *f)
+{
+	return true;
+}
+
+static const struct dma_fence_ops amdgpu_benchmark_fence_ops = {
+	.get_driver_name = amdgpu_benchmark_fence_name,
+	.get_timeline_name = amdgpu_benchmark_fence_name,
+	.enable_signaling = amdgpu_benchmark_fence_signaling,
+	.wait = dma_fence_default_wait,
+};
+
+/* Sequence numbers completing at once in the fence processing benchmark */
+static const unsigned amdgpu_benchmark_fence_batches[] = { 1, 8, 64, 256 };
+
+/* Fence slots used by the fence processing benchmark, a power of two
+ * bigger than the biggest batch like the fence driver uses
+ */
+#define AMDGPU_BENCHMARK_FENCE_SLOTS	512
+
+static void amdgpu_benchmark_fence_cb(struct dma_fence *f,
+				      struct dma_fence_cb *cb)
+{
+}
+
+/*
+ * amdgpu_fence_signal_slots() as used by amdgpu_fence_process(), completing a
+ * batch of fences with callbacks at once. The fences live in a slot array
+ * like the one of a ring's fence driver, no ring is involved.
+ */
+static int amdgpu_benchmark_fence_process(struct seq_file *m)
+{
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS;
+	const uint32_t mask = AMDGPU_BENCHMARK_FENCE_SLOTS - 1;
+	struct dma_fence **slots;
+	struct dma_fence_cb *cbs;
+	unsigned b, i, j, batch;
+	uint32_t last_seq = 0;
+	spinlock_t lock;
+	u64 context;
+	char kind[32];
+	s64 time;
+	int r = 0;
+
+	slots = kcalloc(AMDGPU_BENCHMARK_FENCE_SLOTS, sizeof(*slots),
+			GFP_KERNEL);
+	cbs = kcalloc(AMDGPU_BENCHMARK_FENCE_SLOTS, sizeof(*cbs), GFP_KERNEL);
+	if (!slots || !cbs) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+
+	spin_lock_init(&lock);
+	context = kcl_fence_context_alloc(1);
+
+	for (b = 0; b < ARRAY_SIZE(amdgpu_benchmark_fence_batches); b++) {
+		batch = amdgpu_benchmark_fence_batches[b];
+		time = 0;
+		for (i = 0; i < n && !r; i++) {
+			ktime_t start;
+
+			for (j = 0; j < batch; j++) {
+				uint32_t seq = last_seq + j + 1;
+				struct dma_fence *fence;
+
+				fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+				if (!fence) {
+					r = -ENOMEM;
+					break;
+				}
+				dma_fence_init(fence, &amdgpu_benchmark_fence_ops,
+					       &lock, context, seq);
+				dma_fence_add_callback(fence, &cbs[j],
+						       amdgpu_benchmark_fence_cb);
+				slots[seq & mask] = fence;
+			}
+
+			start = ktime_get();
+			amdgpu_fence_signal_slots(slots, mask, &lock,
+						  last_seq & mask,
+						  (last_seq + j) & mask);
+			time += ktime_to_ns(ktime_sub(ktime_get(), start));
+			last_seq += j;
+		}
+		if (r)
+			break;
+
+		snprintf(kind, sizeof(kind), "fence_process_%u", batch);
+		amdgpu_benchmark_log_results(m, n * batch, 0,
+					     div_s64(time, 1000), 0, 0, kind);
+	}
+
+out_free:
+	kfree(cbs);
+	kfree(slots);
+	return r;
+}
+
+/* Fence contexts added to one sync object, inline up to
+ * AMDGPU_SYNC_INLINE_FENCES and hashed above
+ */
+static const unsigned amdgpu_benchmark_sync_sizes[] = {
+	1, AMDGPU_SYNC_INLINE_FENCES, 16, 64
+};
+
+#define AMDGPU_BENCHMARK_SYNC_MAX	64
+
+/*
+ * Life cycle of the sync object of a CS: add the fences of some contexts
+ * twice, like BOs sharing fences do, peek and get all of them. No device is
+ * needed since none of the fences are scheduler fences.
+ */
+static int amdgpu_benchmark_sync(struct seq_file *m)
+{
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS;
+	struct dma_fence **fences, *f;
+	struct amdgpu_sync sync;
+	unsigned s, i, j, count;
+	spinlock_t lock;
+	ktime_t start;
+	u64 context;
+	char kind[32];
+	int r = 0;
+
+	fences = kcalloc(AMDGPU_BENCHMARK_SYNC_MAX, sizeof(*fences),
+			 GFP_KERNEL);
+	if (!fences)
+		return -ENOMEM;
+
+	spin_lock_init(&lock);
+	context = kcl_fence_context_alloc(AMDGPU_BENCHMARK_SYNC_MAX);
+	for (i = 0; i < AMDGPU_BENCHMARK_SYNC_MAX; i++) {
+		fences[i] = kzalloc(sizeof(*fences[i]), GFP_KERNEL);
+		if (!fences[i]) {
+			r = -ENOMEM;
+			goto out_free;
+		}
+		dma_fence_init(fences[i], &amdgpu_benchmark_fence_ops, &lock,
+			       context + i, 1);
+	}
+
+	for (s = 0; s < ARRAY_SIZE(amdgpu_benchmark_sync_sizes); s++) {
+		count = amdgpu_benchmark_sync_sizes[s];
+		start = ktime_get();
+		for (i = 0; i < n && !r; i++) {
+			amdgpu_sync_create(&sync);
+			for (j = 0; j < count * 2 && !r; j++)
+				r = amdgpu_sync_fence(NULL, &sync,
+						      fences[j % count]);
+
+			amdgpu_sync_peek_fence(&sync, NULL);
+			while ((f = amdgpu_sync_get_fence(&sync)))
+				dma_fence_put(f);
+			amdgpu_sync_free(&sync);
+		}
+		if (r)
+			break;
+
+		snprintf(kind, sizeof(kind), "sync_%u", count);
+		amdgpu_benchmark_log_results(m, n, 0,
+					     ktime_us_delta(ktime_get(), start),
+					     0, 0, kind);
+	}
+
+out_free:
+	for (i = 0; i < AMDGPU_BENCHMARK_SYNC_MAX && fences[i]; i++) {
+		dma_fence_signal(fences[i]);
+		dma_fence_put(fences[i]);
+	}
+	kfree(fences);
+	return r;
+}
+
+/* Shared fences of the reservation object, every other one signaled */
+static const unsigned amdgpu_benchmark_resv_sizes[] = { 4, 32, 128 };
+
+#define AMDGPU_BENCHMARK_RESV_MAX	128
+
+/*
+ * Collect the fences of a synthetic reservation object into a sync object,
+ * with the reservation lock held and from an RCU snapshot. Signaled fences
+ * are filtered out before they reach the sync object.
+ */
+static int amdgpu_benchmark_resv(struct seq_file *m)
+{
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS;
+	struct reservation_object *resv;
+	struct dma_fence **fences;
+	struct amdgpu_sync sync;
+	unsigned s, i, count;
+	s64 time, time_rcu;
+	spinlock_t lock;
+	ktime_t start;
+	u64 context;
+	char kind[32];
+	int r = 0;
+
+	resv = kzalloc(sizeof(*resv), GFP_KERNEL);
+	fences = kcalloc(AMDGPU_BENCHMARK_RESV_MAX, sizeof(*fences),
+			 GFP_KERNEL);
+	if (!resv || !fences) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+
+	spin_lock_init(&lock);
+	context = kcl_fence_context_alloc(AMDGPU_BENCHMARK_RESV_MAX);
+	for (i = 0; i < AMDGPU_BENCHMARK_RESV_MAX; i++) {
+		fences[i] = kzalloc(sizeof(*fences[i]), GFP_KERNEL);
+		if (!fences[i]) {
+			r = -ENOMEM;
+			goto out_free;
+		}
+		dma_fence_init(fences[i], &amdgpu_benchmark_fence_ops, &lock,
+			       context + i, 1);
+		if (i & 1)
+			dma_fence_signal(fences[i]);
+	}
+
+	for (s = 0; s < ARRAY_SIZE(amdgpu_benchmark_resv_sizes) && !r; s++) {
+		count = amdgpu_benchmark_resv_sizes[s];
+
+		reservation_object_init(resv);
+		ww_mutex_lock(&resv->lock, NULL);
+		for (i = 0; i < count && !r; i++) {
+			r = reservation_object_reserve_shared(resv);
+			if (!r)
+				reservation_object_add_shared_fence(resv,
+								    fences[i]);
+		}
+
+		start = ktime_get();
+		for (i = 0; i < n && !r; i++) {
+			amdgpu_sync_create(&sync);
+			r = amdgpu_sync_resv(NULL, &sync, resv,
+					     AMDGPU_FENCE_OWNER_UNDEFINED);
+			amdgpu_sync_free(&sync);
+		}
+		time = ktime_us_delta(ktime_get(), start);
+		ww_mutex_unlock(&resv->lock);
+
+		start = ktime_get();
+		for (i = 0; i < n && !r; i++) {
+			amdgpu_sync_create(&sync);
+			r = amdgpu_sync_resv_rcu(NULL, &sync, resv,
+						 AMDGPU_FENCE_OWNER_UNDEFINED);
+			amdgpu_sync_free(&sync);
+		}
+		time_rcu = ktime_us_delta(ktime_get(), start);
+		reservation_object_fini(resv);
+		if (r)
+			break;
+
+		snprintf(kind, sizeof(kind), "sync_resv_%u", count);
+		amdgpu_benchmark_log_results(m, n, 0, time, 0, 0, kind);
+		snprintf(kind, sizeof(kind), "sync_resv_rcu_%u", count);
+		amdgpu_benchmark_log_results(m, n, 0, time_rcu, 0, 0, kind);
+	}
+
+out_free:
+	for (i = 0; fences && i < AMDGPU_BENCHMARK_RESV_MAX && fences[i];
+	     i++) {
+		dma_fence_signal(fences[i]);
+		dma_fence_put(fences[i]);
+	}
+	kfree(fences);
+	kfree(resv);
+	return r;
+}
+
+/**
+ * amdgpu_benchmark_software - benchmark the device independent CPU paths
+ *
+ * @m: seq_file for CSV output, NULL to log the results
+ *
+ * Nothing here needs a device, so this is also run at module load when the
+ * benchmark parameter is 13, even without any GPU present.
+ */
+void amdgpu_benchmark_software(struct seq_file *m)
+{
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS;
+	spinlock_t lock;
+	ktime_t start;
+	u64 context;
+	unsigned i;
+	int r;
+
+	spin_lock_init(&lock);
+	context = kcl_fence_context_alloc(1);
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		struct dma_fence *fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+
+		if (!fence) {
+			r = -ENOMEM;
+			goto error;
+		}
+		dma_fence_init(fence, &amdgpu_benchmark_fence_ops, &lock,
+			       context, i + 1);
+		dma_fence_signal(fence);
+		dma_fence_put(fence);
+	}
+	amdgpu_benchmark_log_results(m, n, 0,
+				     ktime_us_delta(ktime_get(), start),
+				     0, 0, "fence");
+
+	r = amdgpu_benchmark_fence_process(m);
+	if (r)
+		goto error;
+
+	r = amdgpu_benchmark_sync(m);
+	if (r)
+		goto error;
+
+	r = amdgpu_benchmark_resv(m);
+	if (r)
+		goto error;
+	return;
+
+error:
+	DRM_ERROR("Error while benchmarking the software path (%d).\n", r);
+}
+
+/*
+ * Submission of a job with a NOP IB to the buffer funcs ring and waiting for
+ * it, the kernel side round trip of a CS without the ioctl and BO list.
+ */
+static int amdgpu_benchmark_submit_roundtrip(struct amdgpu_device *adev,
+					     struct seq_file *m)
+{
+	struct amdgpu_ring *ring = adev->mman.buffer_funcs_ring;
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS;
+	struct dma_fence *fence;
+	struct amdgpu_job *job;
+	ktime_t start;
+	unsigned i;
+	int r;
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		r = amdgpu_job_alloc_with_ib(adev, 64, &job);
+		if (r)
+			return r;
+
+		job->ibs[0].ptr[job->ibs[0].length_dw++] = ring->funcs->nop;
+		amdgpu_ring_pad_ib(ring, &job->ibs[0]);
+		r = amdgpu_job_submit(job, ring, &adev->mman.entity,
+				      AMDGPU_FENCE_OWNER_UNDEFINED, &fence);
+		if (r) {
+			amdgpu_job_free(job);
+			return r;
+		}
+
+		r = dma_fence_wait(fence, false);
+		dma_fence_put(fence);
+		if (r)
+			return r;
+	}
+	amdgpu_benchmark_log_results(m, n, 0,
+				     ktime_us_delta(ktime_get(), start),
+				     0, 0, "submit_roundtrip");
+	return 0;
+}
+
+/* GPU VA of the BO in the page table update benchmark */
+#define AMDGPU_BENCHMARK_VM_VA	(1ULL << 32)
+
+/*
+ * Rewrite the PTEs of a BO in a scratch VM and wait for the update, this
+ * goes through SDMA unless the VM is configured for CPU updates.
+ */
+static int amdgpu_benchmark_vm_update(struct amdgpu_device *adev,
+				      struct seq_file *m, unsigned size,
+				      unsigned domain)
+{
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS / 16;
+	struct amdgpu_bo_list_entry pd;
+	struct ttm_validate_buffer tv;
+	struct ww_acquire_ctx ticket;
+	struct amdgpu_bo_va *bo_va;
+	struct amdgpu_bo *bo = NULL;
+	struct list_head list;
+	struct amdgpu_vm *vm;
+	ktime_t start;
+	unsigned i;
+	int r;
+
+	vm = kzalloc(sizeof(*vm), GFP_KERNEL);
+	if (!vm)
+		return -ENOMEM;
+
+	r = amdgpu_vm_init(adev, vm, AMDGPU_VM_CONTEXT_GFX);
+	if (r)
+		goto out_free;
+
+	r = amdgpu_bo_create(adev, size, PAGE_SIZE, true, domain, 0, NULL,
+			     NULL, 0, &bo);
+	if (r)
+		goto out_fini;
+
+	INIT_LIST_HEAD(&list);
+	INIT_LIST_HEAD(&tv.head);
+	tv.bo = &bo->tbo;
+	tv.shared = true;
+	list_add(&tv.head, &list);
+	amdgpu_vm_get_pd_bo(vm, &list, &pd);
+
+	r = ttm_eu_reserve_buffers(&ticket, &list, false, NULL);
+	if (r)
+		goto out_unref;
+
+	bo_va = amdgpu_vm_bo_add(adev, vm, bo);
+	if (!bo_va) {
+		r = -ENOMEM;
+		goto out_backoff;
+	}
+
+	r = amdgpu_vm_alloc_pts(adev, vm, AMDGPU_BENCHMARK_VM_VA, size);
+	if (r)
+		goto out_rmv;
+
+	r = amdgpu_vm_bo_map(adev, bo_va, AMDGPU_BENCHMARK_VM_VA, 0, size,
+			     AMDGPU_PTE_READABLE | AMDGPU_PTE_WRITEABLE);
+	if (r)
+		goto out_rmv;
+
+	r = amdgpu_vm_update_directories(adev, vm);
+	if (r)
+		goto out_rmv;
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		/* pretend the BO moved, so that all PTEs are written again */
+		amdgpu_vm_bo_invalidate(adev, bo, false);
+		r = amdgpu_vm_bo_update(adev, bo_va, false);
+		if (r)
+			break;
+		if (bo_va->last_pt_update) {
+			r = dma_fence_wait(bo_va->last_pt_update, false);
+			if (r)
+				break;
+		}
+	}
+	if (!r)
+		amdgpu_benchmark_log_results(m, n, size,
+					     ktime_us_delta(ktime_get(), start),
+					     domain, 0,
+					     vm->use_cpu_for_update ?
+					     "vm_update_cpu" : "vm_update_sdma");
+
+out_rmv:
+	amdgpu_vm_bo_rmv(adev, bo_va);
+out_backoff:
+	ttm_eu_backoff_reservation(&ticket, &list);
+out_unref:
+	amdgpu_bo_unref(&bo);
+out_fini:
+	amdgpu_vm_fini(adev, vm);
+out_free:
+	kfree(vm);
+	return r;
+}
+
+/* Mappings of the same BO in the lookup benchmark, 1MB apart */
+#define AMDGPU_BENCHMARK_LOOKUP_MAPPINGS	64
+#define AMDGPU_BENCHMARK_LOOKUP_STRIDE		(1ULL << 20)
+
+/*
+ * Mapping lookups as done for UVD and VCE relocations: the same address
+ * again and again, served by the lookup cache, addresses of different
+ * mappings in turn, which miss the cache, and one batched lookup of all the
+ * mappings.
+ */
+static int amdgpu_benchmark_vm_lookup(struct amdgpu_device *adev,
+				      struct seq_file *m)
+{
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS * 16;
+	const unsigned count = AMDGPU_BENCHMARK_LOOKUP_MAPPINGS;
+	struct amdgpu_bo_va_mapping **mappings = NULL;
+	struct amdgpu_bo_va_mapping *mapping;
+	struct amdgpu_bo_list_entry pd;
+	struct ttm_validate_buffer tv;
+	struct ww_acquire_ctx ticket;
+	struct amdgpu_bo_va *bo_va;
+	struct amdgpu_bo *bo = NULL;
+	uint64_t *addrs = NULL;
+	struct list_head list;
+	struct amdgpu_vm *vm;
+	unsigned i, found;
+	ktime_t start;
+	int r;
+
+	vm = kzalloc(sizeof(*vm), GFP_KERNEL);
+	addrs = kcalloc(count, sizeof(*addrs), GFP_KERNEL);
+	mappings = kcalloc(count, sizeof(*mappings), GFP_KERNEL);
+	if (!vm || !addrs || !mappings) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+
+	r = amdgpu_vm_init(adev, vm, AMDGPU_VM_CONTEXT_GFX);
+	if (r)
+		goto out_free;
+
+	r = amdgpu_bo_create(adev, PAGE_SIZE, PAGE_SIZE, true,
+			     AMDGPU_GEM_DOMAIN_GTT, 0, NULL, NULL, 0, &bo);
+	if (r)
+		goto out_fini;
+
+	INIT_LIST_HEAD(&list);
+	INIT_LIST_HEAD(&tv.head);
+	tv.bo = &bo->tbo;
+	tv.shared = true;
+	list_add(&tv.head, &list);
+	amdgpu_vm_get_pd_bo(vm, &list, &pd);
+
+	r = ttm_eu_reserve_buffers(&ticket, &list, false, NULL);
+	if (r)
+		goto out_unref;
+
+	bo_va = amdgpu_vm_bo_add(adev, vm, bo);
+	if (!bo_va) {
+		r = -ENOMEM;
+		goto out_backoff;
+	}
+
+	for (i = 0; i < count; i++) {
+		uint64_t va = AMDGPU_BENCHMARK_VM_VA +
+			i * AMDGPU_BENCHMARK_LOOKUP_STRIDE;
+
+		r = amdgpu_vm_bo_map(adev, bo_va, va, 0, PAGE_SIZE,
+				     AMDGPU_PTE_READABLE);
+		if (r)
+			goto out_rmv;
+		addrs[i] = va / AMDGPU_GPU_PAGE_SIZE;
+	}
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		mapping = amdgpu_vm_bo_lookup_mapping(vm, addrs[0]);
+		if (!mapping) {
+			r = -EINVAL;
+			goto out_rmv;
+		}
+	}
+	amdgpu_benchmark_log_results(m, n, 0,
+				     ktime_us_delta(ktime_get(), start),
+				     0, 0, "vm_lookup_hit");
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		mapping = amdgpu_vm_bo_lookup_mapping(vm, addrs[i % count]);
+		if (!mapping) {
+			r = -EINVAL;
+			goto out_rmv;
+		}
+	}
+	amdgpu_benchmark_log_results(m, n, 0,
+				     ktime_us_delta(ktime_get(), start),
+				     0, 0, "vm_lookup_miss");
+
+	start = ktime_get();
+	for (i = 0; i < n / count; i++) {
+		found = amdgpu_vm_bo_lookup_mappings(vm, addrs, count,
+						     mappings);
+		if (found != count) {
+			r = -EINVAL;
+			goto out_rmv;
+		}
+	}
+	amdgpu_benchmark_log_results(m, n / count * count, 0,
+				     ktime_us_delta(ktime_get(), start),
+				     0, 0, "vm_lookup_batch");
+
+out_rmv:
+	amdgpu_vm_bo_rmv(adev, bo_va);
+out_backoff:
+	ttm_eu_backoff_reservation(&ticket, &list);
+out_unref:
+	amdgpu_bo_unref(&bo);
+out_fini:
+	amdgpu_vm_fini(adev, vm);
+out_free:
+	kfree(mappings);
+	kfree(addrs);
+	kfree(vm);
+	return r;
+}
+
+/*
+ * Overhead of the submission path on a device. Job allocation, packet
+ * emission and PTE generation don't touch the rings and also work with
+ * acceleration disabled, the round trip and page table updates need it.
+ */
+static void amdgpu_benchmark_submit(struct amdgpu_device *adev,
+				    struct seq_file *m)
+{
+	const unsigned n = AMDGPU_BENCHMARK_ITERATIONS;
+	unsigned i, j, num_dw, num_pages = AMDGPU_GTT_MAX_TRANSFER_SIZE;
+	struct amdgpu_job *job;
+	dma_addr_t *dma_addr;
+	ktime_t start;
+	u64 size;
+	void *ptes;
+	int r;
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		r = amdgpu_job_alloc_with_ib(adev, 256, &job);
+		if (r)
+			goto error;
+		amdgpu_job_free(job);
+	}
+	amdgpu_benchmark_log_results(m, n, 0,
+				     ktime_us_delta(ktime_get(), start),
+				     0, 0, "job_alloc");
+
+	if (adev->mman.buffer_funcs) {
+		num_dw = AMDGPU_BENCHMARK_SW_PACKETS *
+			adev->mman.buffer_funcs->copy_num_dw;
+		r = amdgpu_job_alloc_with_ib(adev, num_dw * 4, &job);
+		if (r)
+			goto error;
+
+		start = ktime_get();
+		for (i = 0; i < n; i++) {
+			job->ibs[0].length_dw = 0;
+			for (j = 0; j < AMDGPU_BENCHMARK_SW_PACKETS; j++)
+				amdgpu_emit_copy_buffer(adev, &job->ibs[0], 0,
+							0, PAGE_SIZE);
+		}
+		amdgpu_benchmark_log_results(m, n * AMDGPU_BENCHMARK_SW_PACKETS,
+					     0, ktime_us_delta(ktime_get(), start),
+					     0, 0, "ib_emit");
+		amdgpu_job_free(job);
+	}
+
+	dma_addr = kcalloc(num_pages, sizeof(*dma_addr), GFP_KERNEL);
+	ptes = kcalloc(num_pages, 8 * (PAGE_SIZE / AMDGPU_GPU_PAGE_SIZE),
+		       GFP_KERNEL);
+	if (dma_addr && ptes) {
+		for (i = 0; i < num_pages; i++)
+			dma_addr[i] = (dma_addr_t)i << PAGE_SHIFT;
+
+		start = ktime_get();
+		for (i = 0; i < n; i++) {
+			r = amdgpu_gart_map(adev, 0, num_pages, dma_addr, 0,
+					    ptes);
+			if (r)
+				break;
+		}
+		if (!r)
+			amdgpu_benchmark_log_results(m, n,
+						     (u64)num_pages << PAGE_SHIFT,
+						     ktime_us_delta(ktime_get(),
+								    start),
+						     0, 0, "pte_write");
+	}
+	kfree(ptes);
+	kfree(dma_addr);
+
+	if (!adev->accel_working || !adev->mman.buffer_funcs_ring)
+		return;
+
+	r = amdgpu_benchmark_submit_roundtrip(adev, m);
+	if (r)
+		goto error;
+
+	r = amdgpu_benchmark_vm_lookup(adev, m);
+	if (r)
+		goto error;
+
+	/* 4KB to 64MB of PTEs, one page table is 2MB */
+	for (size = AMDGPU_BENCHMARK_SWEEP_MIN; size <= (64ULL << 20);
+	     size <<= 2) {
+		r = amdgpu_benchmark_vm_update(adev, m, size,
+					       AMDGPU_GEM_DOMAIN_VRAM);
+		if (r)
+			goto error;
+		r = amdgpu_benchmark_vm_update(adev, m, size,
+					       AMDGPU_GEM_DOMAIN_GTT);
+		if (r)
+			goto error;
+	}
+	return;
+
+error:
+	DRM_ERROR("Error while benchmarking the submission path (%d).\n", r);
+}
+
+static void amdgpu_benchmark_evict(struct amdgpu_device *adev,
+				   struct seq_file *m, unsigned size, unsigned n)
+{
+	struct ttm_mem_type_manager *man = &adev->mman.bdev.man[TTM_PL_VRAM];
+	struct amdgpu_bo **bos;
+	u64 before, evicted;
+	ktime_t start;
+	unsigned i;
+	s64 time;
+	int r = 0;
+
+	bos = kcalloc(n, sizeof(*bos), GFP_KERNEL);
+	if (!bos)
+		return;
+
+	for (i = 0; i < n; i++) {
+		r = amdgpu_bo_create(adev, size, PAGE_SIZE, true,
+				     AMDGPU_GEM_DOMAIN_VRAM, 0, NULL,
+				     NULL, 0, &bos[i]);
+		if (r)
+			goto out_cleanup;
+	}
+
+	before = amdgpu_vram_mgr_usage(man);
+	start = ktime_get();
+	r = amdgpu_bo_evict_vram(adev);
+	if (r)
+		goto out_cleanup;
+
+	time = ktime_us_delta(ktime_get(), start);
+	evicted = before - amdgpu_vram_mgr_usage(man);
+	amdgpu_benchmark_log_results(m, 1, evicted, time,
+				     AMDGPU_GEM_DOMAIN_VRAM,
+				     AMDGPU_GEM_DOMAIN_GTT, "evict");
+
+out_cleanup:
+	if (r)
+		DRM_ERROR("Error while benchmarking VRAM eviction.\n");
+
+	for (i = 0; i < n; i++)
+		amdgpu_bo_unref(&bos[i]);
+	kfree(bos);
+}
+
+/* Scratch VRAM manager of 512MB for the allocation trace */
+#define AMDGPU_BENCHMARK_TRACE_PAGES	(512UL << (20 - PAGE_SHIFT))
+/* BOs alive at the same time and allocations/frees of the trace */
+#define AMDGPU_BENCHMARK_TRACE_SLOTS	256
+#define AMDGPU_BENCHMARK_TRACE_STEPS	(16 * 1024)
+
+/*
+ * Size of the next BO in the trace, mostly small BOs, some medium ones up to
+ * 2MB and a few big ones up to 32MB.
+ */
+static unsigned long amdgpu_benchmark_trace_pages(struct rnd_state *rnd)
+{
+	unsigned kind = prandom_u32_state(rnd) % 10;
+	u32 v = prandom_u32_state(rnd);
+
+	if (kind < 6)
+		return 1 + v % 16;
+	if (kind < 9)
+		return 16 + v % 496;
+	return 512 + v % 7680;
+}
+
+/*
+ * Replay a fixed pseudo random allocation trace against a scratch VRAM
+ * manager, using drm_mm or the buddy allocator depending on the vram_buddy
+ * parameter. Some BOs are contiguous or allocated top down. Allocations which
+ * don't fit are counted as well, they show the fragmentation.
+ */
+static int amdgpu_benchmark_vram_mgr(struct amdgpu_device *adev,
+				     struct seq_file *m)
+{
+	const char *backend = amdgpu_vram_buddy == 1 ? "buddy" : "drm_mm";
+	struct ttm_mem_type_manager *man;
+	struct ttm_mem_reg *mems;
+	struct ttm_place place;
+	unsigned i, slot, failed = 0;
+	struct rnd_state rnd;
+	char kind[32];
+	ktime_t start;
+	s64 time;
+	int r;
+
+	man = kzalloc(sizeof(*man), GFP_KERNEL);
+	mems = kcalloc(AMDGPU_BENCHMARK_TRACE_SLOTS, sizeof(*mems),
+		       GFP_KERNEL);
+	if (!man || !mems) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+
+	man->bdev = &adev->mman.bdev;
+	man->size = AMDGPU_BENCHMARK_TRACE_PAGES;
+	r = amdgpu_vram_mgr_func.init(man, man->size);
+	if (r)
+		goto out_free;
+
+	prandom_seed_state(&rnd, 0x616d64677075ULL);
+	start = ktime_get();
+	for (i = 0; i < AMDGPU_BENCHMARK_TRACE_STEPS; i++) {
+		struct ttm_mem_reg *mem;
+		u32 v;
+
+		slot = prandom_u32_state(&rnd) % AMDGPU_BENCHMARK_TRACE_SLOTS;
+		mem = &mems[slot];
+		if (mem->mm_node) {
+			amdgpu_vram_mgr_func.put_node(man, mem);
+			continue;
+		}
+
+		v = prandom_u32_state(&rnd);
+		memset(&place, 0, sizeof(place));
+		if (!(v % 8))
+			place.flags |= TTM_PL_FLAG_CONTIGUOUS;
+		if (!(v % 4))
+			place.flags |= TTM_PL_FLAG_TOPDOWN;
+
+		memset(mem, 0, sizeof(*mem));
+		mem->num_pages = amdgpu_benchmark_trace_pages(&rnd);
+		mem->page_alignment = 1;
+		r = amdgpu_vram_mgr_func.get_node(man, NULL, &place, mem);
+		if (r)
+			break;
+		if (!mem->mm_node)
+			++failed;
+	}
+	time = ktime_us_delta(ktime_get(), start);
+
+	for (slot = 0; slot < AMDGPU_BENCHMARK_TRACE_SLOTS; slot++)
+		amdgpu_vram_mgr_func.put_node(man, &mems[slot]);
+	amdgpu_vram_mgr_func.takedown(man);
+
+	if (!r) {
+		snprintf(kind, sizeof(kind), "vram_trace_%s", backend);
+		amdgpu_benchmark_log_results(m, i, 0, time, 0,
+					     AMDGPU_GEM_DOMAIN_VRAM, kind);
+		snprintf(kind, sizeof(kind), "vram_trace_%s_failed", backend);
+		amdgpu_benchmark_log_results(m, failed, 0, 0, 0,
+					     AMDGPU_GEM_DOMAIN_VRAM, kind);
+	}
+
+out_free:
+	kfree(mems);
+	kfree(man);
+	if (r)
+		DRM_ERROR("Error while replaying the VRAM allocation trace (%d).\n",
+			  r);
+	return r;
+}
+
+/* Each populate worker allocates and frees 2MB of pages this many times */
+#define AMDGPU_BENCHMARK_POPULATE_SIZE	(2UL << 20)
+#define AMDGPU_BENCHMARK_POPULATE_LOOPS	64
+
+static const unsigned amdgpu_benchmark_populate_threads[] = { 1, 2, 4, 8 };
+
+struct amdgpu_benchmark_populate {
+	struct work_struct	work;
+	struct amdgpu_device	*adev;
+	uint32_t		caching;
+	int			r;
+};
+
+static void amdgpu_benchmark_populate_work(struct work_struct *work)
+{
+	struct amdgpu_benchmark_populate *p =
+		container_of(work, struct amdgpu_benchmark_populate, work);
+	struct ttm_bo_device *bdev = &p->adev->mman.bdev;
+	struct ttm_tt *ttm;
+	unsigned i;
+
+	ttm = bdev->driver->ttm_tt_create(bdev, AMDGPU_BENCHMARK_POPULATE_SIZE,
+					  0, bdev->glob->dummy_read_page);
+	if (!ttm) {
+		p->r = -ENOMEM;
+		return;
+	}
+
+	p->r = ttm_tt_set_placement_caching(ttm, p->caching);
+	for (i = 0; i < AMDGPU_BENCHMARK_POPULATE_LOOPS && !p->r; i++) {
+		p->r = bdev->driver->ttm_tt_populate(ttm);
+		if (!p->r)
+			bdev->driver->ttm_tt_unpopulate(ttm);
+	}
+
+	ttm_tt_destroy(ttm);
+}
+
+/*
+ * Populate and unpopulate TTMs from several CPUs at once. Write combined
+ * pages go through the per CPU magazines and the TTM page pools, cached
+ * pages come straight from the page allocator and serve as reference.
+ */
+static int amdgpu_benchmark_populate(struct amdgpu_device *adev,
+				     struct seq_file *m, uint32_t caching)
+{
+	unsigned t, i, cpu, threads, max_threads;
+	struct amdgpu_benchmark_populate *p;
+	char kind[32];
+	ktime_t start;
+	int r = 0;
+
+	max_threads = amdgpu_benchmark_populate_threads[
+		ARRAY_SIZE(amdgpu_benchmark_populate_threads) - 1];
+	p = kcalloc(max_threads, sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+
+	for (t = 0; t < ARRAY_SIZE(amdgpu_benchmark_populate_threads); t++) {
+		threads = amdgpu_benchmark_populate_threads[t];
+		if (threads > num_online_cpus())
+			break;
+
+		/* one worker on each of the first CPUs */
+		start = ktime_get();
+		cpu = cpumask_first(cpu_online_mask);
+		for (i = 0; i < threads; i++) {
+			p[i].adev = adev;
+			p[i].caching = caching;
+			p[i].r = 0;
+			INIT_WORK(&p[i].work, amdgpu_benchmark_populate_work);
+			queue_work_on(cpu, system_wq, &p[i].work);
+			cpu = cpumask_next(cpu, cpu_online_mask);
+		}
+		for (i = 0; i < threads; i++) {
+			flush_work(&p[i].work);
+			if (p[i].r)
+				r = p[i].r;
+		}
+		if (r)
+			break;
+
+		snprintf(kind, sizeof(kind), "populate_%s_%u",
+			 caching == TTM_PL_FLAG_CACHED ? "cached" : "wc",
+			 threads);
+		amdgpu_benchmark_log_results(m, threads *
+					     AMDGPU_BENCHMARK_POPULATE_LOOPS,
+					     AMDGPU_BENCHMARK_POPULATE_SIZE,
+					     ktime_us_delta(ktime_get(), start),
+					     AMDGPU_GEM_DOMAIN_CPU,
+					     AMDGPU_GEM_DOMAIN_GTT, kind);
+	}
+
+	kfree(p);
+	if (r)
+		DRM_ERROR("Error while benchmarking page population (%d).\n",
+			  r);
+	return r;
+}
+
+static void amdgpu_benchmark_run(struct amdgpu_device *adev,
+				 struct seq_file *m, int test_number)
 {
 	int i;
 	static const int common_modes[AMDGPU_BENCHMARK_COMMON_MODES_N] = {
@@ -166,60 +1321,179 @@ void amdgpu_benchmark(struct amdgpu_device *adev, int test_number)
 	switch (test_number) {
 	case 1:
 		/* simple test, VRAM to GTT and GTT to VRAM */
-		amdgpu_benchmark_move(adev, 1024*1024, AMDGPU_GEM_DOMAIN_GTT,
+		amdgpu_benchmark_move(adev, m, 1024*1024,
+				      AMDGPU_BENCHMARK_ITERATIONS,
+				      AMDGPU_GEM_DOMAIN_GTT,
 				      AMDGPU_GEM_DOMAIN_VRAM);
-		amdgpu_benchmark_move(adev, 1024*1024, AMDGPU_GEM_DOMAIN_VRAM,
+		amdgpu_benchmark_move(adev, m, 1024*1024,
+				      AMDGPU_BENCHMARK_ITERATIONS,
+				      AMDGPU_GEM_DOMAIN_VRAM,
 				      AMDGPU_GEM_DOMAIN_GTT);
 		break;
 	case 2:
 		/* simple test, VRAM to VRAM */
-		amdgpu_benchmark_move(adev, 1024*1024, AMDGPU_GEM_DOMAIN_VRAM,
+		amdgpu_benchmark_move(adev, m, 1024*1024,
+				      AMDGPU_BENCHMARK_ITERATIONS,
+				      AMDGPU_GEM_DOMAIN_VRAM,
 				      AMDGPU_GEM_DOMAIN_VRAM);
 		break;
 	case 3:
 		/* GTT to VRAM, buffer size sweep, powers of 2 */
 		for (i = 1; i <= 16384; i <<= 1)
-			amdgpu_benchmark_move(adev, i * AMDGPU_GPU_PAGE_SIZE,
+			amdgpu_benchmark_move(adev, m, i * AMDGPU_GPU_PAGE_SIZE,
+					      AMDGPU_BENCHMARK_ITERATIONS,
 					      AMDGPU_GEM_DOMAIN_GTT,
 					      AMDGPU_GEM_DOMAIN_VRAM);
 		break;
 	case 4:
 		/* VRAM to GTT, buffer size sweep, powers of 2 */
 		for (i = 1; i <= 16384; i <<= 1)
-			amdgpu_benchmark_move(adev, i * AMDGPU_GPU_PAGE_SIZE,
+			amdgpu_benchmark_move(adev, m, i * AMDGPU_GPU_PAGE_SIZE,
+					      AMDGPU_BENCHMARK_ITERATIONS,
 					      AMDGPU_GEM_DOMAIN_VRAM,
 					      AMDGPU_GEM_DOMAIN_GTT);
 		break;
 	case 5:
 		/* VRAM to VRAM, buffer size sweep, powers of 2 */
 		for (i = 1; i <= 16384; i <<= 1)
-			amdgpu_benchmark_move(adev, i * AMDGPU_GPU_PAGE_SIZE,
+			amdgpu_benchmark_move(adev, m, i * AMDGPU_GPU_PAGE_SIZE,
+					      AMDGPU_BENCHMARK_ITERATIONS,
 					      AMDGPU_GEM_DOMAIN_VRAM,
 					      AMDGPU_GEM_DOMAIN_VRAM);
 		break;
 	case 6:
 		/* GTT to VRAM, buffer size sweep, common modes */
 		for (i = 0; i < AMDGPU_BENCHMARK_COMMON_MODES_N; i++)
-			amdgpu_benchmark_move(adev, common_modes[i],
+			amdgpu_benchmark_move(adev, m, common_modes[i],
+					      AMDGPU_BENCHMARK_ITERATIONS,
 					      AMDGPU_GEM_DOMAIN_GTT,
 					      AMDGPU_GEM_DOMAIN_VRAM);
 		break;
 	case 7:
 		/* VRAM to GTT, buffer size sweep, common modes */
 		for (i = 0; i < AMDGPU_BENCHMARK_COMMON_MODES_N; i++)
-			amdgpu_benchmark_move(adev, common_modes[i],
+			amdgpu_benchmark_move(adev, m, common_modes[i],
+					      AMDGPU_BENCHMARK_ITERATIONS,
 					      AMDGPU_GEM_DOMAIN_VRAM,
 					      AMDGPU_GEM_DOMAIN_GTT);
 		break;
 	case 8:
 		/* VRAM to VRAM, buffer size sweep, common modes */
 		for (i = 0; i < AMDGPU_BENCHMARK_COMMON_MODES_N; i++)
-			amdgpu_benchmark_move(adev, common_modes[i],
+			amdgpu_benchmark_move(adev, m, common_modes[i],
+					      AMDGPU_BENCHMARK_ITERATIONS,
 					      AMDGPU_GEM_DOMAIN_VRAM,
 					      AMDGPU_GEM_DOMAIN_VRAM);
 		break;
+	case 9:
+		/* VRAM eviction, 256 BOs of 4MB */
+		amdgpu_benchmark_evict(adev, m, 4 * 1024 * 1024, 256);
+		break;
+	case 10:
+		/* copy, 4KB to 1GB size sweep between all domains */
+		amdgpu_benchmark_sweep(adev, m, test_number,
+				       AMDGPU_GEM_DOMAIN_GTT,
+				       AMDGPU_GEM_DOMAIN_VRAM);
+		amdgpu_benchmark_sweep(adev, m, test_number,
+				       AMDGPU_GEM_DOMAIN_VRAM,
+				       AMDGPU_GEM_DOMAIN_GTT);
+		amdgpu_benchmark_sweep(adev, m, test_number,
+				       AMDGPU_GEM_DOMAIN_VRAM,
+				       AMDGPU_GEM_DOMAIN_VRAM);
+		break;
+	case 11:
+		/* fill, 4KB to 1GB size sweep in VRAM and GTT */
+		amdgpu_benchmark_sweep(adev, m, test_number, 0,
+				       AMDGPU_GEM_DOMAIN_VRAM);
+		amdgpu_benchmark_sweep(adev, m, test_number, 0,
+				       AMDGPU_GEM_DOMAIN_GTT);
+		break;
+	case 12:
+		/* GART unbind and bind, 4KB to 1GB size sweep */
+		amdgpu_benchmark_sweep(adev, m, test_number, 0,
+				       AMDGPU_GEM_DOMAIN_GTT);
+		break;
+	case 13:
+		/* device independent CPU paths */
+		amdgpu_benchmark_software(m);
+		break;
+	case 14:
+		/* submission path, page table updates */
+		amdgpu_benchmark_submit(adev, m);
+		break;
+	case 15:
+		/* VRAM manager, allocation trace replay */
+		amdgpu_benchmark_vram_mgr(adev, m);
+		break;
+	case 16:
+		/* TTM page population from several CPUs */
+		amdgpu_benchmark_populate(adev, m, TTM_PL_FLAG_WC);
+		amdgpu_benchmark_populate(adev, m, TTM_PL_FLAG_CACHED);
+		break;
 
 	default:
 		DRM_ERROR("Unknown benchmark\n");
 	}
 }
+
+void amdgpu_benchmark(struct amdgpu_device *adev, int test_number)
+{
+	amdgpu_benchmark_run(adev, NULL, test_number);
+}
+
+#if defined(CONFIG_DEBUG_FS)
+
+static int amdgpu_benchmark_debugfs(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *)m->private;
+	int test_number = *(int *)node->info_ent->data;
+	struct drm_device *dev = node->minor->dev;
+	struct amdgpu_device *adev = dev->dev_private;
+
+	/* the benchmarks from 13 on check that themselves or don't need it */
+	if (test_number < 13 && !adev->accel_working) {
+		seq_puts(m, "acceleration disabled\n");
+		return 0;
+	}
+
+	seq_puts(m, "test,src,dst,bytes,count,usecs,MB/s,ns/op\n");
+	amdgpu_benchmark_run(adev, m, test_number);
+	return 0;
+}
+
+static int amdgpu_benchmark_copy_test = 10;
+static int amdgpu_benchmark_fill_test = 11;
+static int amdgpu_benchmark_gart_test = 12;
+static int amdgpu_benchmark_software_test = 13;
+static int amdgpu_benchmark_submit_test = 14;
+static int amdgpu_benchmark_vram_mgr_test = 15;
+static int amdgpu_benchmark_populate_test = 16;
+
+static const struct drm_info_list amdgpu_benchmark_debugfs_list[] = {
+	{"amdgpu_benchmark_copy", amdgpu_benchmark_debugfs, 0,
+	 &amdgpu_benchmark_copy_test},
+	{"amdgpu_benchmark_fill", amdgpu_benchmark_debugfs, 0,
+	 &amdgpu_benchmark_fill_test},
+	{"amdgpu_benchmark_gart", amdgpu_benchmark_debugfs, 0,
+	 &amdgpu_benchmark_gart_test},
+	{"amdgpu_benchmark_software", amdgpu_benchmark_debugfs, 0,
+	 &amdgpu_benchmark_software_test},
+	{"amdgpu_benchmark_submit", amdgpu_benchmark_debugfs, 0,
+	 &amdgpu_benchmark_submit_test},
+	{"amdgpu_benchmark_vram_mgr", amdgpu_benchmark_debugfs, 0,
+	 &amdgpu_benchmark_vram_mgr_test},
+	{"amdgpu_benchmark_populate", amdgpu_benchmark_debugfs, 0,
+	 &amdgpu_benchmark_populate_test},
+};
+
+#endif
+
+int amdgpu_benchmark_debugfs_init(struct amdgpu_device *adev)
+{
+#if defined(CONFIG_DEBUG_FS)
+	return amdgpu_debugfs_add_files(adev, amdgpu_benchmark_debugfs_list,
+					ARRAY_SIZE(amdgpu_benchmark_debugfs_list));
+#else
+	return 0;
+#endif
+}
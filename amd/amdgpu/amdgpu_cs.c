@@ -222,6 +222,28 @@ static s64 bytes_to_us(struct amdgpu_device *adev, u64 bytes)
 	return bytes >> adev->mm_stats.log2_max_MBps;
 }
 
+/* Share of the measured blit throughput given to optional moves, as shift */
+#define AMDGPU_MOVE_SHARE_SHIFT	6
+
+/* With an automatic move rate, follow the throughput the copy engine
+ * actually achieved for moves into VRAM instead of a fixed guess. The rate
+ * is never lowered below the 8 MB/s default. Needs mm_stats.lock held.
+ */
+static void amdgpu_cs_update_move_rate(struct amdgpu_device *adev)
+{
+	u32 MBps;
+
+	if (!adev->mm_stats.learn_rate)
+		return;
+
+	MBps = READ_ONCE(adev->mm_stats.blit_MBps[AMDGPU_MOVE_TO_VRAM]);
+	MBps >>= AMDGPU_MOVE_SHARE_SHIFT;
+	if (!MBps)
+		return;
+
+	adev->mm_stats.log2_max_MBps = ilog2(max(8u, MBps));
+}
+
 /* Returns how many bytes TTM can move right now. If no bytes can be moved,
  * it returns 0. If it returns non-zero, it's OK to move at least one buffer,
  * which means it can go over the threshold once. If that happens, the driver
@@ -263,6 +285,8 @@ static void amdgpu_cs_get_threshold_for_moves(struct amdgpu_device *adev,
 
 	spin_lock(&adev->mm_stats.lock);
 
+	amdgpu_cs_update_move_rate(adev);
+
 	/* Increase the amount of accumulated us. */
 	time_us = ktime_to_us(ktime_get());
 	increment_us = time_us - adev->mm_stats.last_update_us;
@@ -469,6 +493,37 @@ static int amdgpu_cs_validate(void *param, struct amdgpu_bo *bo)
 	return r;
 }
 
+/**
+ * amdgpu_cs_entry_resident - check if a BO needs validation
+ *
+ * @e: BO list entry
+ *
+ * BOs of a BO list which didn't move since the last submission validated
+ * them into their preferred domains don't need to be validated again.
+ */
+static bool amdgpu_cs_entry_resident(struct amdgpu_bo_list_entry *e)
+{
+	return e->resident && e->move_count == e->robj->move_count;
+}
+
+/**
+ * amdgpu_cs_entry_validated - remember where a BO was validated to
+ *
+ * @e: BO list entry
+ *
+ * BOs which ended up outside their preferred domains, e.g. because the
+ * move threshold was exceeded, are validated again by the next submission.
+ */
+static void amdgpu_cs_entry_validated(struct amdgpu_bo_list_entry *e)
+{
+	struct amdgpu_bo *bo = e->robj;
+	uint32_t domain = amdgpu_mem_type_to_domain(bo->tbo.mem.mem_type);
+
+	e->resident = !bo->shadow && !amdgpu_ttm_tt_get_usermm(bo->tbo.ttm) &&
+		(domain & bo->preferred_domains);
+	e->move_count = bo->move_count;
+}
+
 static int amdgpu_cs_list_validate(struct amdgpu_cs_parser *p,
 			    struct list_head *validated)
 {
@@ -501,10 +556,15 @@ static int amdgpu_cs_list_validate(struct amdgpu_cs_parser *p,
 		if (p->evictable == lobj)
 			p->evictable = NULL;
 
+		if (!binding_userptr && amdgpu_cs_entry_resident(lobj))
+			continue;
+
 		r = amdgpu_cs_validate(p, bo);
 		if (r)
 			return r;
 
+		amdgpu_cs_entry_validated(lobj);
+
 		if (binding_userptr) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 12, 0)
 			drm_free_large(lobj->user_pages);
@@ -793,7 +853,7 @@ static void amdgpu_cs_parser_fini(struct amdgpu_cs_parser *parser, int error,
 	amdgpu_bo_unref(&parser->uf_entry.robj);
 }
 
-static int amdgpu_bo_vm_update_pte(struct amdgpu_cs_parser *p)
+static int amdgpu_bo_vm_update_mappings(struct amdgpu_cs_parser *p)
 {
 	struct amdgpu_device *adev = p->adev;
 	struct amdgpu_fpriv *fpriv = p->filp->driver_priv;
@@ -802,10 +862,6 @@ static int amdgpu_bo_vm_update_pte(struct amdgpu_cs_parser *p)
 	struct amdgpu_bo *bo;
 	int i, r;
 
-	r = amdgpu_vm_update_directories(adev, vm);
-	if (r)
-		return r;
-
 	r = amdgpu_vm_clear_freed(adev, vm, NULL);
 	if (r)
 		return r;
@@ -814,30 +870,16 @@ static int amdgpu_bo_vm_update_pte(struct amdgpu_cs_parser *p)
 	if (r)
 		return r;
 
-	r = amdgpu_sync_fence(adev, &p->job->sync,
-			      fpriv->prt_va->last_pt_update);
-	if (r)
-		return r;
-
 	if (amdgpu_sriov_vf(adev)) {
-		struct dma_fence *f;
-
 		bo_va = fpriv->csa_va;
 		BUG_ON(!bo_va);
 		r = amdgpu_vm_bo_update(adev, bo_va, false);
 		if (r)
 			return r;
-
-		f = bo_va->last_pt_update;
-		r = amdgpu_sync_fence(adev, &p->job->sync, f);
-		if (r)
-			return r;
 	}
 
 	if (p->bo_list) {
 		for (i = 0; i < p->bo_list->num_entries; i++) {
-			struct dma_fence *f;
-
 			/* ignore duplicates */
 			bo = p->bo_list->array[i].robj;
 			if (!bo)
@@ -847,22 +889,79 @@ static int amdgpu_bo_vm_update_pte(struct amdgpu_cs_parser *p)
 			if (bo_va == NULL)
 				continue;
 
-			r = amdgpu_vm_bo_update(adev, bo_va, false);
-			if (r)
-				return r;
+			/* Skip BOs which didn't move and whose mappings didn't
+			 * change since the last submission.
+			 */
+			if (!bo_va->base.moved && !bo_va->cleared &&
+			    list_empty(&bo_va->invalids))
+				continue;
 
-			f = bo_va->last_pt_update;
-			r = amdgpu_sync_fence(adev, &p->job->sync, f);
+			r = amdgpu_vm_bo_update(adev, bo_va, false);
 			if (r)
 				return r;
 		}
 
 	}
 
-	r = amdgpu_vm_handle_moved(adev, vm);
+	return amdgpu_vm_handle_moved(adev, vm);
+}
+
+static int amdgpu_bo_vm_update_pte(struct amdgpu_cs_parser *p)
+{
+	struct amdgpu_device *adev = p->adev;
+	struct amdgpu_fpriv *fpriv = p->filp->driver_priv;
+	struct amdgpu_vm *vm = &fpriv->vm;
+	struct amdgpu_vm_update_batch batch;
+	struct amdgpu_bo_va *bo_va;
+	struct amdgpu_bo *bo;
+	int i, r, r2;
+
+	r = amdgpu_vm_update_directories(adev, vm);
 	if (r)
 		return r;
 
+	/* Collect all page table updates of the CS into as few jobs as
+	 * possible, the fences are only known after the commit.
+	 */
+	amdgpu_vm_batch_begin(vm, &batch);
+	r = amdgpu_bo_vm_update_mappings(p);
+	r2 = amdgpu_vm_batch_commit(adev, vm, NULL);
+	if (r)
+		return r;
+	if (r2)
+		return r2;
+
+	r = amdgpu_sync_fence(adev, &p->job->sync,
+			      fpriv->prt_va->last_pt_update);
+	if (r)
+		return r;
+
+	if (amdgpu_sriov_vf(adev)) {
+		r = amdgpu_sync_fence(adev, &p->job->sync,
+				      fpriv->csa_va->last_pt_update);
+		if (r)
+			return r;
+	}
+
+	if (p->bo_list) {
+		for (i = 0; i < p->bo_list->num_entries; i++) {
+			/* ignore duplicates */
+			bo = p->bo_list->array[i].robj;
+			if (!bo)
+				continue;
+
+			bo_va = p->bo_list->array[i].bo_va;
+			if (bo_va == NULL)
+				continue;
+
+			r = amdgpu_sync_fence(adev, &p->job->sync,
+					      bo_va->last_pt_update);
+			if (r)
+				return r;
+		}
+
+	}
+
 	r = amdgpu_sync_fence(adev, &p->job->sync, vm->last_update);
 	if (r)
 		return r;
@@ -1327,7 +1426,7 @@ int amdgpu_cs_wait_ioctl(struct drm_device *dev, void *data,
 	if (IS_ERR(fence))
 		r = PTR_ERR(fence);
 	else if (fence) {
-		r = kcl_fence_wait_timeout(fence, true, timeout);
+		r = amdgpu_fence_wait_polled(fence, true, timeout);
 		dma_fence_put(fence);
 	} else
 		r = 1;
@@ -1402,7 +1501,7 @@ static int amdgpu_cs_wait_all_fences(struct amdgpu_device *adev,
 		else if (!fence)
 			continue;
 
-		r = kcl_fence_wait_timeout(fence, true, timeout);
+		r = amdgpu_fence_wait_polled(fence, true, timeout);
 		dma_fence_put(fence);
 		if (r < 0)
 			return r;
@@ -1524,33 +1623,25 @@ err_free_fences:
 }
 
 /**
- * amdgpu_cs_find_bo_va - find bo_va for VM address
+ * amdgpu_cs_bind_mapping - make the BO of a mapping usable by the parser
  *
  * @parser: command submission parser context
- * @addr: VM address
- * @bo: resulting BO of the mapping found
+ * @mapping: mapping found for a VM address
+ * @bo: resulting BO of the mapping
  *
- * Search the buffer objects in the command submission context for a certain
- * virtual memory address. Returns allocation structure when found, NULL
- * otherwise.
+ * Make sure the BO is reserved by this CS, bound and contiguous, so that
+ * the parser can patch its address into the command stream.
  */
-int amdgpu_cs_find_mapping(struct amdgpu_cs_parser *parser,
-			   uint64_t addr, struct amdgpu_bo **bo,
-			   struct amdgpu_bo_va_mapping **map)
+int amdgpu_cs_bind_mapping(struct amdgpu_cs_parser *parser,
+			   struct amdgpu_bo_va_mapping *mapping,
+			   struct amdgpu_bo **bo)
 {
-	struct amdgpu_fpriv *fpriv = parser->filp->driver_priv;
-	struct amdgpu_vm *vm = &fpriv->vm;
-	struct amdgpu_bo_va_mapping *mapping;
 	int r;
 
-	addr /= AMDGPU_GPU_PAGE_SIZE;
-
-	mapping = amdgpu_vm_bo_lookup_mapping(vm, addr);
 	if (!mapping || !mapping->bo_va || !mapping->bo_va->base.bo)
 		return -EINVAL;
 
 	*bo = mapping->bo_va->base.bo;
-	*map = mapping;
 
 	/* Double check that the BO is reserved by this CS */
 	if (READ_ONCE((*bo)->tbo.resv->lock.ctx) != &parser->ticket)
@@ -1567,3 +1658,48 @@ int amdgpu_cs_find_mapping(struct amdgpu_cs_parser *parser,
 	amdgpu_ttm_placement_from_domain(*bo, (*bo)->allowed_domains);
 	return ttm_bo_validate(&(*bo)->tbo, &(*bo)->placement, false, false);
 }
+
+/**
+ * amdgpu_cs_find_bo_va - find bo_va for VM address
+ *
+ * @parser: command submission parser context
+ * @addr: VM address
+ * @bo: resulting BO of the mapping found
+ *
+ * Search the buffer objects in the command submission context for a certain
+ * virtual memory address. Returns allocation structure when found, NULL
+ * otherwise.
+ */
+int amdgpu_cs_find_mapping(struct amdgpu_cs_parser *parser,
+			   uint64_t addr, struct amdgpu_bo **bo,
+			   struct amdgpu_bo_va_mapping **map)
+{
+	struct amdgpu_fpriv *fpriv = parser->filp->driver_priv;
+	struct amdgpu_vm *vm = &fpriv->vm;
+
+	addr /= AMDGPU_GPU_PAGE_SIZE;
+
+	*map = amdgpu_vm_bo_lookup_mapping(vm, addr);
+	return amdgpu_cs_bind_mapping(parser, *map, bo);
+}
+
+/**
+ * amdgpu_cs_find_mappings - find the mappings of several VM addresses
+ *
+ * @parser: command submission parser context
+ * @addrs: VM addresses in GPU pages, sorted in ascending order
+ * @count: number of addresses
+ * @mappings: resulting mappings, NULL where nothing is mapped
+ *
+ * Like amdgpu_cs_find_mapping(), but resolves all the addresses with a
+ * single walk over the VA tree. The BOs still need to go through
+ * amdgpu_cs_bind_mapping() before they are used.
+ */
+void amdgpu_cs_find_mappings(struct amdgpu_cs_parser *parser,
+			     const uint64_t *addrs, unsigned count,
+			     struct amdgpu_bo_va_mapping **mappings)
+{
+	struct amdgpu_fpriv *fpriv = parser->filp->driver_priv;
+
+	amdgpu_vm_bo_lookup_mappings(&fpriv->vm, addrs, count, mappings);
+}
@@ -59,7 +59,7 @@ static int amdgpu_ctx_init(struct amdgpu_device *adev, struct amdgpu_ctx *ctx)
 			continue;
 
 		r = amd_sched_entity_init(&ring->sched, &ctx->rings[i].entity,
-					  rq, amdgpu_sched_jobs);
+					  rq);
 		if (r)
 			goto failed;
 	}
@@ -225,6 +225,48 @@ static int amdgpu_ctx_query(struct amdgpu_device *adev,
 	return 0;
 }
 
+static bool amdgpu_ctx_weight_allowed(struct drm_file *filp, uint32_t weight)
+{
+	if (weight <= AMD_SCHED_WEIGHT_DEFAULT)
+		return true;
+
+	if (capable(CAP_SYS_NICE))
+		return true;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	return drm_is_current_master(filp);
+#else
+	return filp->is_master;
+#endif
+}
+
+static int amdgpu_ctx_set_sched_weight(struct amdgpu_device *adev,
+				       struct drm_file *filp, uint32_t id,
+				       uint32_t weight)
+{
+	struct amdgpu_fpriv *fpriv = filp->driver_priv;
+	struct amdgpu_ctx *ctx;
+	unsigned i;
+
+	/* only privileged clients may get more than the default share */
+	if (!amdgpu_ctx_weight_allowed(filp, weight))
+		return -EACCES;
+
+	ctx = amdgpu_ctx_get(fpriv, id);
+	if (!ctx)
+		return -EINVAL;
+
+	for (i = 0; i < adev->num_rings; i++) {
+		if (adev->rings[i] == &adev->gfx.kiq.ring)
+			continue;
+
+		amd_sched_entity_set_weight(&ctx->rings[i].entity, weight);
+	}
+
+	amdgpu_ctx_put(ctx);
+	return 0;
+}
+
 int amdgpu_ctx_ioctl(struct drm_device *dev, void *data,
 		     struct drm_file *filp)
 {
@@ -249,6 +291,10 @@ int amdgpu_ctx_ioctl(struct drm_device *dev, void *data,
 	case AMDGPU_CTX_OP_QUERY_STATE:
 		r = amdgpu_ctx_query(adev, fpriv, id, &args->out);
 		break;
+	case AMDGPU_CTX_OP_SET_SCHED_WEIGHT:
+		r = amdgpu_ctx_set_sched_weight(adev, filp, id,
+						args->in.weight);
+		break;
 	default:
 		return -EINVAL;
 	}
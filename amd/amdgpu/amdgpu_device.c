@@ -2125,6 +2125,7 @@ int amdgpu_device_init(struct amdgpu_device *adev,
 	spin_lock_init(&adev->se_cac_idx_lock);
 	spin_lock_init(&adev->audio_endpt_idx_lock);
 	spin_lock_init(&adev->mm_stats.lock);
+	spin_lock_init(&adev->mm_stats.blit_lock);
 	spin_lock_init(&adev->tlb_invalidation_lock);
 
 	INIT_LIST_HEAD(&adev->shadow_list);
@@ -2277,6 +2278,8 @@ int amdgpu_device_init(struct amdgpu_device *adev,
 		max_MBps = 8; /* Allow 8 MB/s. */
 	/* Get a log2 for easy divisions. */
 	adev->mm_stats.log2_max_MBps = ilog2(max(1u, max_MBps));
+	/* Adjust the auto rate to the measured blit throughput */
+	adev->mm_stats.learn_rate = amdgpu_moverate < 0;
 
 	r = amdgpu_ib_pool_init(adev);
 	if (r) {
@@ -2311,12 +2314,18 @@ int amdgpu_device_init(struct amdgpu_device *adev,
 	if (r)
 		DRM_ERROR("Creating vbios dump debugfs failed (%d).\n", r);
 
+	r = amdgpu_benchmark_debugfs_init(adev);
+	if (r)
+		DRM_ERROR("registering benchmark debugfs failed (%d).\n", r);
+
 	if ((amdgpu_testing & 1)) {
 		if (adev->accel_working)
 			amdgpu_test_moves(adev);
 		else
 			DRM_INFO("amdgpu: acceleration disabled, skipping move tests\n");
 	}
+	if (amdgpu_testing & 2)
+		amdgpu_test_pte_plan();
 	if (amdgpu_benchmarking) {
 		if (adev->accel_working)
 			amdgpu_benchmark(adev, amdgpu_benchmarking);
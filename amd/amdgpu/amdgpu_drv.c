@@ -70,9 +70,10 @@
  * - 3.18.0 - Export gpu always on cu bitmap
  * - 3.19.0 - Add support for UVD MJPEG decode
  * - 3.20.0 - Add support for local BOs
+ * - 3.21.0 - Add context scheduler weight
  */
 #define KMS_DRIVER_MAJOR	3
-#define KMS_DRIVER_MINOR	20
+#define KMS_DRIVER_MINOR	21
 #define KMS_DRIVER_PATCHLEVEL	0
 
 int amdgpu_vram_limit = 0;
@@ -87,6 +88,9 @@ int amdgpu_disp_priority = 0;
 int amdgpu_hw_i2c = 0;
 int amdgpu_pcie_gen2 = -1;
 int amdgpu_msi = -1;
+int amdgpu_ih_budget = 0;
+int amdgpu_ih_rings = 1;
+int amdgpu_fence_poll_us = 0;
 int amdgpu_lockup_timeout = 0;
 int amdgpu_dpm = -1;
 int amdgpu_fw_load_type = -1;
@@ -101,11 +105,15 @@ int amdgpu_vm_block_size = -1;
 int amdgpu_vm_fault_stop = 0;
 int amdgpu_vm_debug = 0;
 int amdgpu_vram_page_split = 512;
+int amdgpu_vram_buddy = 0;
 int amdgpu_vm_update_mode = -1;
+int amdgpu_vm_update_cpu_max = 0;
 int amdgpu_exp_hw_support = 0;
 int amdgpu_dc = -1;
 int amdgpu_sched_jobs = 32;
 int amdgpu_sched_hw_submission = 2;
+int amdgpu_sched_policy = 0;
+int amdgpu_sched_batch = 1;
 int amdgpu_no_evict = 0;
 int amdgpu_direct_gma_size = 0;
 int amdgpu_ssg_enabled = 0;
@@ -144,7 +152,7 @@ module_param_named(moverate, amdgpu_moverate, int, 0600);
 MODULE_PARM_DESC(benchmark, "Run benchmark");
 module_param_named(benchmark, amdgpu_benchmarking, int, 0444);
 
-MODULE_PARM_DESC(test, "Run tests");
+MODULE_PARM_DESC(test, "Run tests (1 = BO moves, 2 = PTE planner)");
 module_param_named(test, amdgpu_testing, int, 0444);
 
 MODULE_PARM_DESC(audio, "Audio enable (-1 = auto, 0 = disable, 1 = enable)");
@@ -162,6 +170,15 @@ module_param_named(pcie_gen2, amdgpu_pcie_gen2, int, 0444);
 MODULE_PARM_DESC(msi, "MSI support (1 = enable, 0 = disable, -1 = auto)");
 module_param_named(msi, amdgpu_msi, int, 0444);
 
+MODULE_PARM_DESC(ih_budget, "Number of IH entries processed per softirq run, the interrupt handler only schedules the processing, requires MSI (0 = process in the interrupt handler (default))");
+module_param_named(ih_budget, amdgpu_ih_budget, int, 0444);
+
+MODULE_PARM_DESC(ih_rings, "Number of IH processing rings (1 = default, 2 = process VM faults and KFD traps on a separate ring)");
+module_param_named(ih_rings, amdgpu_ih_rings, int, 0444);
+
+MODULE_PARM_DESC(fence_poll_us, "Maximum time in us a fence waiter polls before sleeping, the window adapts to the observed wait times (0 = disable (default))");
+module_param_named(fence_poll_us, amdgpu_fence_poll_us, int, 0444);
+
 MODULE_PARM_DESC(lockup_timeout, "GPU lockup timeout in ms (default 0 = disable)");
 module_param_named(lockup_timeout, amdgpu_lockup_timeout, int, 0444);
 
@@ -204,21 +221,33 @@ module_param_named(vm_debug, amdgpu_vm_debug, int, 0644);
 MODULE_PARM_DESC(vm_update_mode, "VM update using CPU (0 = never (default except for large BAR(LB)), 1 = Graphics only, 2 = Compute only (default for LB), 3 = Both");
 module_param_named(vm_update_mode, amdgpu_vm_update_mode, int, 0444);
 
+MODULE_PARM_DESC(vm_update_cpu_max, "Max number of PTEs written by the CPU when the VM is otherwise updated by SDMA, large BAR only and not used while page table shadows are needed for GPU recovery, see lockup_timeout (0 = disabled (default))");
+module_param_named(vm_update_cpu_max, amdgpu_vm_update_cpu_max, int, 0444);
+
 MODULE_PARM_DESC(vram_page_split, "Number of pages after we split VRAM allocations (default 512, -1 = disable)");
 module_param_named(vram_page_split, amdgpu_vram_page_split, int, 0444);
 
+MODULE_PARM_DESC(vram_buddy, "VRAM allocator (0 = drm_mm (default), 1 = buddy allocator)");
+module_param_named(vram_buddy, amdgpu_vram_buddy, int, 0444);
+
 MODULE_PARM_DESC(exp_hw_support, "experimental hw support (1 = enable, 0 = disable (default))");
 module_param_named(exp_hw_support, amdgpu_exp_hw_support, int, 0444);
 
 MODULE_PARM_DESC(dc, "Display Core driver (1 = enable, 0 = disable, -1 = auto (default))");
 module_param_named(dc, amdgpu_dc, int, 0444);
 
-MODULE_PARM_DESC(sched_jobs, "the max number of jobs supported in the sw queue (default 32)");
+MODULE_PARM_DESC(sched_jobs, "the number of submissions per context and ring tracked for fence queries, more submissions in flight wait for the oldest one to finish (default 32)");
 module_param_named(sched_jobs, amdgpu_sched_jobs, int, 0444);
 
 MODULE_PARM_DESC(sched_hw_submission, "the max number of HW submissions (default 2)");
 module_param_named(sched_hw_submission, amdgpu_sched_hw_submission, int, 0444);
 
+MODULE_PARM_DESC(sched_policy, "GPU scheduler policy inside a priority level (0 = round robin (default), 1 = fair share by GPU time)");
+module_param_named(sched_policy, amdgpu_sched_policy, int, 0444);
+
+MODULE_PARM_DESC(sched_batch, "the max number of jobs submitted to the HW per scheduler wakeup (default 1)");
+module_param_named(sched_batch, amdgpu_sched_batch, int, 0444);
+
 MODULE_PARM_DESC(ppfeaturemask, "all power features enabled (default))");
 module_param_named(ppfeaturemask, amdgpu_pp_feature_mask, uint, 0444);
 
@@ -913,6 +942,10 @@ static int __init amdgpu_init(void)
 	if (r)
 		goto error_sched;
 
+	/* doesn't need a device, so run it before probing */
+	if (amdgpu_benchmarking == 13)
+		amdgpu_benchmark_software(NULL);
+
 	if (vgacon_text_force()) {
 		DRM_ERROR("VGACON disables amdgpu kernel modesetting.\n");
 		return -EINVAL;
@@ -181,6 +181,63 @@ static void amdgpu_fence_schedule_fallback(struct amdgpu_ring *ring)
 		  jiffies + AMDGPU_FENCE_JIFFIES_TIMEOUT);
 }
 
+/* Fences signalled per fence lock hold, bounds the time interrupts are off */
+#define AMDGPU_FENCE_SIGNAL_BATCH	64
+
+/**
+ * amdgpu_fence_signal_slots - signal the fences of a range of slots
+ *
+ * @fences: array of fence slots
+ * @mask: number of slots minus one, a power of two minus one
+ * @lock: lock shared by all the fences
+ * @last_seq: slot of the last already signalled sequence number
+ * @seq: slot of the last sequence number to signal
+ *
+ * All fences of a ring share the fence driver lock, so take it only once per
+ * batch instead of once per fence. Fences are signalled and their callbacks
+ * run in sequence number order. The references held by the slots are
+ * dropped.
+ */
+void amdgpu_fence_signal_slots(struct dma_fence **fences, uint32_t mask,
+			       spinlock_t *lock, uint32_t last_seq,
+			       uint32_t seq)
+{
+	unsigned long flags;
+	unsigned count;
+	int r;
+
+	while (last_seq != seq) {
+		spin_lock_irqsave(lock, flags);
+		for (count = 0; last_seq != seq &&
+		     count < AMDGPU_FENCE_SIGNAL_BATCH; ++count) {
+			struct dma_fence *fence, **ptr;
+
+			++last_seq;
+			last_seq &= mask;
+			ptr = &fences[last_seq];
+
+			/* There is always exactly one thread signaling this
+			 * fence slot
+			 */
+			fence = rcu_dereference_protected(*ptr, 1);
+			RCU_INIT_POINTER(*ptr, NULL);
+
+			if (!fence)
+				continue;
+
+			r = dma_fence_signal_locked(fence);
+			if (!r)
+				DMA_FENCE_TRACE(fence, "signaled from irq context\n");
+			else
+				BUG();
+
+			/* Only frees the fence after an RCU grace period */
+			dma_fence_put(fence);
+		}
+		spin_unlock_irqrestore(lock, flags);
+	}
+}
+
 /**
  * amdgpu_fence_process - check for fence activity
  *
@@ -194,7 +251,6 @@ void amdgpu_fence_process(struct amdgpu_ring *ring)
 {
 	struct amdgpu_fence_driver *drv = &ring->fence_drv;
 	uint32_t seq, last_seq;
-	int r;
 
 	do {
 		last_seq = atomic_read(&ring->fence_drv.last_seq);
@@ -208,31 +264,140 @@ void amdgpu_fence_process(struct amdgpu_ring *ring)
 	if (unlikely(seq == last_seq))
 		return;
 
-	last_seq &= drv->num_fences_mask;
-	seq &= drv->num_fences_mask;
+	if (amdgpu_fence_poll_us > 0)
+		drv->signal_time = ktime_get();
 
-	do {
-		struct dma_fence *fence, **ptr;
+	amdgpu_fence_signal_slots(drv->fences, drv->num_fences_mask, &drv->lock,
+				  last_seq & drv->num_fences_mask,
+				  seq & drv->num_fences_mask);
+}
 
-		++last_seq;
-		last_seq &= drv->num_fences_mask;
-		ptr = &drv->fences[last_seq];
+/**
+ * amdgpu_fence_get_hw - get the hardware fence behind a fence
+ *
+ * @f: amdgpu or scheduler fence
+ *
+ * Returns a reference to the amdgpu fence of @f or NULL if there is none
+ * (yet).
+ */
+static struct dma_fence *amdgpu_fence_get_hw(struct dma_fence *f)
+{
+	struct amd_sched_fence *s_fence = to_amd_sched_fence(f);
+	struct dma_fence *hw = f;
 
-		/* There is always exactly one thread signaling this fence slot */
-		fence = rcu_dereference_protected(*ptr, 1);
-		RCU_INIT_POINTER(*ptr, NULL);
+	/* amdgpu fences are RCU freed, the parent can go away on reset */
+	rcu_read_lock();
+	if (s_fence)
+		hw = READ_ONCE(s_fence->parent);
+	if (hw && to_amdgpu_fence(hw))
+		hw = dma_fence_get_rcu(hw);
+	else
+		hw = NULL;
+	rcu_read_unlock();
 
-		if (!fence)
-			continue;
+	return hw;
+}
+
+/**
+ * amdgpu_fence_poll_window - current polling window of a ring
+ *
+ * @drv: fence driver of the ring
+ *
+ * Polling pays off when fences signal within a short time. Poll for twice
+ * the average wait and not at all when waits take longer than the maximum
+ * window anyway. Returns the window in ns.
+ */
+static u64 amdgpu_fence_poll_window(struct amdgpu_fence_driver *drv)
+{
+	u64 limit = (u64)max(amdgpu_fence_poll_us, 0) * NSEC_PER_USEC;
+	u64 avg = READ_ONCE(drv->wait_ns);
+
+	if (avg > limit)
+		return 0;
+
+	return min(2 * avg, limit);
+}
 
-		r = dma_fence_signal(fence);
-		if (!r)
-			DMA_FENCE_TRACE(fence, "signaled from irq context\n");
-		else
-			BUG();
+/* Update a moving average with 1/8 weight for the new sample */
+static void amdgpu_fence_ewma(u32 *avg, s64 sample)
+{
+	s64 old = READ_ONCE(*avg);
 
-		dma_fence_put(fence);
-	} while (last_seq != seq);
+	sample = clamp_t(s64, sample, 0, U32_MAX);
+	WRITE_ONCE(*avg, old + div_s64(sample - old, 8));
+}
+
+/**
+ * amdgpu_fence_wait_polled - wait for a fence, polling first
+ *
+ * @f: fence to wait for
+ * @intr: use interruptible sleep
+ * @timeout: timeout in jiffies
+ *
+ * Polls the writeback sequence number of the ring executing @f for a
+ * bounded, self tuning window before falling back to sleeping until the
+ * fence interrupt. When the sequence number is seen all fences completed so
+ * far are signalled in one go. Returns like dma_fence_wait_timeout().
+ */
+signed long amdgpu_fence_wait_polled(struct dma_fence *f, bool intr,
+				     signed long timeout)
+{
+	struct amdgpu_fence_driver *drv;
+	struct amdgpu_ring *ring;
+	struct dma_fence *hw;
+	ktime_t start, end;
+	bool hit = false;
+	signed long r;
+	u64 window;
+
+	if (amdgpu_fence_poll_us <= 0 || !timeout || dma_fence_is_signaled(f))
+		return kcl_fence_wait_timeout(f, intr, timeout);
+
+	hw = amdgpu_fence_get_hw(f);
+	if (!hw)
+		return kcl_fence_wait_timeout(f, intr, timeout);
+
+	ring = to_amdgpu_fence(hw)->ring;
+	drv = &ring->fence_drv;
+	window = amdgpu_fence_poll_window(drv);
+	start = ktime_get();
+
+	if (window) {
+		atomic64_inc(&drv->poll_waits);
+		do {
+			if ((s32)(amdgpu_fence_read(ring) - hw->seqno) >= 0) {
+				amdgpu_fence_process(ring);
+				hit = true;
+				break;
+			}
+			cpu_relax();
+		} while (ktime_to_ns(ktime_sub(ktime_get(), start)) < window &&
+			 !need_resched());
+
+		if (hit) {
+			atomic64_inc(&drv->poll_hits);
+			atomic64_add(READ_ONCE(drv->wake_ns),
+				     &drv->poll_saved_ns);
+		} else {
+			atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+				     &drv->poll_spin_ns);
+		}
+	}
+
+	r = kcl_fence_wait_timeout(f, intr, timeout);
+	end = ktime_get();
+
+	if (r > 0) {
+		amdgpu_fence_ewma(&drv->wait_ns,
+				  ktime_to_ns(ktime_sub(end, start)));
+		/* Latency between signalling and the waiter running again */
+		if (!hit && ktime_after(drv->signal_time, start))
+			amdgpu_fence_ewma(&drv->wake_ns, ktime_to_ns(
+					  ktime_sub(end, drv->signal_time)));
+	}
+	dma_fence_put(hw);
+
+	return r;
 }
 
 /**
@@ -386,6 +551,13 @@ int amdgpu_fence_driver_init_ring(struct amdgpu_ring *ring,
 	ring->fence_drv.sync_seq = 0;
 	atomic_set(&ring->fence_drv.last_seq, 0);
 	ring->fence_drv.initialized = false;
+	ring->fence_drv.wait_ns = max(amdgpu_fence_poll_us, 0) *
+		NSEC_PER_USEC / 2;
+	ring->fence_drv.wake_ns = 0;
+	atomic64_set(&ring->fence_drv.poll_waits, 0);
+	atomic64_set(&ring->fence_drv.poll_hits, 0);
+	atomic64_set(&ring->fence_drv.poll_spin_ns, 0);
+	atomic64_set(&ring->fence_drv.poll_saved_ns, 0);
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
 	timer_setup(&ring->fence_drv.fallback_timer, amdgpu_fence_fallback, 0);
@@ -422,6 +594,13 @@ int amdgpu_fence_driver_init_ring(struct amdgpu_ring *ring,
 				  ring->name);
 			return r;
 		}
+
+		if (amdgpu_sched_policy == AMD_SCHED_POLICY_FAIR)
+			amd_sched_set_policy(&ring->sched,
+					     AMD_SCHED_POLICY_FAIR);
+		if (amdgpu_sched_batch > 1)
+			amd_sched_set_batch_size(&ring->sched,
+						 amdgpu_sched_batch);
 	}
 
 	return 0;
@@ -664,6 +843,68 @@ static int amdgpu_debugfs_fence_info(struct seq_file *m, void *data)
 			   atomic_read(&ring->fence_drv.last_seq));
 		seq_printf(m, "Last emitted        0x%08x\n",
 			   ring->fence_drv.sync_seq);
+
+		if (amdgpu_fence_poll_us > 0) {
+			struct amdgpu_fence_driver *drv = &ring->fence_drv;
+			u64 waits = atomic64_read(&drv->poll_waits);
+			u64 hits = atomic64_read(&drv->poll_hits);
+
+			seq_printf(m, "Poll window         %llu us\n",
+				   div_u64(amdgpu_fence_poll_window(drv),
+					   NSEC_PER_USEC));
+			seq_printf(m, "Poll hits           %llu/%llu (%llu%%)\n",
+				   hits, waits,
+				   div64_u64(hits * 100, max_t(u64, waits, 1)));
+			seq_printf(m, "Poll time missed    %llu us\n",
+				   div_u64(atomic64_read(&drv->poll_spin_ns),
+					   NSEC_PER_USEC));
+			seq_printf(m, "Latency saved (est) %llu us\n",
+				   div_u64(atomic64_read(&drv->poll_saved_ns),
+					   NSEC_PER_USEC));
+		}
+	}
+	return 0;
+}
+
+/**
+ * amdgpu_debugfs_sched_latency - dump the scheduler latency histograms
+ *
+ * One line per ring, priority and stage with the log2 buckets in us.
+ */
+static int amdgpu_debugfs_sched_latency(struct seq_file *m, void *data)
+{
+	static const char * const stages[AMD_SCHED_LAT_MAX] = {
+		[AMD_SCHED_LAT_QUEUE] = "queue",
+		[AMD_SCHED_LAT_SCHED] = "sched",
+		[AMD_SCHED_LAT_HW] = "hw",
+		[AMD_SCHED_LAT_TOTAL] = "total",
+	};
+	struct drm_info_node *node = (struct drm_info_node *)m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct amdgpu_device *adev = dev->dev_private;
+	u64 buckets[AMD_SCHED_LAT_BUCKETS];
+	int i, p, s, b;
+
+	seq_printf(m, "bucket n counts latencies below 2^n us\n");
+	for (i = 0; i < AMDGPU_MAX_RINGS; ++i) {
+		struct amdgpu_ring *ring = adev->rings[i];
+
+		if (!ring || !ring->sched.lat_hist)
+			continue;
+
+		seq_printf(m, "--- ring %d (%s) ---\n", i, ring->name);
+		for (p = AMD_SCHED_PRIORITY_MIN; p < AMD_SCHED_PRIORITY_MAX; ++p) {
+			for (s = 0; s < AMD_SCHED_LAT_MAX; ++s) {
+				amd_sched_lat_hist_read(&ring->sched, p, s,
+							buckets);
+				seq_printf(m, "%s %-5s:",
+					   p == AMD_SCHED_PRIORITY_KERNEL ?
+					   "kernel" : "normal", stages[s]);
+				for (b = 0; b < AMD_SCHED_LAT_BUCKETS; ++b)
+					seq_printf(m, " %llu", buckets[b]);
+				seq_printf(m, "\n");
+			}
+		}
 	}
 	return 0;
 }
@@ -687,11 +928,13 @@ static int amdgpu_debugfs_gpu_reset(struct seq_file *m, void *data)
 
 static const struct drm_info_list amdgpu_debugfs_fence_list[] = {
 	{"amdgpu_fence_info", &amdgpu_debugfs_fence_info, 0, NULL},
+	{"amdgpu_sched_latency", &amdgpu_debugfs_sched_latency, 0, NULL},
 	{"amdgpu_gpu_reset", &amdgpu_debugfs_gpu_reset, 0, NULL}
 };
 
 static const struct drm_info_list amdgpu_debugfs_fence_list_sriov[] = {
 	{"amdgpu_fence_info", &amdgpu_debugfs_fence_info, 0, NULL},
+	{"amdgpu_sched_latency", &amdgpu_debugfs_sched_latency, 0, NULL},
 };
 #endif
 
@@ -699,8 +942,8 @@ int amdgpu_debugfs_fence_init(struct amdgpu_device *adev)
 {
 #if defined(CONFIG_DEBUG_FS)
 	if (amdgpu_sriov_vf(adev))
-		return amdgpu_debugfs_add_files(adev, amdgpu_debugfs_fence_list_sriov, 1);
-	return amdgpu_debugfs_add_files(adev, amdgpu_debugfs_fence_list, 2);
+		return amdgpu_debugfs_add_files(adev, amdgpu_debugfs_fence_list_sriov, 2);
+	return amdgpu_debugfs_add_files(adev, amdgpu_debugfs_fence_list, 3);
 #else
 	return 0;
 #endif
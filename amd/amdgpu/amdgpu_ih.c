@@ -138,6 +138,142 @@ void amdgpu_ih_ring_fini(struct amdgpu_device *adev)
 	}
 }
 
+/* IV entries decoded in one go before they are dispatched */
+#define AMDGPU_IH_BATCH		8
+
+/**
+ * amdgpu_ih_prescreen_iv - prescreen an interrupt vector
+ *
+ * @adev: amdgpu_device pointer
+ *
+ * Gives the IH block a chance to drop the IV entry at the current rptr
+ * before it is decoded. Returns true if the entry should be processed.
+ */
+static bool amdgpu_ih_prescreen_iv(struct amdgpu_device *adev)
+{
+	if (!adev->irq.ih_funcs->prescreen_iv)
+		return true;
+
+	return adev->irq.ih_funcs->prescreen_iv(adev);
+}
+
+static void amdgpu_ih_route_test_check(struct amdgpu_device *adev,
+				       unsigned idx,
+				       struct amdgpu_iv_entry *entry);
+static void amdgpu_ih_sw_ring_flush(struct amdgpu_ih_sw_ring *ring);
+
+/**
+ * amdgpu_ih_route - queue an IV entry to the IH ring of its client
+ *
+ * @adev: amdgpu_device pointer
+ * @entry: decoded IV entry
+ * @dw: size of the raw IV entry in dwords
+ * @test: entry was fed by the routing self test
+ *
+ * When the secondary ring is full, the entries already queued and then
+ * this one are processed right away, so the order within a client is kept.
+ * Returns true if the entry was handed over to a secondary ring, false if
+ * it should be processed on the hardware ring.
+ */
+static bool amdgpu_ih_route(struct amdgpu_device *adev,
+			    struct amdgpu_iv_entry *entry, unsigned dw,
+			    bool test)
+{
+	struct amdgpu_ih_sw_ring *ring;
+	struct amdgpu_ih_sw_entry sw;
+	unsigned idx = 0;
+
+	if (entry->client_id < AMDGPU_IH_CLIENTID_MAX)
+		idx = adev->irq.ih_route[entry->client_id];
+	if (!idx)
+		return false;
+
+	ring = &adev->irq.ih_sw[idx - 1];
+	if (kfifo_avail(&ring->fifo) < sizeof(sw)) {
+		ring->overflows++;
+		dev_err_ratelimited(adev->dev,
+				    "IH ring %u overflow, processing entries directly\n",
+				    idx);
+		amdgpu_ih_sw_ring_flush(ring);
+	}
+
+	/* The hardware ring is overwritten once the rptr moves on */
+	sw.entry = *entry;
+	sw.test = test;
+	memcpy(sw.dw, entry->iv_entry,
+	       min_t(unsigned, dw, AMDGPU_IH_MAX_IV_DW) * 4);
+	kfifo_in(&ring->fifo, &sw, sizeof(sw));
+	queue_work_on(ring->cpu, adev->irq.ih_wq, &ring->work);
+
+	return true;
+}
+
+/**
+ * amdgpu_ih_drain - process IV entries
+ *
+ * @adev: amdgpu_device pointer
+ * @wptr: write pointer to process up to
+ * @budget: maximum number of entries to process
+ *
+ * Decode the entries in small batches and dispatch them. Must be called with
+ * the IH lock held. Returns the number of processed or dropped entries.
+ */
+static unsigned amdgpu_ih_drain(struct amdgpu_device *adev, u32 wptr,
+				unsigned budget)
+{
+	struct amdgpu_iv_entry entries[AMDGPU_IH_BATCH];
+	unsigned sizes[AMDGPU_IH_BATCH];
+	unsigned i, num, count = 0;
+	unsigned long flags;
+
+	DRM_DEBUG("%s: rptr %d, wptr %d\n", __func__, adev->irq.ih.rptr, wptr);
+
+	/* Order reading of wptr vs. reading of IH ring data */
+	rmb();
+
+	while (adev->irq.ih.rptr != wptr && count < budget) {
+		num = 0;
+		while (num < AMDGPU_IH_BATCH && adev->irq.ih.rptr != wptr &&
+		       count + num < budget) {
+			u32 ring_index = adev->irq.ih.rptr >> 2;
+
+			/* Prescreening of high-frequency interrupts, dropped
+			 * entries count against the budget as well
+			 */
+			if (!amdgpu_ih_prescreen_iv(adev)) {
+				adev->irq.ih.rptr &= adev->irq.ih.ptr_mask;
+				++count;
+				continue;
+			}
+
+			entries[num].iv_entry = (const uint32_t *)
+				&adev->irq.ih.ring[ring_index];
+			amdgpu_ih_decode_iv(adev, &entries[num]);
+			sizes[num] = (adev->irq.ih.rptr >> 2) - ring_index;
+			adev->irq.ih.rptr &= adev->irq.ih.ptr_mask;
+			++num;
+		}
+
+		for (i = 0; i < num; ++i) {
+			if (amdgpu_ih_route(adev, &entries[i], sizes[i], false))
+				continue;
+
+			/* The handlers expect to run in interrupt context, this
+			 * only matters when called from the tasklet
+			 */
+			local_irq_save(flags);
+			/* Before dispatching irq to IP blocks, send it to amdkfd */
+			amdgpu_amdkfd_interrupt(adev,
+					(const void *)entries[i].iv_entry);
+			amdgpu_irq_dispatch(adev, &entries[i]);
+			local_irq_restore(flags);
+		}
+		count += num;
+	}
+
+	return count;
+}
+
 /**
  * amdgpu_ih_process - interrupt handler
  *
@@ -148,7 +284,6 @@ void amdgpu_ih_ring_fini(struct amdgpu_device *adev)
  */
 int amdgpu_ih_process(struct amdgpu_device *adev)
 {
-	struct amdgpu_iv_entry entry;
 	u32 wptr;
 
 	if (!adev->irq.ih.enabled || adev->shutdown)
@@ -161,25 +296,7 @@ restart_ih:
 	if (atomic_xchg(&adev->irq.ih.lock, 1))
 		return IRQ_NONE;
 
-	DRM_DEBUG("%s: rptr %d, wptr %d\n", __func__, adev->irq.ih.rptr, wptr);
-
-	/* Order reading of wptr vs. reading of IH ring data */
-	rmb();
-
-	while (adev->irq.ih.rptr != wptr) {
-		u32 ring_index = adev->irq.ih.rptr >> 2;
-
-		/* Before dispatching irq to IP blocks, send it to amdkfd */
-		amdgpu_amdkfd_interrupt(adev,
-				(const void *) &adev->irq.ih.ring[ring_index]);
-
-		entry.iv_entry = (const uint32_t *)
-			&adev->irq.ih.ring[ring_index];
-		amdgpu_ih_decode_iv(adev, &entry);
-		adev->irq.ih.rptr &= adev->irq.ih.ptr_mask;
-
-		amdgpu_irq_dispatch(adev, &entry);
-	}
+	amdgpu_ih_drain(adev, wptr, UINT_MAX);
 	amdgpu_ih_set_rptr(adev);
 	atomic_set(&adev->irq.ih.lock, 0);
 
@@ -190,3 +307,439 @@ restart_ih:
 
 	return IRQ_HANDLED;
 }
+
+/**
+ * amdgpu_ih_schedule - interrupt handler top half
+ *
+ * @adev: amdgpu_device pointer
+ *
+ * Leave the processing of the IV entries to amdgpu_ih_tasklet.
+ * Only used with MSI, which is never shared. The tasklet might already
+ * have processed the entries this interrupt was raised for, so an empty
+ * ring is still reported as handled.
+ * Returns irq process return code.
+ */
+int amdgpu_ih_schedule(struct amdgpu_device *adev)
+{
+	struct amdgpu_ih_ring *ih = &adev->irq.ih;
+
+	if (!ih->enabled || adev->shutdown)
+		return IRQ_NONE;
+
+	tasklet_schedule(&ih->tasklet);
+	return IRQ_HANDLED;
+}
+
+/**
+ * amdgpu_ih_tasklet - interrupt handler bottom half
+ *
+ * @data: amdgpu_device pointer
+ *
+ * Process at most budget IV entries and reschedule when there is more
+ * work, so that interrupt storms don't monopolize the CPU.
+ */
+void amdgpu_ih_tasklet(unsigned long data)
+{
+	struct amdgpu_device *adev = (struct amdgpu_device *)data;
+	struct amdgpu_ih_ring *ih = &adev->irq.ih;
+	u32 wptr;
+
+	if (!ih->enabled || adev->shutdown)
+		return;
+
+	/* whoever holds the lock looks at the wptr again */
+	if (atomic_xchg(&ih->lock, 1))
+		return;
+
+	amdgpu_ih_drain(adev, amdgpu_ih_get_wptr(adev), ih->budget);
+	amdgpu_ih_set_rptr(adev);
+	atomic_set(&ih->lock, 0);
+
+	wptr = amdgpu_ih_get_wptr(adev);
+	if (wptr != ih->rptr)
+		tasklet_schedule(&ih->tasklet);
+}
+
+/**
+ * amdgpu_ih_faults_init - allocate the retry fault filter
+ *
+ * @adev: amdgpu_device pointer
+ *
+ * Allocates the hash table used by the IH block to drop repeated
+ * retry page faults before they are dispatched.
+ */
+int amdgpu_ih_faults_init(struct amdgpu_device *adev)
+{
+	struct amdgpu_retryfault_hashtable *faults;
+
+	faults = kzalloc(sizeof(*faults), GFP_KERNEL);
+	if (!faults)
+		return -ENOMEM;
+
+	INIT_CHASH_TABLE(faults->hash, AMDGPU_PAGEFAULT_HASH_BITS, 8,
+			 sizeof(unsigned long));
+	spin_lock_init(&faults->lock);
+	faults->expire = max(msecs_to_jiffies(AMDGPU_PAGEFAULT_EXPIRE_MS), 1UL);
+	adev->irq.ih.faults = faults;
+
+	return 0;
+}
+
+/**
+ * amdgpu_ih_faults_fini - free the retry fault filter
+ *
+ * @adev: amdgpu_device pointer
+ */
+void amdgpu_ih_faults_fini(struct amdgpu_device *adev)
+{
+	kfree(adev->irq.ih.faults);
+	adev->irq.ih.faults = NULL;
+}
+
+/**
+ * amdgpu_ih_expire_faults - remove old entries from the fault filter
+ *
+ * @faults: retry fault hash table
+ * @now: current jiffies
+ *
+ * Must be called with the fault filter lock held.
+ */
+static void amdgpu_ih_expire_faults(struct amdgpu_retryfault_hashtable *faults,
+				    unsigned long now)
+{
+	struct chash_iter iter = CHASH_ITER_INIT(&faults->hash.table, 0);
+	unsigned i;
+
+	for (i = 0; i < (1 << AMDGPU_PAGEFAULT_HASH_BITS); ++i) {
+		unsigned long *stamp = chash_iter_value(iter);
+
+		if (chash_iter_is_valid(iter) &&
+		    !time_before(now, *stamp + faults->expire)) {
+			chash_iter_set_invalid(iter);
+			faults->count--;
+		}
+		CHASH_ITER_INC(iter);
+	}
+}
+
+/**
+ * amdgpu_ih_filter_fault - check if a retry fault was recently seen
+ *
+ * @adev: amdgpu_device pointer
+ * @key: 64-bit encoding of PASID and page address
+ *
+ * Retry faults are raised again and again by the hardware until they are
+ * handled. Only let the first fault for a page through and drop the same
+ * fault until AMDGPU_PAGEFAULT_EXPIRE_MS have passed. If the table is full
+ * the fault is let through without being tracked.
+ * Returns true if the fault should be dropped.
+ */
+bool amdgpu_ih_filter_fault(struct amdgpu_device *adev, u64 key)
+{
+	struct amdgpu_retryfault_hashtable *faults = adev->irq.ih.faults;
+	unsigned long now = jiffies;
+	unsigned long stamp;
+	bool drop = false;
+
+	if (!faults)
+		return false;
+
+	spin_lock(&faults->lock);
+	if (chash_table_copy_out(&faults->hash, key, &stamp) >= 0) {
+		if (time_before(now, stamp + faults->expire)) {
+			faults->hits++;
+			drop = true;
+			goto unlock;
+		}
+		/* Expired, refresh the time stamp below */
+	} else {
+		if (faults->count >= AMDGPU_PAGEFAULT_HASH_MAX)
+			amdgpu_ih_expire_faults(faults, now);
+		if (faults->count >= AMDGPU_PAGEFAULT_HASH_MAX) {
+			faults->misses++;
+			goto unlock;
+		}
+		faults->count++;
+	}
+
+	faults->misses++;
+	chash_table_copy_in(&faults->hash, key, &now);
+
+unlock:
+	spin_unlock(&faults->lock);
+	return drop;
+}
+
+/**
+ * amdgpu_ih_sw_ring_next - process the next entry of a secondary IH ring
+ *
+ * @ring: the secondary IH ring
+ *
+ * Must be called with the ring lock held, which keeps the entries of a
+ * ring in order and their handlers from running concurrently. The
+ * handlers expect to run in interrupt context, so the lock is taken with
+ * interrupts disabled. Returns false if the ring is empty.
+ */
+static bool amdgpu_ih_sw_ring_next(struct amdgpu_ih_sw_ring *ring)
+{
+	struct amdgpu_device *adev = ring->adev;
+	struct amdgpu_ih_sw_entry sw;
+
+	if (kfifo_out(&ring->fifo, &sw, sizeof(sw)) != sizeof(sw))
+		return false;
+
+	sw.entry.iv_entry = sw.dw;
+	ring->processed++;
+
+	if (sw.test) {
+		amdgpu_ih_route_test_check(adev, ring->idx, &sw.entry);
+		return true;
+	}
+
+	amdgpu_amdkfd_interrupt(adev, (const void *)sw.entry.iv_entry);
+	amdgpu_irq_dispatch(adev, &sw.entry);
+	return true;
+}
+
+/**
+ * amdgpu_ih_sw_ring_flush - process a full secondary IH ring directly
+ *
+ * @ring: the secondary IH ring
+ *
+ * Called by the hardware ring when the secondary ring overflows.
+ */
+static void amdgpu_ih_sw_ring_flush(struct amdgpu_ih_sw_ring *ring)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ring->lock, flags);
+	while (amdgpu_ih_sw_ring_next(ring));
+	spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+/**
+ * amdgpu_ih_sw_ring_work - process a secondary IH ring
+ *
+ * @work: work item of the ring
+ *
+ * Dispatches the entries queued by amdgpu_ih_route() in order.
+ */
+static void amdgpu_ih_sw_ring_work(struct work_struct *work)
+{
+	struct amdgpu_ih_sw_ring *ring =
+		container_of(work, struct amdgpu_ih_sw_ring, work);
+	unsigned long flags;
+	bool more;
+
+	do {
+		/* one entry at a time to keep the interrupt latency low */
+		spin_lock_irqsave(&ring->lock, flags);
+		more = amdgpu_ih_sw_ring_next(ring);
+		spin_unlock_irqrestore(&ring->lock, flags);
+	} while (more);
+}
+
+/**
+ * amdgpu_ih_ring_cpu - pick the CPU processing a logical IH ring
+ *
+ * @adev: amdgpu_device pointer
+ * @idx: logical ring index
+ *
+ * Spreads the rings over the CPUs close to the device.
+ */
+int amdgpu_ih_ring_cpu(struct amdgpu_device *adev, unsigned idx)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	return cpumask_local_spread(idx, dev_to_node(adev->dev));
+#else
+	return WORK_CPU_UNBOUND;
+#endif
+}
+
+/**
+ * amdgpu_ih_rings_init - set up the secondary IH rings
+ *
+ * @adev: amdgpu_device pointer
+ *
+ * Allocates the secondary rings requested with the ih_rings module parameter
+ * and routes VM faults and shader interrupts (KFD traps) to them. All other
+ * clients stay on the hardware ring. Pre-vega10 asics report every entry
+ * with the legacy client ID and always use a single ring.
+ */
+int amdgpu_ih_rings_init(struct amdgpu_device *adev)
+{
+	static const u8 fault_clients[] = {
+		AMDGPU_IH_CLIENTID_VMC,
+		AMDGPU_IH_CLIENTID_UTCL2,
+		AMDGPU_IH_CLIENTID_UTCL2LOG,
+		AMDGPU_IH_CLIENTID_SE0SH,
+		AMDGPU_IH_CLIENTID_SE1SH,
+		AMDGPU_IH_CLIENTID_SE2SH,
+		AMDGPU_IH_CLIENTID_SE3SH,
+	};
+	unsigned i, num_rings;
+	int r;
+
+	adev->irq.num_ih_rings = 1;
+	num_rings = clamp(amdgpu_ih_rings, 1, AMDGPU_IH_MAX_RINGS);
+	if (num_rings == 1 || adev->asic_type < CHIP_VEGA10)
+		return 0;
+
+	adev->irq.ih_wq = alloc_workqueue("amdgpu-ih", WQ_HIGHPRI, 0);
+	if (!adev->irq.ih_wq)
+		return -ENOMEM;
+
+	for (i = 1; i < num_rings; ++i) {
+		struct amdgpu_ih_sw_ring *ring = &adev->irq.ih_sw[i - 1];
+
+		r = kfifo_alloc(&ring->fifo, AMDGPU_IH_SW_RING_ENTRIES *
+				sizeof(struct amdgpu_ih_sw_entry), GFP_KERNEL);
+		if (r)
+			goto error;
+
+		ring->adev = adev;
+		ring->idx = i;
+		ring->cpu = amdgpu_ih_ring_cpu(adev, i);
+		ring->processed = 0;
+		ring->overflows = 0;
+		spin_lock_init(&ring->lock);
+		INIT_WORK(&ring->work, amdgpu_ih_sw_ring_work);
+	}
+
+	adev->irq.num_ih_rings = num_rings;
+	for (i = 0; i < ARRAY_SIZE(fault_clients); ++i)
+		adev->irq.ih_route[fault_clients[i]] = AMDGPU_IH_RING_FAULTS;
+
+	return 0;
+
+error:
+	while (--i)
+		kfifo_free(&adev->irq.ih_sw[i - 1].fifo);
+	destroy_workqueue(adev->irq.ih_wq);
+	adev->irq.ih_wq = NULL;
+	return r;
+}
+
+/**
+ * amdgpu_ih_rings_fini - tear down the secondary IH rings
+ *
+ * @adev: amdgpu_device pointer
+ *
+ * Must be called after the interrupt handler is uninstalled, pending
+ * entries are processed before the rings are freed.
+ */
+void amdgpu_ih_rings_fini(struct amdgpu_device *adev)
+{
+	unsigned i;
+
+	if (!adev->irq.ih_wq)
+		return;
+
+	memset(adev->irq.ih_route, 0, sizeof(adev->irq.ih_route));
+	destroy_workqueue(adev->irq.ih_wq);
+	adev->irq.ih_wq = NULL;
+
+	for (i = 1; i < adev->irq.num_ih_rings; ++i)
+		kfifo_free(&adev->irq.ih_sw[i - 1].fifo);
+	adev->irq.num_ih_rings = 1;
+}
+
+/* Synthetic entries fed per client by the routing self test */
+#define AMDGPU_IH_TEST_ENTRIES	16
+
+struct amdgpu_ih_route_test {
+	unsigned	received[AMDGPU_IH_MAX_RINGS];
+	atomic_t	misrouted;
+	atomic_t	reordered;
+	unsigned	next[AMDGPU_IH_CLIENTID_MAX];
+};
+
+/**
+ * amdgpu_ih_route_test_check - check a self test entry
+ *
+ * @adev: amdgpu_device pointer
+ * @idx: logical ring the entry was processed on
+ * @entry: the test entry
+ *
+ * Test entries carry a per client sequence number in src_data[0].
+ */
+static void amdgpu_ih_route_test_check(struct amdgpu_device *adev,
+				       unsigned idx,
+				       struct amdgpu_iv_entry *entry)
+{
+	struct amdgpu_ih_route_test *test = adev->irq.ih_test;
+	unsigned client_id = entry->client_id;
+
+	test->received[idx]++;
+	if (adev->irq.ih_route[client_id] != idx)
+		atomic_inc(&test->misrouted);
+	if (entry->src_data[0] != test->next[client_id])
+		atomic_inc(&test->reordered);
+	test->next[client_id] = entry->src_data[0] + 1;
+}
+
+/**
+ * amdgpu_ih_route_test - software fed test of the IH ring routing
+ *
+ * @adev: amdgpu_device pointer
+ * @m: seq_file to print the results to
+ *
+ * Feeds interleaved synthetic entries for every client through the routing
+ * and checks that each entry ends up on the ring of its client, in order.
+ * The interrupt is disabled meanwhile so that the hardware ring doesn't feed
+ * the secondary rings at the same time. Test entries are never dispatched.
+ */
+int amdgpu_ih_route_test(struct amdgpu_device *adev, struct seq_file *m)
+{
+	struct amdgpu_ih_route_test *test;
+	unsigned irq = adev->ddev->pdev->irq;
+	unsigned i, j, total = 0;
+	bool passed;
+
+	if (!adev->irq.installed)
+		return -ENODEV;
+
+	test = kzalloc(sizeof(*test), GFP_KERNEL);
+	if (!test)
+		return -ENOMEM;
+
+	disable_irq(irq);
+	tasklet_disable(&adev->irq.ih.tasklet);
+	adev->irq.ih_test = test;
+
+	for (i = 0; i < AMDGPU_IH_TEST_ENTRIES; ++i) {
+		for (j = 0; j < AMDGPU_IH_CLIENTID_MAX; ++j) {
+			uint32_t dw[AMDGPU_IH_MAX_IV_DW] = {};
+			struct amdgpu_iv_entry entry = {};
+
+			entry.client_id = j;
+			entry.src_data[0] = i;
+			entry.iv_entry = dw;
+			if (!amdgpu_ih_route(adev, &entry, AMDGPU_IH_MAX_IV_DW,
+					     true))
+				amdgpu_ih_route_test_check(adev, 0, &entry);
+		}
+	}
+
+	tasklet_enable(&adev->irq.ih.tasklet);
+	enable_irq(irq);
+	if (adev->irq.ih_wq)
+		flush_workqueue(adev->irq.ih_wq);
+	adev->irq.ih_test = NULL;
+
+	for (i = 0; i < adev->irq.num_ih_rings; ++i) {
+		seq_printf(m, "ring %u: %u entries\n", i, test->received[i]);
+		total += test->received[i];
+	}
+	seq_printf(m, "misrouted: %d, out of order: %d\n",
+		   atomic_read(&test->misrouted),
+		   atomic_read(&test->reordered));
+
+	passed = total == AMDGPU_IH_TEST_ENTRIES * AMDGPU_IH_CLIENTID_MAX &&
+		 !atomic_read(&test->misrouted) &&
+		 !atomic_read(&test->reordered);
+	seq_printf(m, "IH routing test %s\n", passed ? "passed" : "FAILED");
+
+	kfree(test);
+	return 0;
+}
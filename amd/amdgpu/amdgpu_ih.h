@@ -24,7 +24,11 @@
 #ifndef __AMDGPU_IH_H__
 #define __AMDGPU_IH_H__
 
+#include <linux/chash.h>
+#include <linux/kfifo.h>
+
 struct amdgpu_device;
+struct seq_file;
  /*
   * vega10+ IH clients
  */
@@ -69,6 +73,37 @@ enum amdgpu_ih_clientid
 
 #define AMDGPU_IH_CLIENTID_LEGACY 0
 
+#define AMDGPU_PAGEFAULT_HASH_BITS 8
+#define AMDGPU_PAGEFAULT_HASH_MAX ((1 << AMDGPU_PAGEFAULT_HASH_BITS) * 3 / 4)
+#define AMDGPU_PAGEFAULT_EXPIRE_MS 10
+
+/* 64-bit hash key of a retry fault, the address is at most 48 bits */
+#define AMDGPU_VM_FAULT(pasid, addr) (((u64)(pasid) << 48) | (addr))
+
+/*
+ * Recently seen retry faults with the jiffies they were let through
+ */
+struct amdgpu_retryfault_hashtable {
+	DECLARE_CHASH_TABLE(hash, AMDGPU_PAGEFAULT_HASH_BITS, 8,
+			    sizeof(unsigned long));
+	spinlock_t	lock;
+	unsigned	count;
+	unsigned long	expire;
+	unsigned long	hits;
+	unsigned long	misses;
+};
+
+/*
+ * Logical IH rings. Ring 0 is the hardware ring processed from the interrupt,
+ * the other rings are fed from it based on the client ID of an entry.
+ */
+#define AMDGPU_IH_MAX_RINGS		2
+#define AMDGPU_IH_RING_FAULTS		1
+#define AMDGPU_IH_SW_RING_ENTRIES	256
+#define AMDGPU_IH_MAX_IV_DW		8
+
+struct amdgpu_ih_route_test;
+
 /*
  * R6xx+ IH ring
  */
@@ -87,6 +122,13 @@ struct amdgpu_ih_ring {
 	bool			use_doorbell;
 	bool			use_bus_addr;
 	dma_addr_t		rb_dma_addr; /* only used when use_bus_addr = true */
+
+	/* processing outside of the interrupt handler */
+	struct tasklet_struct	tasklet;
+	unsigned		budget;
+
+	/* retry fault filter, only used by vega10+ */
+	struct amdgpu_retryfault_hashtable *faults;
 };
 
 #define AMDGPU_IH_SRC_DATA_MAX_SIZE_DW 4
@@ -105,9 +147,37 @@ struct amdgpu_iv_entry {
 	const uint32_t *iv_entry;
 };
 
+/* IV entry queued to a secondary IH ring, including its raw data */
+struct amdgpu_ih_sw_entry {
+	struct amdgpu_iv_entry	entry;
+	uint32_t		dw[AMDGPU_IH_MAX_IV_DW];
+	bool			test;
+};
+
+struct amdgpu_ih_sw_ring {
+	struct amdgpu_device	*adev;
+	unsigned		idx;
+	struct kfifo		fifo;
+	/* serializes dispatching the entries taken out of the fifo */
+	spinlock_t		lock;
+	struct work_struct	work;
+	int			cpu;
+	unsigned long		processed;
+	unsigned long		overflows;
+};
+
 int amdgpu_ih_ring_init(struct amdgpu_device *adev, unsigned ring_size,
 			bool use_bus_addr);
 void amdgpu_ih_ring_fini(struct amdgpu_device *adev);
 int amdgpu_ih_process(struct amdgpu_device *adev);
+int amdgpu_ih_schedule(struct amdgpu_device *adev);
+void amdgpu_ih_tasklet(unsigned long data);
+int amdgpu_ih_faults_init(struct amdgpu_device *adev);
+void amdgpu_ih_faults_fini(struct amdgpu_device *adev);
+bool amdgpu_ih_filter_fault(struct amdgpu_device *adev, u64 key);
+int amdgpu_ih_ring_cpu(struct amdgpu_device *adev, unsigned idx);
+int amdgpu_ih_rings_init(struct amdgpu_device *adev);
+void amdgpu_ih_rings_fini(struct amdgpu_device *adev);
+int amdgpu_ih_route_test(struct amdgpu_device *adev, struct seq_file *m);
 
 #endif
@@ -184,7 +184,10 @@ irqreturn_t amdgpu_irq_handler(int irq, void *arg)
 	struct amdgpu_device *adev = dev->dev_private;
 	irqreturn_t ret;
 
-	ret = amdgpu_ih_process(adev);
+	if (adev->irq.ih.budget)
+		ret = amdgpu_ih_schedule(adev);
+	else
+		ret = amdgpu_ih_process(adev);
 	if (ret == IRQ_HANDLED)
 		pm_runtime_mark_last_busy(dev->dev);
 	return ret;
@@ -211,6 +214,87 @@ static bool amdgpu_msi_ok(struct amdgpu_device *adev)
 	return true;
 }
 
+#if defined(CONFIG_DEBUG_FS)
+
+static int amdgpu_debugfs_irq_stats(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *)m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct amdgpu_device *adev = dev->dev_private;
+	ktime_t now = ktime_get();
+	s64 ms = ktime_to_ms(ktime_sub(now, adev->irq.stats_time));
+	unsigned i, j;
+
+	ms = max_t(s64, ms, 1);
+
+	seq_printf(m, "IH processing: %s, budget %u\n",
+		   adev->irq.ih.budget ? "softirq" : "interrupt handler",
+		   adev->irq.ih.budget);
+	if (adev->irq.ih.faults) {
+		struct amdgpu_retryfault_hashtable *faults = adev->irq.ih.faults;
+
+		seq_printf(m, "retry faults: %lu dropped, %lu passed, %u tracked\n",
+			   READ_ONCE(faults->hits), READ_ONCE(faults->misses),
+			   READ_ONCE(faults->count));
+	}
+	for (i = 1; i < adev->irq.num_ih_rings; ++i) {
+		struct amdgpu_ih_sw_ring *ring = &adev->irq.ih_sw[i - 1];
+
+		seq_printf(m, "IH ring %u: cpu %d, %lu processed, %lu overflows\n",
+			   i, ring->cpu, READ_ONCE(ring->processed),
+			   READ_ONCE(ring->overflows));
+	}
+	seq_puts(m, "client src_id ring       count  rate/s\n");
+	for (i = 0; i < AMDGPU_IH_CLIENTID_MAX; ++i) {
+		struct amdgpu_irq_client *client = &adev->irq.client[i];
+
+		if (!client->counts)
+			continue;
+
+		for (j = 0; j < AMDGPU_MAX_IRQ_SRC_ID; ++j) {
+			unsigned long count = atomic_long_read(&client->counts[j]);
+			unsigned long delta = count - client->last_counts[j];
+
+			if (!count)
+				continue;
+
+			seq_printf(m, "  0x%02x   0x%02x %4u %11lu %7llu\n", i, j,
+				   adev->irq.ih_route[i], count,
+				   div64_u64((u64)delta * 1000, ms));
+			client->last_counts[j] = count;
+		}
+	}
+	adev->irq.stats_time = now;
+
+	return 0;
+}
+
+static int amdgpu_debugfs_ih_route_test(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *)m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct amdgpu_device *adev = dev->dev_private;
+
+	return amdgpu_ih_route_test(adev, m);
+}
+
+static const struct drm_info_list amdgpu_debugfs_irq_list[] = {
+	{"amdgpu_irq_stats", &amdgpu_debugfs_irq_stats, 0, NULL},
+	{"amdgpu_ih_route_test", &amdgpu_debugfs_ih_route_test, 0, NULL},
+};
+
+#endif
+
+static int amdgpu_debugfs_irq_init(struct amdgpu_device *adev)
+{
+#if defined(CONFIG_DEBUG_FS)
+	return amdgpu_debugfs_add_files(adev, amdgpu_debugfs_irq_list,
+					ARRAY_SIZE(amdgpu_debugfs_irq_list));
+#else
+	return 0;
+#endif
+}
+
 /**
  * amdgpu_irq_init - init driver interrupt info
  *
@@ -253,6 +337,16 @@ int amdgpu_irq_init(struct amdgpu_device *adev)
 
 	INIT_WORK(&adev->reset_work, amdgpu_irq_reset_work_func);
 
+	/* a level triggered INTx line would stay asserted until the
+	 * tasklet runs, so only defer the processing with MSI
+	 */
+	if (adev->irq.msi_enabled)
+		adev->irq.ih.budget = max(amdgpu_ih_budget, 0);
+	else
+		adev->irq.ih.budget = 0;
+	tasklet_init(&adev->irq.ih.tasklet, amdgpu_ih_tasklet,
+		     (unsigned long)adev);
+
 	adev->irq.installed = true;
 	r = drm_irq_install(adev->ddev, adev->ddev->pdev->irq);
 	if (r) {
@@ -262,6 +356,23 @@ int amdgpu_irq_init(struct amdgpu_device *adev)
 		return r;
 	}
 
+	r = amdgpu_ih_rings_init(adev);
+	if (r)
+		dev_warn(adev->dev, "(%d) failed to set up IH rings, using one\n",
+			 r);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	/* All logical rings share the one MSI vector, the hint only applies
+	 * to the hardware ring. The secondary rings run on their own CPUs.
+	 */
+	if (adev->irq.num_ih_rings > 1)
+		irq_set_affinity_hint(adev->ddev->pdev->irq,
+				      cpumask_of(amdgpu_ih_ring_cpu(adev, 0)));
+#endif
+
+	adev->irq.stats_time = ktime_get();
+	if (amdgpu_debugfs_irq_init(adev))
+		dev_err(adev->dev, "IRQ debugfs file creation failed\n");
+
 	DRM_INFO("amdgpu: irq initialized.\n");
 	return 0;
 }
@@ -281,7 +392,13 @@ void amdgpu_irq_fini(struct amdgpu_device *adev)
 	drm_vblank_cleanup(adev->ddev);
 #endif
 	if (adev->irq.installed) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+		if (adev->irq.num_ih_rings > 1)
+			irq_set_affinity_hint(adev->ddev->pdev->irq, NULL);
+#endif
 		drm_irq_uninstall(adev->ddev);
+		tasklet_kill(&adev->irq.ih.tasklet);
+		amdgpu_ih_rings_fini(adev);
 		adev->irq.installed = false;
 		if (adev->irq.msi_enabled)
 			pci_disable_msi(adev->pdev);
@@ -308,6 +425,8 @@ void amdgpu_irq_fini(struct amdgpu_device *adev)
 			}
 		}
 		kfree(adev->irq.client[i].sources);
+		kfree(adev->irq.client[i].counts);
+		kfree(adev->irq.client[i].last_counts);
 	}
 }
 
@@ -333,12 +452,30 @@ int amdgpu_irq_add_id(struct amdgpu_device *adev,
 		return -EINVAL;
 
 	if (!adev->irq.client[client_id].sources) {
+		unsigned long *last_counts;
+		atomic_long_t *counts;
+
+		counts = kcalloc(AMDGPU_MAX_IRQ_SRC_ID, sizeof(*counts),
+				 GFP_KERNEL);
+		last_counts = kcalloc(AMDGPU_MAX_IRQ_SRC_ID,
+				      sizeof(*last_counts), GFP_KERNEL);
+		if (!counts || !last_counts) {
+			kfree(counts);
+			kfree(last_counts);
+			return -ENOMEM;
+		}
+
 		adev->irq.client[client_id].sources =
 			kcalloc(AMDGPU_MAX_IRQ_SRC_ID,
 				sizeof(struct amdgpu_irq_src *),
 				GFP_KERNEL);
-		if (!adev->irq.client[client_id].sources)
+		if (!adev->irq.client[client_id].sources) {
+			kfree(counts);
+			kfree(last_counts);
 			return -ENOMEM;
+		}
+		adev->irq.client[client_id].counts = counts;
+		adev->irq.client[client_id].last_counts = last_counts;
 	}
 
 	if (adev->irq.client[client_id].sources[src_id] != NULL)
@@ -387,6 +524,9 @@ void amdgpu_irq_dispatch(struct amdgpu_device *adev,
 		return;
 	}
 
+	if (adev->irq.client[client_id].counts)
+		atomic_long_inc(&adev->irq.client[client_id].counts[src_id]);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 1, 0)
 	src = adev->irq.client[client_id].sources[src_id];
 	if (!src) {
@@ -399,7 +539,12 @@ void amdgpu_irq_dispatch(struct amdgpu_device *adev,
 		DRM_ERROR("error processing interrupt (%d)\n", r);
 #else
 	if (adev->irq.virq[src_id]) {
+		unsigned long flags;
+
+		/* might be called from the IH tasklet */
+		local_irq_save(flags);
 		generic_handle_irq(irq_find_mapping(adev->irq.domain, src_id));
+		local_irq_restore(flags);
 	} else {
 		if (!adev->irq.client[client_id].sources) {
 			DRM_DEBUG("Unregistered interrupt client_id: %d src_id: %d\n",
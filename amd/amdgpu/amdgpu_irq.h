@@ -49,6 +49,9 @@ struct amdgpu_irq_src {
 
 struct amdgpu_irq_client {
 	struct amdgpu_irq_src **sources;
+	/* number of IV entries for each src_id, and at the last stats read */
+	atomic_long_t *counts;
+	unsigned long *last_counts;
 };
 
 /* provided by interrupt generating IP blocks */
@@ -74,12 +77,22 @@ struct amdgpu_irq {
 	struct amdgpu_ih_ring		ih;
 	const struct amdgpu_ih_funcs	*ih_funcs;
 
+	/* secondary IH rings and the ring each client is routed to */
+	unsigned			num_ih_rings;
+	u8				ih_route[AMDGPU_IH_CLIENTID_MAX];
+	struct workqueue_struct		*ih_wq;
+	struct amdgpu_ih_sw_ring	ih_sw[AMDGPU_IH_MAX_RINGS - 1];
+	struct amdgpu_ih_route_test	*ih_test;
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 1, 0)
 	/* gen irq stuff */
 	struct irq_domain		*domain; /* GPU irq controller domain */
 	unsigned			virq[AMDGPU_MAX_IRQ_SRC_ID];
 #endif
 	uint32_t                        srbm_soft_reset;
+
+	/* time of the last stats read */
+	ktime_t				stats_time;
 };
 
 void amdgpu_irq_preinstall(struct drm_device *dev);
@@ -24,6 +24,11 @@
 #include <linux/kthread.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#if defined(BUILD_AS_DKMS)
+#include <kcl/kcl_fence_array.h>
+#else
+#include <linux/dma-fence-array.h>
+#endif
 #include <drm/drmP.h>
 #include "amdgpu.h"
 #include "amdgpu_trace.h"
@@ -103,6 +108,8 @@ static void amdgpu_job_free_cb(struct amd_sched_job *s_job)
 {
 	struct amdgpu_job *job = container_of(s_job, struct amdgpu_job, base);
 
+	while (job->num_deps)
+		dma_fence_put(job->deps[--job->num_deps]);
 	dma_fence_put(job->fence);
 	amdgpu_sync_free(&job->sync);
 	amdgpu_sync_free(&job->dep_sync);
@@ -114,6 +121,8 @@ void amdgpu_job_free(struct amdgpu_job *job)
 {
 	amdgpu_job_free_resources(job);
 
+	while (job->num_deps)
+		dma_fence_put(job->deps[--job->num_deps]);
 	dma_fence_put(job->fence);
 	amdgpu_sync_free(&job->sync);
 	amdgpu_sync_free(&job->dep_sync);
@@ -144,21 +153,107 @@ int amdgpu_job_submit(struct amdgpu_job *job, struct amdgpu_ring *ring,
 	return 0;
 }
 
+/**
+ * amdgpu_job_ring_ordered - check if a dependency is ordered by the ring
+ *
+ * @job: job with the dependency
+ * @fence: the dependency
+ *
+ * Dependencies which are already scheduled on the same ring, either as
+ * scheduler fence or as hardware fence, only need a pipeline sync.
+ * Returns the fence to actually wait for before the job can run.
+ */
+static struct dma_fence *amdgpu_job_ring_ordered(struct amdgpu_job *job,
+						 struct dma_fence *fence)
+{
+	struct amdgpu_device *adev = job->adev;
+	struct amd_sched_fence *s_fence;
+	int r;
+
+	if (fence->context != adev->fence_context + job->ring->idx &&
+	    !amd_sched_dependency_optimized(fence, job->base.s_entity))
+		return fence;
+
+	r = amdgpu_sync_fence(adev, &job->sched_sync, fence);
+	if (r)
+		DRM_ERROR("Error adding fence to sync (%d)\n", r);
+
+	s_fence = to_amd_sched_fence(fence);
+	if (s_fence && s_fence->sched == &job->ring->sched) {
+		struct dma_fence *scheduled = dma_fence_get(&s_fence->scheduled);
+
+		dma_fence_put(fence);
+		return scheduled;
+	}
+
+	/* hardware fence already emitted to our ring */
+	dma_fence_put(fence);
+	return NULL;
+}
+
+/**
+ * amdgpu_job_merge_deps - wait for all pending dependencies at once
+ *
+ * @job: job to collect the dependencies for
+ *
+ * Takes up to AMDGPU_JOB_MAX_MERGED_DEPS unsignaled fences out of the
+ * job's sync objects and merges them into a single fence array, so the
+ * scheduler needs only one callback round trip to resolve all of them
+ * instead of one per predecessor. If the array can't be allocated the
+ * fences stay in job->deps and are returned one per call instead.
+ */
+static struct dma_fence *amdgpu_job_merge_deps(struct amdgpu_job *job)
+{
+	struct amd_sched_entity *entity = job->base.s_entity;
+	struct dma_fence_array *array;
+	struct dma_fence **fences;
+	struct dma_fence *fence;
+
+	if (job->num_deps)
+		return job->deps[--job->num_deps];
+
+	while (job->num_deps < AMDGPU_JOB_MAX_MERGED_DEPS &&
+	       (fence = amdgpu_sync_get_fence(&job->dep_sync))) {
+		fence = amdgpu_job_ring_ordered(job, fence);
+		if (fence && !dma_fence_is_signaled(fence))
+			job->deps[job->num_deps++] = fence;
+		else
+			dma_fence_put(fence);
+	}
+
+	while (job->num_deps < AMDGPU_JOB_MAX_MERGED_DEPS &&
+	       (fence = amdgpu_sync_get_fence(&job->sync)))
+		job->deps[job->num_deps++] = fence;
+
+	if (job->num_deps <= 1)
+		return job->num_deps ? job->deps[--job->num_deps] : NULL;
+
+	fences = kmemdup(job->deps, sizeof(*fences) * job->num_deps,
+			 GFP_KERNEL);
+	if (!fences)
+		return job->deps[--job->num_deps];
+
+	array = dma_fence_array_create(job->num_deps, fences,
+				       entity->dependency_context,
+				       ++entity->dependency_seq, false);
+	if (!array) {
+		kfree(fences);
+		return job->deps[--job->num_deps];
+	}
+
+	/* the array owns the references now */
+	job->num_deps = 0;
+	return &array->base;
+}
+
 static struct dma_fence *amdgpu_job_dependency(struct amd_sched_job *sched_job)
 {
 	struct amdgpu_job *job = to_amdgpu_job(sched_job);
 	struct amdgpu_vm *vm = job->vm;
 
-	struct dma_fence *fence = amdgpu_sync_get_fence(&job->dep_sync);
+	struct dma_fence *fence = amdgpu_job_merge_deps(job);
 	int r;
 
-	if (amd_sched_dependency_optimized(fence, sched_job->s_entity)) {
-		r = amdgpu_sync_fence(job->adev, &job->sched_sync, fence);
-		if (r)
-			DRM_ERROR("Error adding fence to sync (%d)\n", r);
-	}
-	if (!fence)
-		fence = amdgpu_sync_get_fence(&job->sync);
 	while (fence == NULL && vm && !job->vm_id) {
 		struct amdgpu_ring *ring = job->ring;
 
@@ -207,9 +302,25 @@ static struct dma_fence *amdgpu_job_run(struct amd_sched_job *sched_job)
 	return fence;
 }
 
+static void amdgpu_job_begin_batch(struct amd_gpu_scheduler *sched)
+{
+	struct amdgpu_ring *ring = container_of(sched, struct amdgpu_ring, sched);
+
+	amdgpu_ring_begin_batch(ring);
+}
+
+static void amdgpu_job_end_batch(struct amd_gpu_scheduler *sched)
+{
+	struct amdgpu_ring *ring = container_of(sched, struct amdgpu_ring, sched);
+
+	amdgpu_ring_end_batch(ring);
+}
+
 const struct amd_sched_backend_ops amdgpu_sched_ops = {
 	.dependency = amdgpu_job_dependency,
 	.run_job = amdgpu_job_run,
 	.timedout_job = amdgpu_job_timedout,
-	.free_job = amdgpu_job_free_cb
+	.free_job = amdgpu_job_free_cb,
+	.begin_batch = amdgpu_job_begin_batch,
+	.end_batch = amdgpu_job_end_batch
 };
@@ -796,14 +796,172 @@ error:
 	return r;
 }
 
+/* Number of BOs which get their system pages allocated ahead of eviction */
+#define AMDGPU_EVICT_PREPARE_MAX	256
+
+struct amdgpu_evict_prepare {
+	struct work_struct		work;
+	struct ttm_buffer_object	*bo;
+	/* the worker created the TTM of the BO */
+	bool				populated;
+};
+
+/**
+ * amdgpu_bo_evict_prepare_work - allocate the pages for an eviction
+ *
+ * @work: the amdgpu_evict_prepare work item
+ *
+ * Create and populate the TTM of a VRAM BO with the caching its GTT
+ * placement uses, so that evicting it only needs to bind the pages and
+ * start the copy. BOs which are reserved are most likely being evicted
+ * already and are skipped.
+ */
+static void amdgpu_bo_evict_prepare_work(struct work_struct *work)
+{
+	struct amdgpu_evict_prepare *prep =
+		container_of(work, struct amdgpu_evict_prepare, work);
+	struct ttm_buffer_object *bo = prep->bo;
+	struct ttm_bo_device *bdev = bo->bdev;
+	struct amdgpu_bo *abo;
+	uint32_t page_flags = 0;
+	uint32_t placement;
+
+	if (ttm_bo_reserve(bo, false, true, NULL))
+		return;
+
+	if (bo->mem.mem_type != TTM_PL_VRAM || bo->ttm ||
+	    bo->type == ttm_bo_type_sg || !amdgpu_ttm_bo_is_amdgpu_bo(bo))
+		goto out_unreserve;
+
+	if (bdev->need_dma32)
+		page_flags |= TTM_PAGE_FLAG_DMA32;
+
+	bo->ttm = bdev->driver->ttm_tt_create(bdev, bo->num_pages << PAGE_SHIFT,
+					      page_flags,
+					      bo->glob->dummy_read_page);
+	if (!bo->ttm)
+		goto out_unreserve;
+
+	prep->populated = true;
+	abo = container_of(bo, struct amdgpu_bo, tbo);
+	if (abo->flags & AMDGPU_GEM_CREATE_CPU_GTT_USWC)
+		placement = TTM_PL_FLAG_WC | TTM_PL_FLAG_UNCACHED;
+	else
+		placement = TTM_PL_FLAG_CACHED;
+
+	/* A failure here just leaves the work to the eviction */
+	if (!ttm_tt_set_placement_caching(bo->ttm, placement))
+		bdev->driver->ttm_tt_populate(bo->ttm);
+
+out_unreserve:
+	ttm_bo_unreserve(bo);
+}
+
+/**
+ * amdgpu_bo_evict_unprepare - drop the pages of a BO which stayed in VRAM
+ *
+ * @prep: the amdgpu_evict_prepare work item, already flushed
+ *
+ * Pinned BOs and BOs which couldn't be evicted would otherwise keep their
+ * system pages until they are moved or destroyed.
+ */
+static void amdgpu_bo_evict_unprepare(struct amdgpu_evict_prepare *prep)
+{
+	struct ttm_buffer_object *bo = prep->bo;
+
+	if (!prep->populated || ttm_bo_reserve(bo, false, false, NULL))
+		return;
+
+	if (bo->mem.mem_type == TTM_PL_VRAM && bo->ttm) {
+		ttm_tt_destroy(bo->ttm);
+		bo->ttm = NULL;
+	}
+
+	ttm_bo_unreserve(bo);
+}
+
+/**
+ * amdgpu_bo_evict_prepare - start allocating pages for VRAM eviction
+ *
+ * @adev: amdgpu_device pointer
+ * @preps: array of AMDGPU_EVICT_PREPARE_MAX work items
+ *
+ * Take a reference to the first BOs on the VRAM LRU and queue their page
+ * allocation to the unbound workqueue. Returns the number of queued items.
+ */
+static unsigned amdgpu_bo_evict_prepare(struct amdgpu_device *adev,
+					struct amdgpu_evict_prepare *preps)
+{
+	struct ttm_bo_global *glob = adev->mman.bdev.glob;
+	struct ttm_mem_type_manager *man = &adev->mman.bdev.man[TTM_PL_VRAM];
+	struct ttm_buffer_object *bo;
+	unsigned i, count = 0;
+
+	spin_lock(&glob->lru_lock);
+	for (i = 0; i < TTM_MAX_BO_PRIORITY; ++i) {
+		list_for_each_entry(bo, &man->lru[i], lru) {
+			if (count == AMDGPU_EVICT_PREPARE_MAX)
+				break;
+
+			if (bo->ttm || !kref_get_unless_zero(&bo->kref))
+				continue;
+
+			preps[count++].bo = bo;
+		}
+	}
+	spin_unlock(&glob->lru_lock);
+
+	for (i = 0; i < count; ++i) {
+		INIT_WORK(&preps[i].work, amdgpu_bo_evict_prepare_work);
+		queue_work(system_unbound_wq, &preps[i].work);
+	}
+
+	return count;
+}
+
+/**
+ * amdgpu_bo_evict_vram - evict all BOs from VRAM
+ *
+ * @adev: amdgpu_device pointer
+ *
+ * The page allocation for the first BOs on the LRU is done by a pool of
+ * workers while TTM evicts. TTM still evicts the BOs one after another, the
+ * copies are pipelined by amdgpu_move_blit and ttm_bo_evict_mm only waits
+ * for the last eviction fence of VRAM. Prepared BOs which are still in VRAM
+ * afterwards give their pages back.
+ */
 int amdgpu_bo_evict_vram(struct amdgpu_device *adev)
 {
+	struct amdgpu_evict_prepare *preps;
+	unsigned i, count = 0;
+	int r;
+
 	/* late 2.6.33 fix IGP hibernate - we need pm ops to do this correct */
 	if (0 && (adev->flags & AMD_IS_APU)) {
 		/* Useless to evict on IGP chips */
 		return 0;
 	}
-	return ttm_bo_evict_mm(&adev->mman.bdev, TTM_PL_VRAM);
+
+	preps = kcalloc(AMDGPU_EVICT_PREPARE_MAX, sizeof(*preps), GFP_KERNEL);
+	if (preps)
+		count = amdgpu_bo_evict_prepare(adev, preps);
+
+	r = ttm_bo_evict_mm(&adev->mman.bdev, TTM_PL_VRAM);
+
+	for (i = 0; i < count; ++i)
+		flush_work(&preps[i].work);
+
+	/* BOs reserved by the workers can't be evicted, try again */
+	if (r == -EBUSY && count)
+		r = ttm_bo_evict_mm(&adev->mman.bdev, TTM_PL_VRAM);
+
+	for (i = 0; i < count; ++i) {
+		amdgpu_bo_evict_unprepare(&preps[i]);
+		ttm_bo_unref(&preps[i].bo);
+	}
+	kfree(preps);
+
+	return r;
 }
 
 static const char *amdgpu_vram_names[] = {
@@ -932,6 +1090,7 @@ void amdgpu_bo_move_notify(struct ttm_buffer_object *bo,
 
 	abo = container_of(bo, struct amdgpu_bo, tbo);
 	amdgpu_vm_bo_invalidate(adev, abo, evict);
+	++abo->move_count;
 
 	amdgpu_bo_kunmap(abo);
 
@@ -195,6 +195,7 @@ amdgpu_gem_prime_foreign_bo(struct amdgpu_device *adev, struct amdgpu_bo *bo)
 	list_add(&gobj->list, &bo->gem_objects);
 	gobj->bo = amdgpu_bo_ref(bo);
 	bo->flags |= AMDGPU_GEM_CREATE_CPU_ACCESS_REQUIRED;
+	++bo->move_count;
 
 	ww_mutex_unlock(&bo->tbo.resv->lock);
 
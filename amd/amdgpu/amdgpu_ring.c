@@ -119,6 +119,7 @@ void amdgpu_ring_generic_pad_ib(struct amdgpu_ring *ring, struct amdgpu_ib *ib)
  *
  * Update the wptr (write pointer) to tell the GPU to
  * execute new commands on the ring buffer (all asics).
+ * Inside a batch the wptr update is deferred to amdgpu_ring_end_batch().
  */
 void amdgpu_ring_commit(struct amdgpu_ring *ring)
 {
@@ -130,8 +131,12 @@ void amdgpu_ring_commit(struct amdgpu_ring *ring)
 	count %= ring->funcs->align_mask + 1;
 	ring->funcs->insert_nop(ring, count);
 
-	mb();
-	amdgpu_ring_set_wptr(ring);
+	if (ring->defer_commit) {
+		ring->commit_pending = true;
+	} else {
+		mb();
+		amdgpu_ring_set_wptr(ring);
+	}
 
 	if (ring->funcs->end_use)
 		ring->funcs->end_use(ring);
@@ -154,6 +159,38 @@ void amdgpu_ring_undo(struct amdgpu_ring *ring)
 		ring->funcs->end_use(ring);
 }
 
+/**
+ * amdgpu_ring_begin_batch - start collecting submissions
+ *
+ * @ring: amdgpu_ring structure holding ring information
+ *
+ * Commands committed until amdgpu_ring_end_batch() are only made
+ * visible to the GPU with a single wptr update. The caller must not
+ * commit more than the ring size allows, the scheduler guarantees
+ * that by staying within its hw submission credit.
+ */
+void amdgpu_ring_begin_batch(struct amdgpu_ring *ring)
+{
+	ring->defer_commit = true;
+	ring->commit_pending = false;
+}
+
+/**
+ * amdgpu_ring_end_batch - kick the GPU for all batched submissions
+ *
+ * @ring: amdgpu_ring structure holding ring information
+ */
+void amdgpu_ring_end_batch(struct amdgpu_ring *ring)
+{
+	ring->defer_commit = false;
+	if (!ring->commit_pending)
+		return;
+
+	ring->commit_pending = false;
+	mb();
+	amdgpu_ring_set_wptr(ring);
+}
+
 /**
  * amdgpu_ring_init - init driver ring struct.
  *
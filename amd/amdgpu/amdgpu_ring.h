@@ -74,6 +74,15 @@ struct amdgpu_fence_driver {
 	unsigned			num_fences_mask;
 	spinlock_t			lock;
 	struct dma_fence		**fences;
+
+	/* adaptive polling of waiters, see amdgpu_fence_wait_polled() */
+	u32				wait_ns;
+	u32				wake_ns;
+	ktime_t				signal_time;
+	atomic64_t			poll_waits;
+	atomic64_t			poll_hits;
+	atomic64_t			poll_spin_ns;
+	atomic64_t			poll_saved_ns;
 };
 
 int amdgpu_fence_driver_init(struct amdgpu_device *adev);
@@ -89,7 +98,12 @@ int amdgpu_fence_driver_start_ring(struct amdgpu_ring *ring,
 void amdgpu_fence_driver_suspend(struct amdgpu_device *adev);
 void amdgpu_fence_driver_resume(struct amdgpu_device *adev);
 int amdgpu_fence_emit(struct amdgpu_ring *ring, struct dma_fence **fence);
+void amdgpu_fence_signal_slots(struct dma_fence **fences, uint32_t mask,
+			       spinlock_t *lock, uint32_t last_seq,
+			       uint32_t seq);
 void amdgpu_fence_process(struct amdgpu_ring *ring);
+signed long amdgpu_fence_wait_polled(struct dma_fence *f, bool intr,
+				     signed long timeout);
 int amdgpu_fence_wait_empty(struct amdgpu_ring *ring);
 unsigned amdgpu_fence_count_emitted(struct amdgpu_ring *ring);
 
@@ -162,6 +176,8 @@ struct amdgpu_ring {
 	unsigned		rptr_offs;
 	u64			wptr;
 	u64			wptr_old;
+	bool			defer_commit;
+	bool			commit_pending;
 	unsigned		ring_size;
 	unsigned		max_dw;
 	int			count_dw;
@@ -198,6 +214,8 @@ void amdgpu_ring_insert_nop(struct amdgpu_ring *ring, uint32_t count);
 void amdgpu_ring_generic_pad_ib(struct amdgpu_ring *ring, struct amdgpu_ib *ib);
 void amdgpu_ring_commit(struct amdgpu_ring *ring);
 void amdgpu_ring_undo(struct amdgpu_ring *ring);
+void amdgpu_ring_begin_batch(struct amdgpu_ring *ring);
+void amdgpu_ring_end_batch(struct amdgpu_ring *ring);
 int amdgpu_ring_init(struct amdgpu_device *adev, struct amdgpu_ring *ring,
 		     unsigned ring_size, struct amdgpu_irq_src *irq_src,
 		     unsigned irq_type);
@@ -49,10 +49,49 @@ static struct kmem_cache *amdgpu_sync_slab;
  */
 void amdgpu_sync_create(struct amdgpu_sync *sync)
 {
+	sync->num_inline = 0;
+	sync->num_hashed = 0;
 	hash_init(sync->fences);
 	sync->last_vm_update = NULL;
 }
 
+/**
+ * amdgpu_sync_inline_del - remove an inline fence
+ *
+ * @sync: sync object to remove the fence from
+ * @i: index of the fence
+ *
+ * Moves the last inline fence into the free slot and returns the removed
+ * fence, the reference is transferred to the caller.
+ */
+static struct dma_fence *amdgpu_sync_inline_del(struct amdgpu_sync *sync,
+						unsigned i)
+{
+	struct dma_fence *f = sync->inline_fences[i];
+
+	sync->inline_fences[i] = sync->inline_fences[--sync->num_inline];
+	return f;
+}
+
+/**
+ * amdgpu_sync_hash_del - remove and free a hashed entry
+ *
+ * @sync: sync object the entry belongs to
+ * @e: entry to remove
+ *
+ * Returns the fence of the entry, the reference is transferred to the caller.
+ */
+static struct dma_fence *amdgpu_sync_hash_del(struct amdgpu_sync *sync,
+					      struct amdgpu_sync_entry *e)
+{
+	struct dma_fence *f = e->fence;
+
+	hash_del(&e->node);
+	kmem_cache_free(amdgpu_sync_slab, e);
+	--sync->num_hashed;
+	return f;
+}
+
 /**
  * amdgpu_sync_same_dev - test if fence belong to us
  *
@@ -121,17 +160,29 @@ static void amdgpu_sync_keep_later(struct dma_fence **keep,
 }
 
 /**
- * amdgpu_sync_add_later - add the fence to the hash
+ * amdgpu_sync_add_later - add the fence to an existing entry
  *
  * @sync: sync object to add the fence to
  * @f: fence to add
  *
- * Tries to add the fence to an existing hash entry. Returns true when an entry
- * was found, false otherwise.
+ * Tries to add the fence to an existing inline or hash entry. Returns true
+ * when an entry was found, false otherwise.
  */
 static bool amdgpu_sync_add_later(struct amdgpu_sync *sync, struct dma_fence *f)
 {
 	struct amdgpu_sync_entry *e;
+	unsigned i;
+
+	for (i = 0; i < sync->num_inline; ++i) {
+		if (sync->inline_fences[i]->context != f->context)
+			continue;
+
+		amdgpu_sync_keep_later(&sync->inline_fences[i], f);
+		return true;
+	}
+
+	if (!sync->num_hashed)
+		return false;
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	struct hlist_node *node;
@@ -171,12 +222,130 @@ int amdgpu_sync_fence(struct amdgpu_device *adev, struct amdgpu_sync *sync,
 	if (amdgpu_sync_add_later(sync, f))
 		return 0;
 
+	if (sync->num_inline < AMDGPU_SYNC_INLINE_FENCES) {
+		sync->inline_fences[sync->num_inline++] = dma_fence_get(f);
+		return 0;
+	}
+
 	e = kmem_cache_alloc(amdgpu_sync_slab, GFP_KERNEL);
 	if (!e)
 		return -ENOMEM;
 
 	hash_add(sync->fences, &e->node, f->context);
 	e->fence = dma_fence_get(f);
+	++sync->num_hashed;
+	return 0;
+}
+
+/* number of reservation object fences deduplicated before adding them */
+#define AMDGPU_SYNC_RESV_BATCH	32
+
+struct amdgpu_sync_resv_batch {
+	unsigned		count;
+	struct dma_fence	*fences[AMDGPU_SYNC_RESV_BATCH];
+};
+
+/**
+ * amdgpu_sync_resv_needed - check if we need to sync to a reservation fence
+ *
+ * @adev: amdgpu device
+ * @f: fence from the reservation object
+ * @owner: owner of the new submission
+ * @exclusive: true for the exclusive fence
+ *
+ * Signaled fences are skipped unless they are VM updates, those are still
+ * needed to track the last VM update of the sync object.
+ */
+static bool amdgpu_sync_resv_needed(struct amdgpu_device *adev,
+				    struct dma_fence *f, void *owner,
+				    bool exclusive)
+{
+	bool same_dev = amdgpu_sync_same_dev(adev, f);
+	void *fence_owner = amdgpu_sync_get_owner(f);
+
+	if (fence_owner == AMDGPU_FENCE_OWNER_KFD &&
+	    owner == AMDGPU_FENCE_OWNER_VM)
+		return false;
+
+	if (dma_fence_is_signaled(f) &&
+	    !(same_dev && fence_owner == AMDGPU_FENCE_OWNER_VM))
+		return false;
+
+	if (exclusive || !same_dev)
+		return true;
+
+	/* VM updates are only interesting
+	 * for other VM updates and moves.
+	 */
+	if ((owner != AMDGPU_FENCE_OWNER_UNDEFINED) &&
+	    (fence_owner != AMDGPU_FENCE_OWNER_UNDEFINED) &&
+	    ((owner == AMDGPU_FENCE_OWNER_VM) !=
+	     (fence_owner == AMDGPU_FENCE_OWNER_VM)))
+		return false;
+
+	/* Ignore fence from the same owner as
+	 * long as it isn't undefined.
+	 */
+	if (owner != AMDGPU_FENCE_OWNER_UNDEFINED &&
+	    fence_owner == owner)
+		return false;
+
+	return true;
+}
+
+/**
+ * amdgpu_sync_resv_flush - add the collected fences to the sync object
+ *
+ * @adev: amdgpu device
+ * @sync: sync object to add the fences to
+ * @batch: collected fences, emptied afterwards
+ */
+static int amdgpu_sync_resv_flush(struct amdgpu_device *adev,
+				  struct amdgpu_sync *sync,
+				  struct amdgpu_sync_resv_batch *batch)
+{
+	unsigned i;
+	int r = 0;
+
+	for (i = 0; i < batch->count && !r; ++i)
+		r = amdgpu_sync_fence(adev, sync, batch->fences[i]);
+
+	batch->count = 0;
+	return r;
+}
+
+/**
+ * amdgpu_sync_resv_add - collect a reservation fence
+ *
+ * @adev: amdgpu device
+ * @sync: sync object the batch is flushed to when full
+ * @batch: collected fences
+ * @f: fence to add, only the latest fence of each context is kept
+ */
+static int amdgpu_sync_resv_add(struct amdgpu_device *adev,
+				struct amdgpu_sync *sync,
+				struct amdgpu_sync_resv_batch *batch,
+				struct dma_fence *f)
+{
+	unsigned i;
+
+	for (i = 0; i < batch->count; ++i) {
+		if (batch->fences[i]->context != f->context)
+			continue;
+
+		if (dma_fence_is_later(f, batch->fences[i]))
+			batch->fences[i] = f;
+		return 0;
+	}
+
+	if (batch->count == AMDGPU_SYNC_RESV_BATCH) {
+		int r = amdgpu_sync_resv_flush(adev, sync, batch);
+
+		if (r)
+			return r;
+	}
+
+	batch->fences[batch->count++] = f;
 	return 0;
 }
 
@@ -185,68 +354,129 @@ int amdgpu_sync_fence(struct amdgpu_device *adev, struct amdgpu_sync *sync,
  *
  * @sync: sync object to add fences from reservation object to
  * @resv: reservation object with embedded fence
- * @shared: true if we should only sync to the exclusive fence
+ * @owner: owner of the new submission
  *
  * Sync to the fence except if it is KFD eviction fence and owner is
- * AMDGPU_FENCE_OWNER_VM.
+ * AMDGPU_FENCE_OWNER_VM. The fences are filtered and deduplicated by context
+ * before touching the sync object. The reservation object must be locked.
  */
 int amdgpu_sync_resv(struct amdgpu_device *adev,
 		     struct amdgpu_sync *sync,
 		     struct reservation_object *resv,
 		     void *owner)
 {
+	struct amdgpu_sync_resv_batch batch;
 	struct reservation_object_list *flist;
 	struct dma_fence *f;
-	void *fence_owner;
 	unsigned i;
 	int r = 0;
 
 	if (resv == NULL)
 		return -EINVAL;
 
+	batch.count = 0;
+
+	/* always sync to the exclusive fence */
 	f = reservation_object_get_excl(resv);
-	fence_owner = amdgpu_sync_get_owner(f);
-	if (fence_owner != AMDGPU_FENCE_OWNER_KFD ||
-			owner != AMDGPU_FENCE_OWNER_VM)
-		r = amdgpu_sync_fence(adev, sync, f);
+	if (f && amdgpu_sync_resv_needed(adev, f, owner, true))
+		batch.fences[batch.count++] = f;
 
 	flist = reservation_object_get_list(resv);
-	if (!flist || r)
-		return r;
-
-	for (i = 0; i < flist->shared_count; ++i) {
+	for (i = 0; flist && i < flist->shared_count && !r; ++i) {
 		f = rcu_dereference_protected(flist->shared[i],
 					      reservation_object_held(resv));
-		fence_owner = amdgpu_sync_get_owner(f);
-		if (fence_owner == AMDGPU_FENCE_OWNER_KFD &&
-				owner == AMDGPU_FENCE_OWNER_VM)
-			continue;
+		if (amdgpu_sync_resv_needed(adev, f, owner, false))
+			r = amdgpu_sync_resv_add(adev, sync, &batch, f);
+	}
 
-		if (amdgpu_sync_same_dev(adev, f)) {
-			/* VM updates are only interesting
-			 * for other VM updates and moves.
-			 */
-			if ((owner != AMDGPU_FENCE_OWNER_UNDEFINED) &&
-			    (fence_owner != AMDGPU_FENCE_OWNER_UNDEFINED) &&
-			    ((owner == AMDGPU_FENCE_OWNER_VM) !=
-			     (fence_owner == AMDGPU_FENCE_OWNER_VM)))
-				continue;
-
-			/* Ignore fence from the same owner as
-			 * long as it isn't undefined.
-			 */
-			if (owner != AMDGPU_FENCE_OWNER_UNDEFINED &&
-			    fence_owner == owner)
-				continue;
-		}
+	if (r)
+		return r;
 
-		r = amdgpu_sync_fence(adev, sync, f);
-		if (r)
-			break;
+	return amdgpu_sync_resv_flush(adev, sync, &batch);
+}
+
+/**
+ * amdgpu_sync_resv_rcu - sync to a snapshot of a reservation object
+ *
+ * @sync: sync object to add fences from reservation object to
+ * @resv: reservation object with embedded fence
+ * @owner: owner of the new submission
+ *
+ * Same as amdgpu_sync_resv(), but takes an RCU snapshot of the fences and
+ * so doesn't need the reservation lock.
+ */
+int amdgpu_sync_resv_rcu(struct amdgpu_device *adev,
+			 struct amdgpu_sync *sync,
+			 struct reservation_object *resv,
+			 void *owner)
+{
+	struct amdgpu_sync_resv_batch batch;
+	struct dma_fence *excl, **shared;
+	unsigned i, shared_count;
+	int r;
+
+	if (resv == NULL)
+		return -EINVAL;
+
+	r = reservation_object_get_fences_rcu(resv, &excl,
+					      &shared_count, &shared);
+	if (r)
+		return r;
+
+	batch.count = 0;
+	if (excl && amdgpu_sync_resv_needed(adev, excl, owner, true))
+		batch.fences[batch.count++] = excl;
+
+	for (i = 0; i < shared_count && !r; ++i) {
+		if (amdgpu_sync_resv_needed(adev, shared[i], owner, false))
+			r = amdgpu_sync_resv_add(adev, sync, &batch,
+						 shared[i]);
 	}
+
+	/* the batch only borrows the snapshot references */
+	if (!r)
+		r = amdgpu_sync_resv_flush(adev, sync, &batch);
+
+	dma_fence_put(excl);
+	for (i = 0; i < shared_count; ++i)
+		dma_fence_put(shared[i]);
+	kfree(shared);
+
 	return r;
 }
 
+/**
+ * amdgpu_sync_peek_one - check a single fence of the sync object
+ *
+ * @f: fence to check
+ * @ring: optional ring to use for test
+ *
+ * Returns ERR_PTR(-ENOENT) if the fence is signaled and can be dropped,
+ * NULL if it doesn't need to be waited for on @ring, or the fence to wait for.
+ */
+static struct dma_fence *amdgpu_sync_peek_one(struct dma_fence *f,
+					      struct amdgpu_ring *ring)
+{
+	struct amd_sched_fence *s_fence = to_amd_sched_fence(f);
+
+	if (dma_fence_is_signaled(f))
+		return ERR_PTR(-ENOENT);
+
+	if (ring && s_fence) {
+		/* For fences from the same ring it is sufficient
+		 * when they are scheduled.
+		 */
+		if (s_fence->sched == &ring->sched) {
+			if (dma_fence_is_signaled(&s_fence->scheduled))
+				return NULL;
+
+			return &s_fence->scheduled;
+		}
+	}
+
+	return f;
+}
+
 /**
  * amdgpu_sync_peek_fence - get the next fence not signaled yet
  *
@@ -261,37 +491,40 @@ struct dma_fence *amdgpu_sync_peek_fence(struct amdgpu_sync *sync,
 {
 	struct amdgpu_sync_entry *e;
 	struct hlist_node *tmp;
-	int i;
-
+	struct dma_fence *f;
+	unsigned i;
+	int bkt;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	struct hlist_node *node;
-
-	hash_for_each_safe(sync->fences, i, node, tmp, e, node) {
-#else
-	hash_for_each_safe(sync->fences, i, tmp, e, node) {
 #endif
-		struct dma_fence *f = e->fence;
-		struct amd_sched_fence *s_fence = to_amd_sched_fence(f);
 
-		if (dma_fence_is_signaled(f)) {
-			hash_del(&e->node);
-			dma_fence_put(f);
-			kmem_cache_free(amdgpu_sync_slab, e);
+	for (i = 0; i < sync->num_inline;) {
+		f = amdgpu_sync_peek_one(sync->inline_fences[i], ring);
+		if (f != ERR_PTR(-ENOENT)) {
+			if (f)
+				return f;
+			++i;
 			continue;
 		}
-		if (ring && s_fence) {
-			/* For fences from the same ring it is sufficient
-			 * when they are scheduled.
-			 */
-			if (s_fence->sched == &ring->sched) {
-				if (dma_fence_is_signaled(&s_fence->scheduled))
-					continue;
-
-				return &s_fence->scheduled;
-			}
-		}
 
-		return f;
+		dma_fence_put(amdgpu_sync_inline_del(sync, i));
+	}
+
+	if (!sync->num_hashed)
+		return NULL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	hash_for_each_safe(sync->fences, bkt, node, tmp, e, node) {
+#else
+	hash_for_each_safe(sync->fences, bkt, tmp, e, node) {
+#endif
+		f = amdgpu_sync_peek_one(e->fence, ring);
+		if (f == ERR_PTR(-ENOENT)) {
+			dma_fence_put(amdgpu_sync_hash_del(sync, e));
+			continue;
+		}
+		if (f)
+			return f;
 	}
 
 	return NULL;
@@ -312,17 +545,25 @@ struct dma_fence *amdgpu_sync_get_fence(struct amdgpu_sync *sync)
 	int i;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	struct hlist_node *node;
+#endif
+
+	while (sync->num_inline) {
+		f = sync->inline_fences[--sync->num_inline];
+		if (!dma_fence_is_signaled(f))
+			return f;
 
+		dma_fence_put(f);
+	}
+
+	if (!sync->num_hashed)
+		return NULL;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	hash_for_each_safe(sync->fences, i, node, tmp, e, node) {
 #else
 	hash_for_each_safe(sync->fences, i, tmp, e, node) {
 #endif
-
-		f = e->fence;
-
-		hash_del(&e->node);
-		kmem_cache_free(amdgpu_sync_slab, e);
-
+		f = amdgpu_sync_hash_del(sync, e);
 		if (!dma_fence_is_signaled(f))
 			return f;
 
@@ -338,11 +579,28 @@ int amdgpu_sync_clone(struct amdgpu_device *adev,
 	struct amdgpu_sync_entry *e;
 	struct hlist_node *tmp;
 	struct dma_fence *f;
+	unsigned j;
 	int i, r;
-
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	struct hlist_node *node;
+#endif
+
+	for (j = 0; j < source->num_inline;) {
+		f = source->inline_fences[j];
+		if (!dma_fence_is_signaled(f)) {
+			r = amdgpu_sync_fence(adev, clone, f);
+			if (r)
+				return r;
+			++j;
+		} else {
+			dma_fence_put(amdgpu_sync_inline_del(source, j));
+		}
+	}
+
+	if (!source->num_hashed)
+		return 0;
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	hash_for_each_safe(source->fences, i, node, tmp, e, node) {
 #else
 	hash_for_each_safe(source->fences, i, tmp, e, node) {
@@ -354,9 +612,7 @@ int amdgpu_sync_clone(struct amdgpu_device *adev,
 			if (r)
 				return r;
 		} else {
-			hash_del(&e->node);
-			dma_fence_put(f);
-			kmem_cache_free(amdgpu_sync_slab, e);
+			dma_fence_put(amdgpu_sync_hash_del(source, e));
 		}
 	}
 	return 0;
@@ -369,7 +625,21 @@ int amdgpu_sync_wait(struct amdgpu_sync *sync, bool intr)
 	int i, r;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	struct hlist_node *node;
+#endif
+
+	while (sync->num_inline) {
+		r = dma_fence_wait(sync->inline_fences[sync->num_inline - 1],
+				   intr);
+		if (r)
+			return r;
 
+		dma_fence_put(sync->inline_fences[--sync->num_inline]);
+	}
+
+	if (!sync->num_hashed)
+		return 0;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	hash_for_each_safe(sync->fences, i, node, tmp, e, node) {
 #else
 	hash_for_each_safe(sync->fences, i, tmp, e, node) {
@@ -378,9 +648,7 @@ int amdgpu_sync_wait(struct amdgpu_sync *sync, bool intr)
 		if (r)
 			return r;
 
-		hash_del(&e->node);
-		dma_fence_put(e->fence);
-		kmem_cache_free(amdgpu_sync_slab, e);
+		dma_fence_put(amdgpu_sync_hash_del(sync, e));
 	}
 
 	return 0;
@@ -400,14 +668,18 @@ void amdgpu_sync_free(struct amdgpu_sync *sync)
 	unsigned i;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
 	struct hlist_node *node;
+#endif
 
-	hash_for_each_safe(sync->fences, i, node, tmp, e, node) {
+	while (sync->num_inline)
+		dma_fence_put(sync->inline_fences[--sync->num_inline]);
+
+	if (sync->num_hashed) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hash_for_each_safe(sync->fences, i, node, tmp, e, node)
 #else
-	hash_for_each_safe(sync->fences, i, tmp, e, node) {
+		hash_for_each_safe(sync->fences, i, tmp, e, node)
 #endif
-		hash_del(&e->node);
-		dma_fence_put(e->fence);
-		kmem_cache_free(amdgpu_sync_slab, e);
+			dma_fence_put(amdgpu_sync_hash_del(sync, e));
 	}
 
 	dma_fence_put(sync->last_vm_update);
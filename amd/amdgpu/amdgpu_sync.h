@@ -31,10 +31,19 @@ struct reservation_object;
 struct amdgpu_device;
 struct amdgpu_ring;
 
+/* number of fence contexts a sync object can hold without allocating */
+#define AMDGPU_SYNC_INLINE_FENCES	4
+
 /*
  * Container for fences used to sync command submissions.
+ *
+ * Holds at most one fence per context. The first few contexts are stored
+ * inline, only further ones are allocated and hashed.
  */
 struct amdgpu_sync {
+	unsigned		num_inline;
+	unsigned		num_hashed;
+	struct dma_fence	*inline_fences[AMDGPU_SYNC_INLINE_FENCES];
 	DECLARE_HASHTABLE(fences, 4);
 	struct dma_fence	*last_vm_update;
 };
@@ -46,6 +55,10 @@ int amdgpu_sync_resv(struct amdgpu_device *adev,
 		     struct amdgpu_sync *sync,
 		     struct reservation_object *resv,
 		     void *owner);
+int amdgpu_sync_resv_rcu(struct amdgpu_device *adev,
+			 struct amdgpu_sync *sync,
+			 struct reservation_object *resv,
+			 void *owner);
 struct dma_fence *amdgpu_sync_peek_fence(struct amdgpu_sync *sync,
 				     struct amdgpu_ring *ring);
 struct dma_fence *amdgpu_sync_get_fence(struct amdgpu_sync *sync);
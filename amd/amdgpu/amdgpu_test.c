@@ -26,6 +26,7 @@
 #include "amdgpu.h"
 #include "amdgpu_uvd.h"
 #include "amdgpu_vce.h"
+#include "amdgpu_vm_pte_plan.h"
 
 /* Test BO GTT->VRAM and VRAM->GTT GPU copies across the whole GTT aperture */
 static void amdgpu_do_test_moves(struct amdgpu_device *adev)
@@ -237,3 +238,102 @@ void amdgpu_test_moves(struct amdgpu_device *adev)
 	if (adev->mman.buffer_funcs)
 		amdgpu_do_test_moves(adev);
 }
+
+struct amdgpu_test_pte_plan_case {
+	const char			*name;
+	unsigned			max_frag;
+	bool				huge_pages;
+	bool				copy;
+	uint64_t			start;
+	struct amdgpu_vm_pte_run	runs[3];
+	unsigned			num_runs;
+	/* expected number of operations of each type */
+	unsigned			ops[3];
+};
+
+/* page tables with 512 entries, 2MB huge pages */
+static const struct amdgpu_test_pte_plan_case amdgpu_test_pte_plan_cases[] = {
+	{ "huge pages", 4, true, false, 512,
+	  { { 0x200000, 1024 } }, 1, { 0, 2, 0 } },
+	{ "contiguous runs", 4, true, false, 512,
+	  { { 0x200000, 256 }, { 0x300000, 512 }, { 0x500000, 256 } }, 3,
+	  { 0, 2, 0 } },
+	{ "split runs", 4, true, false, 512,
+	  { { 0x200000, 512 }, { 0x800000, 512 } }, 2, { 0, 2, 0 } },
+	{ "no huge pages", 4, false, false, 512,
+	  { { 0x200000, 1024 } }, 1, { 2, 0, 0 } },
+	{ "no fragments", 0, false, false, 512,
+	  { { 0x200000, 1024 } }, 1, { 2, 0, 0 } },
+	{ "fragment edges", 4, true, false, 3,
+	  { { 0x203000, 600 } }, 1, { 8, 0, 0 } },
+	{ "misaligned dst", 4, true, false, 512,
+	  { { 0x201000, 1024 } }, 1, { 2, 0, 0 } },
+	{ "partially aligned dst", 4, true, false, 512,
+	  { { 0x202000, 1024 } }, 1, { 2, 0, 0 } },
+	{ "copy", 4, true, true, 100,
+	  { { 0, 600 } }, 1, { 0, 0, 2 } },
+};
+
+struct amdgpu_test_pte_plan_state {
+	uint64_t	next;
+	unsigned	ops[3];
+	bool		gap;
+};
+
+static int amdgpu_test_pte_plan_emit(void *data,
+				     const struct amdgpu_vm_pte_op *op)
+{
+	struct amdgpu_test_pte_plan_state *state = data;
+
+	if (op->start != state->next || !op->count)
+		state->gap = true;
+
+	state->next = op->start + op->count;
+	++state->ops[op->type];
+	return 0;
+}
+
+/* Test the number of operations the PTE planner emits for some ranges */
+void amdgpu_test_pte_plan(void)
+{
+	const struct amdgpu_test_pte_plan_case *c;
+	struct amdgpu_test_pte_plan_state state;
+	struct amdgpu_vm_pte_planner planner = {
+		.block_size = 9,
+		.emit = amdgpu_test_pte_plan_emit,
+		.data = &state,
+	};
+	unsigned i, j, failed = 0;
+	uint64_t end;
+
+	for (i = 0; i < ARRAY_SIZE(amdgpu_test_pte_plan_cases); ++i) {
+		c = &amdgpu_test_pte_plan_cases[i];
+
+		planner.max_frag = c->max_frag;
+		planner.huge_pages = c->huge_pages;
+		planner.copy = c->copy;
+
+		memset(&state, 0, sizeof(state));
+		state.next = c->start;
+		amdgpu_vm_pte_plan_runs(&planner, c->start, c->runs,
+					c->num_runs);
+
+		end = c->start;
+		for (j = 0; j < c->num_runs; ++j)
+			end += c->runs[j].count;
+
+		if (state.gap || state.next != end ||
+		    memcmp(state.ops, c->ops, sizeof(state.ops))) {
+			DRM_ERROR("PTE planner test \"%s\" failed: %u/%u/%u "
+				  "operations, expected %u/%u/%u%s\n", c->name,
+				  state.ops[0], state.ops[1], state.ops[2],
+				  c->ops[0], c->ops[1], c->ops[2],
+				  state.gap || state.next != end ?
+				  ", range not covered" : "");
+			++failed;
+		}
+	}
+
+	DRM_INFO("Tested PTE planner, %u of %u cases failed\n", failed,
+		 (unsigned)ARRAY_SIZE(amdgpu_test_pte_plan_cases));
+}
@@ -54,7 +54,16 @@ static int amdgpu_map_buffer(struct ttm_buffer_object *bo,
 			     struct ttm_mem_reg *mem, unsigned num_pages,
 			     uint64_t offset, unsigned window,
 			     struct amdgpu_ring *ring,
+			     struct amd_sched_entity *entity,
 			     uint64_t *addr);
+static int amdgpu_ttm_copy(struct amdgpu_ring *ring,
+			   struct amd_sched_entity *entity,
+			   uint64_t src_offset, uint64_t dst_offset,
+			   uint32_t byte_count,
+			   struct reservation_object *resv,
+			   struct dma_fence **deps, unsigned num_deps,
+			   struct dma_fence **fence, bool direct_submit,
+			   bool vm_needs_flush);
 
 static int amdgpu_ttm_debugfs_init(struct amdgpu_device *adev);
 static void amdgpu_ttm_debugfs_fini(struct amdgpu_device *adev);
@@ -72,6 +81,66 @@ static void amdgpu_ttm_mem_global_release(struct drm_global_reference *ref)
 	ttm_mem_global_release(ref->object);
 }
 
+static struct amd_sched_entity *
+amdgpu_ttm_copy_entity(struct amdgpu_device *adev, unsigned idx)
+{
+	return idx ? &adev->mman.copy_entities[idx - 1] : &adev->mman.entity;
+}
+
+static void amdgpu_ttm_copy_entities_fini(struct amdgpu_device *adev)
+{
+	while (adev->mman.num_copy_rings > 1) {
+		struct amd_sched_entity *entity =
+			amdgpu_ttm_copy_entity(adev, --adev->mman.num_copy_rings);
+
+		amd_sched_entity_fini(entity->sched, entity);
+	}
+}
+
+/**
+ * amdgpu_ttm_copy_entities_init - setup additional rings for moves
+ *
+ * @adev: amdgpu_device pointer
+ *
+ * Add the SDMA rings besides buffer_funcs_ring, so that big moves can be
+ * spread over all copy engines.
+ */
+static int amdgpu_ttm_copy_entities_init(struct amdgpu_device *adev)
+{
+	struct amdgpu_ring *ring;
+	struct amd_sched_rq *rq;
+	unsigned i;
+	int r;
+
+	adev->mman.copy_rings[0] = adev->mman.buffer_funcs_ring;
+	adev->mman.num_copy_rings = 1;
+
+	for (i = 0; i < adev->sdma.num_instances; ++i) {
+		unsigned idx = adev->mman.num_copy_rings;
+
+		ring = &adev->sdma.instance[i].ring;
+		if (ring == adev->mman.buffer_funcs_ring)
+			continue;
+
+		if (idx == AMDGPU_TTM_MAX_COPY_RINGS)
+			break;
+
+		rq = &ring->sched.sched_rq[AMD_SCHED_PRIORITY_KERNEL];
+		r = amd_sched_entity_init(&ring->sched,
+					  amdgpu_ttm_copy_entity(adev, idx),
+					  rq);
+		if (r) {
+			amdgpu_ttm_copy_entities_fini(adev);
+			return r;
+		}
+
+		adev->mman.copy_rings[idx] = ring;
+		adev->mman.num_copy_rings++;
+	}
+
+	return 0;
+}
+
 static int amdgpu_ttm_global_init(struct amdgpu_device *adev)
 {
 	struct drm_global_reference *global_ref;
@@ -110,16 +179,24 @@ static int amdgpu_ttm_global_init(struct amdgpu_device *adev)
 	ring = adev->mman.buffer_funcs_ring;
 	rq = &ring->sched.sched_rq[AMD_SCHED_PRIORITY_KERNEL];
 	r = amd_sched_entity_init(&ring->sched, &adev->mman.entity,
-				  rq, amdgpu_sched_jobs);
+				  rq);
 	if (r) {
 		DRM_ERROR("Failed setting up TTM BO move run queue.\n");
 		goto error_entity;
 	}
 
+	r = amdgpu_ttm_copy_entities_init(adev);
+	if (r) {
+		DRM_ERROR("Failed setting up TTM BO copy run queues.\n");
+		goto error_copy_entities;
+	}
+
 	adev->mman.mem_global_referenced = true;
 
 	return 0;
 
+error_copy_entities:
+	amd_sched_entity_fini(adev->mman.entity.sched, &adev->mman.entity);
 error_entity:
 	kcl_drm_global_item_unref(&adev->mman.bo_global_ref.ref);
 error_bo:
@@ -131,6 +208,7 @@ error_mem:
 static void amdgpu_ttm_global_fini(struct amdgpu_device *adev)
 {
 	if (adev->mman.mem_global_referenced) {
+		amdgpu_ttm_copy_entities_fini(adev);
 		amd_sched_entity_fini(adev->mman.entity.sched,
 				      &adev->mman.entity);
 		mutex_destroy(&adev->mman.gtt_window_lock);
@@ -336,6 +414,112 @@ static uint64_t amdgpu_mm_node_addr(struct ttm_buffer_object *bo,
 	return addr;
 }
 
+struct amdgpu_move_sample {
+	struct dma_fence_cb	cb;
+	struct amdgpu_device	*adev;
+	ktime_t			submit;
+	u64			bytes;
+	unsigned		dir;
+};
+
+/**
+ * amdgpu_move_sample_cb - account a finished blit
+ *
+ * @f: fence of the last copy of the move
+ * @cb: the callback structure
+ *
+ * Update the average throughput of the move direction. The time is counted
+ * from the submission or the end of the previous blit, whichever is later,
+ * so that moves queued behind each other aren't accounted twice.
+ */
+static void amdgpu_move_sample_cb(struct dma_fence *f, struct dma_fence_cb *cb)
+{
+	struct amdgpu_move_sample *sample =
+		container_of(cb, struct amdgpu_move_sample, cb);
+	struct amdgpu_device *adev = sample->adev;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	s64 us;
+
+	spin_lock_irqsave(&adev->mm_stats.blit_lock, flags);
+	us = ktime_us_delta(now, ktime_after(sample->submit,
+					     adev->mm_stats.last_blit_end) ?
+			    sample->submit : adev->mm_stats.last_blit_end);
+	adev->mm_stats.last_blit_end = now;
+
+	/* Small moves are dominated by the submission overhead */
+	if (us > 0 && sample->bytes >= (1 << 20)) {
+		u32 *avg = &adev->mm_stats.blit_MBps[sample->dir];
+		u32 MBps = min_t(u64, div64_u64(sample->bytes, us), U32_MAX);
+
+		*avg = *avg ? (*avg * 7ULL + MBps) / 8 : MBps;
+		adev->mm_stats.blit_samples[sample->dir]++;
+	}
+	spin_unlock_irqrestore(&adev->mm_stats.blit_lock, flags);
+
+	kfree(sample);
+}
+
+/**
+ * amdgpu_move_sample - measure the throughput of a blit
+ *
+ * @adev: amdgpu_device pointer
+ * @old_mem: source of the move
+ * @new_mem: destination of the move
+ * @submit: time the first copy was submitted
+ * @fence: fence of the last copy
+ *
+ * Only moves to or from VRAM are measured, failing to allocate the sample
+ * just drops it.
+ */
+static void amdgpu_move_sample(struct amdgpu_device *adev,
+			       struct ttm_mem_reg *old_mem,
+			       struct ttm_mem_reg *new_mem,
+			       ktime_t submit, struct dma_fence *fence)
+{
+	struct amdgpu_move_sample *sample;
+	unsigned dir;
+
+	if (new_mem->mem_type == TTM_PL_VRAM)
+		dir = AMDGPU_MOVE_TO_VRAM;
+	else if (old_mem->mem_type == TTM_PL_VRAM)
+		dir = AMDGPU_MOVE_FROM_VRAM;
+	else
+		return;
+
+	sample = kmalloc(sizeof(*sample), GFP_KERNEL);
+	if (!sample)
+		return;
+
+	sample->adev = adev;
+	sample->submit = submit;
+	sample->bytes = (u64)new_mem->num_pages << PAGE_SHIFT;
+	sample->dir = dir;
+	if (dma_fence_add_callback(fence, &sample->cb, amdgpu_move_sample_cb))
+		kfree(sample);
+}
+
+/**
+ * amdgpu_move_pick_ring - select the ring for the next chunk of a move
+ *
+ * @adev: amdgpu_device pointer
+ * @load: pages queued on each copy ring
+ *
+ * Returns the index of the least loaded copy ring which is ready.
+ */
+static unsigned amdgpu_move_pick_ring(struct amdgpu_device *adev,
+				      unsigned long *load)
+{
+	unsigned i, best = 0;
+
+	for (i = 1; i < adev->mman.num_copy_rings; ++i) {
+		if (adev->mman.copy_rings[i]->ready && load[i] < load[best])
+			best = i;
+	}
+
+	return best;
+}
+
 static int amdgpu_move_blit(struct ttm_buffer_object *bo,
 			    bool evict, bool no_wait_gpu,
 			    struct ttm_mem_reg *new_mem,
@@ -343,11 +527,15 @@ static int amdgpu_move_blit(struct ttm_buffer_object *bo,
 {
 	struct amdgpu_device *adev = amdgpu_ttm_adev(bo->bdev);
 	struct amdgpu_ring *ring = adev->mman.buffer_funcs_ring;
+	struct dma_fence *fences[AMDGPU_TTM_MAX_COPY_RINGS] = {};
+	unsigned long load[AMDGPU_TTM_MAX_COPY_RINGS];
 
 	struct drm_mm_node *old_mm, *new_mm;
 	uint64_t old_start, old_size, new_start, new_size;
 	unsigned long num_pages;
-	struct dma_fence *fence = NULL;
+	struct dma_fence *fence;
+	ktime_t submit;
+	unsigned i;
 	int r;
 
 	BUILD_BUG_ON((PAGE_SIZE % AMDGPU_GPU_PAGE_SIZE) != 0);
@@ -357,6 +545,21 @@ static int amdgpu_move_blit(struct ttm_buffer_object *bo,
 		return -EINVAL;
 	}
 
+	submit = ktime_get();
+
+	/* Start with what is already queued up on each ring, a job is
+	 * accounted as a full transfer window.
+	 */
+	for (i = 0; i < adev->mman.num_copy_rings; ++i) {
+		struct amdgpu_ring *copy_ring = adev->mman.copy_rings[i];
+		struct amd_sched_entity *entity =
+			amdgpu_ttm_copy_entity(adev, i);
+
+		load[i] = atomic_read(&copy_ring->sched.hw_rq_count) +
+			spsc_queue_count(&entity->job_queue);
+		load[i] *= AMDGPU_GTT_MAX_TRANSFER_SIZE;
+	}
+
 	old_mm = old_mem->mm_node;
 	old_size = old_mm->size;
 	old_start = amdgpu_mm_node_addr(bo, old_mm, old_mem);
@@ -371,12 +574,32 @@ static int amdgpu_move_blit(struct ttm_buffer_object *bo,
 		unsigned long cur_pages = min(min(old_size, new_size),
 					      (u64)AMDGPU_GTT_MAX_TRANSFER_SIZE);
 		uint64_t from = old_start, to = new_start;
+		struct dma_fence *deps[AMDGPU_TTM_MAX_COPY_RINGS];
+		struct amd_sched_entity *entity;
+		unsigned idx = 0, num_deps = 0;
 		struct dma_fence *next;
 
+		/* Chunks are spread over the copy rings, the last one always
+		 * goes to buffer_funcs_ring and waits for all the others. This
+		 * way the move is still finished by a single fence from the
+		 * buffer move entity which TTM can order against others.
+		 */
+		if (num_pages > cur_pages) {
+			idx = amdgpu_move_pick_ring(adev, load);
+		} else {
+			for (i = 1; i < adev->mman.num_copy_rings; ++i)
+				if (fences[i])
+					deps[num_deps++] = fences[i];
+		}
+		ring = adev->mman.copy_rings[idx];
+		entity = amdgpu_ttm_copy_entity(adev, idx);
+		load[idx] += cur_pages;
+
 		if (old_mem->mem_type == TTM_PL_TT &&
 		    !amdgpu_gtt_mgr_is_allocated(old_mem)) {
 			r = amdgpu_map_buffer(bo, old_mem, cur_pages,
-					      old_start, 0, ring, &from);
+					      old_start, idx * 2, ring, entity,
+					      &from);
 			if (r)
 				goto error;
 		}
@@ -384,19 +607,20 @@ static int amdgpu_move_blit(struct ttm_buffer_object *bo,
 		if (new_mem->mem_type == TTM_PL_TT &&
 		    !amdgpu_gtt_mgr_is_allocated(new_mem)) {
 			r = amdgpu_map_buffer(bo, new_mem, cur_pages,
-					      new_start, 1, ring, &to);
+					      new_start, idx * 2 + 1, ring,
+					      entity, &to);
 			if (r)
 				goto error;
 		}
 
-		r = amdgpu_copy_buffer(ring, from, to,
-				       cur_pages * PAGE_SIZE,
-				       bo->resv, &next, false, true);
+		r = amdgpu_ttm_copy(ring, entity, from, to,
+				    cur_pages * PAGE_SIZE, bo->resv,
+				    deps, num_deps, &next, false, true);
 		if (r)
 			goto error;
 
-		dma_fence_put(fence);
-		fence = next;
+		dma_fence_put(fences[idx]);
+		fences[idx] = next;
 
 		num_pages -= cur_pages;
 		if (!num_pages)
@@ -420,6 +644,11 @@ static int amdgpu_move_blit(struct ttm_buffer_object *bo,
 	}
 	mutex_unlock(&adev->mman.gtt_window_lock);
 
+	fence = fences[0];
+	for (i = 1; i < adev->mman.num_copy_rings; ++i)
+		dma_fence_put(fences[i]);
+
+	amdgpu_move_sample(adev, old_mem, new_mem, submit, fence);
 	r = ttm_bo_pipeline_move(bo, fence, evict, new_mem);
 	dma_fence_put(fence);
 	return r;
@@ -427,9 +656,11 @@ static int amdgpu_move_blit(struct ttm_buffer_object *bo,
 error:
 	mutex_unlock(&adev->mman.gtt_window_lock);
 
-	if (fence)
-		dma_fence_wait(fence, false);
-	dma_fence_put(fence);
+	for (i = 0; i < adev->mman.num_copy_rings; ++i) {
+		if (fences[i])
+			dma_fence_wait(fences[i], false);
+		dma_fence_put(fences[i]);
+	}
 	return r;
 }
 
@@ -1713,6 +1944,7 @@ static int amdgpu_map_buffer(struct ttm_buffer_object *bo,
 			     struct ttm_mem_reg *mem, unsigned num_pages,
 			     uint64_t offset, unsigned window,
 			     struct amdgpu_ring *ring,
+			     struct amd_sched_entity *entity,
 			     uint64_t *addr)
 {
 	struct amdgpu_ttm_tt *gtt = (void *)bo->ttm;
@@ -1761,7 +1993,7 @@ static int amdgpu_map_buffer(struct ttm_buffer_object *bo,
 	if (r)
 		goto error_free;
 
-	r = amdgpu_job_submit(job, ring, &adev->mman.entity,
+	r = amdgpu_job_submit(job, ring, entity,
 			      AMDGPU_FENCE_OWNER_UNDEFINED, &fence);
 	if (r)
 		goto error_free;
@@ -1775,11 +2007,29 @@ error_free:
 	return r;
 }
 
-int amdgpu_copy_buffer(struct amdgpu_ring *ring, uint64_t src_offset,
-		       uint64_t dst_offset, uint32_t byte_count,
-		       struct reservation_object *resv,
-		       struct dma_fence **fence, bool direct_submit,
-		       bool vm_needs_flush)
+/**
+ * amdgpu_ttm_copy - copy memory with the copy engine
+ *
+ * @ring: ring to run the copy on
+ * @entity: scheduler entity of @ring to submit the copy with
+ * @src_offset: source MC address
+ * @dst_offset: destination MC address
+ * @byte_count: number of bytes to copy
+ * @resv: reservation object to sync to or NULL
+ * @deps: additional fences the copy has to wait for
+ * @num_deps: number of fences in @deps
+ * @fence: resulting fence of the copy
+ * @direct_submit: bypass the scheduler
+ * @vm_needs_flush: flush the GART TLB before the copy
+ */
+static int amdgpu_ttm_copy(struct amdgpu_ring *ring,
+			   struct amd_sched_entity *entity,
+			   uint64_t src_offset, uint64_t dst_offset,
+			   uint32_t byte_count,
+			   struct reservation_object *resv,
+			   struct dma_fence **deps, unsigned num_deps,
+			   struct dma_fence **fence, bool direct_submit,
+			   bool vm_needs_flush)
 {
 	struct amdgpu_device *adev = ring->adev;
 	struct amdgpu_job *job;
@@ -1811,6 +2061,12 @@ int amdgpu_copy_buffer(struct amdgpu_ring *ring, uint64_t src_offset,
 		}
 	}
 
+	for (i = 0; i < num_deps; i++) {
+		r = amdgpu_sync_fence(adev, &job->sync, deps[i]);
+		if (r)
+			goto error_free;
+	}
+
 	for (i = 0; i < num_loops; i++) {
 		uint32_t cur_size_in_bytes = min(byte_count, max_bytes);
 
@@ -1832,7 +2088,7 @@ int amdgpu_copy_buffer(struct amdgpu_ring *ring, uint64_t src_offset,
 			DRM_ERROR("Error scheduling IBs (%d)\n", r);
 		amdgpu_job_free(job);
 	} else {
-		r = amdgpu_job_submit(job, ring, &adev->mman.entity,
+		r = amdgpu_job_submit(job, ring, entity,
 				      AMDGPU_FENCE_OWNER_UNDEFINED, fence);
 		if (r)
 			goto error_free;
@@ -1845,6 +2101,17 @@ error_free:
 	return r;
 }
 
+int amdgpu_copy_buffer(struct amdgpu_ring *ring, uint64_t src_offset,
+		       uint64_t dst_offset, uint32_t byte_count,
+		       struct reservation_object *resv,
+		       struct dma_fence **fence, bool direct_submit,
+		       bool vm_needs_flush)
+{
+	return amdgpu_ttm_copy(ring, &ring->adev->mman.entity, src_offset,
+			       dst_offset, byte_count, resv, NULL, 0, fence,
+			       direct_submit, vm_needs_flush);
+}
+
 int amdgpu_fill_buffer(struct amdgpu_bo *bo,
 		       uint64_t src_data,
 		       struct reservation_object *resv,
@@ -1971,6 +2238,34 @@ static int amdgpu_mm_dump_table(struct seq_file *m, void *data)
 #endif
 }
 
+static int amdgpu_move_model_info(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *)m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct amdgpu_device *adev = dev->dev_private;
+	static const char *dirs[AMDGPU_MOVE_NUM_DIRS] = {
+		"to vram", "from vram"
+	};
+	unsigned i;
+
+	for (i = 0; i < AMDGPU_MOVE_NUM_DIRS; ++i) {
+		u32 MBps;
+		u64 samples;
+
+		spin_lock_irq(&adev->mm_stats.blit_lock);
+		MBps = adev->mm_stats.blit_MBps[i];
+		samples = adev->mm_stats.blit_samples[i];
+		spin_unlock_irq(&adev->mm_stats.blit_lock);
+
+		seq_printf(m, "blit %s: %u MB/s (%llu samples)\n",
+			   dirs[i], MBps, samples);
+	}
+	seq_printf(m, "move rate: %u MB/s (%s)\n",
+		   1u << READ_ONCE(adev->mm_stats.log2_max_MBps),
+		   adev->mm_stats.learn_rate ? "learned" : "fixed");
+	return 0;
+}
+
 static int ttm_pl_vram = TTM_PL_VRAM;
 static int ttm_pl_tt = TTM_PL_TT;
 static int ttm_pl_dgma = AMDGPU_PL_DGMA;
@@ -1979,6 +2274,7 @@ static int ttm_pl_dgma_import = AMDGPU_PL_DGMA_IMPORT;
 static const struct drm_info_list amdgpu_ttm_debugfs_list[] = {
 	{"amdgpu_vram_mm", amdgpu_mm_dump_table, 0, &ttm_pl_vram},
 	{"amdgpu_gtt_mm", amdgpu_mm_dump_table, 0, &ttm_pl_tt},
+	{"amdgpu_move_model", amdgpu_move_model_info, 0, NULL},
 	{"ttm_page_pool", ttm_page_alloc_debugfs, 0, NULL},
 #ifdef CONFIG_SWIOTLB
 	{"ttm_dma_page_pool", ttm_dma_page_alloc_debugfs, 0, NULL}
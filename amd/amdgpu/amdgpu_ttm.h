@@ -39,7 +39,14 @@
 #define AMDGPU_PL_FLAG_DGMA_IMPORT	(TTM_PL_FLAG_PRIV << 4)
 
 #define AMDGPU_GTT_MAX_TRANSFER_SIZE	512
-#define AMDGPU_GTT_NUM_TRANSFER_WINDOWS	2
+/* maximum number of rings moves can be spread over, each needs two windows */
+#define AMDGPU_TTM_MAX_COPY_RINGS	2
+#define AMDGPU_GTT_NUM_TRANSFER_WINDOWS	(2 * AMDGPU_TTM_MAX_COPY_RINGS)
+
+/* directions of buffer moves measured for the move throttling */
+#define AMDGPU_MOVE_TO_VRAM		0
+#define AMDGPU_MOVE_FROM_VRAM		1
+#define AMDGPU_MOVE_NUM_DIRS		2
 
 struct amdgpu_mman {
 	struct ttm_bo_global_ref        bo_global_ref;
@@ -60,6 +67,13 @@ struct amdgpu_mman {
 	struct mutex				gtt_window_lock;
 	/* Scheduler entity for buffer moves */
 	struct amd_sched_entity			entity;
+
+	/* Rings big moves are spread over, the first is buffer_funcs_ring
+	 * using the entity above, the others use copy_entities.
+	 */
+	unsigned				num_copy_rings;
+	struct amdgpu_ring			*copy_rings[AMDGPU_TTM_MAX_COPY_RINGS];
+	struct amd_sched_entity			copy_entities[AMDGPU_TTM_MAX_COPY_RINGS - 1];
 };
 
 extern const struct ttm_mem_type_manager_func amdgpu_gtt_mgr_func;
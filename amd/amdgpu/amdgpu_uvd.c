@@ -30,6 +30,8 @@
 
 #include <linux/firmware.h>
 #include <linux/module.h>
+#include <linux/sort.h>
+#include <linux/bsearch.h>
 #include <drm/drmP.h>
 #include <drm/drm.h>
 
@@ -92,6 +94,11 @@ struct amdgpu_uvd_cs_ctx {
 
 	/* minimum buffer sizes */
 	unsigned *buf_sizes;
+
+	/* sorted GPU pages of all relocations and their mappings */
+	uint64_t *addrs;
+	struct amdgpu_bo_va_mapping **mappings;
+	unsigned num_addrs;
 };
 
 #ifdef CONFIG_DRM_AMDGPU_CIK
@@ -232,7 +239,7 @@ int amdgpu_uvd_sw_init(struct amdgpu_device *adev)
 	ring = &adev->uvd.ring;
 	rq = &ring->sched.sched_rq[AMD_SCHED_PRIORITY_NORMAL];
 	r = amd_sched_entity_init(&ring->sched, &adev->uvd.entity,
-				  rq, amdgpu_sched_jobs);
+				  rq);
 	if (r != 0) {
 		DRM_ERROR("Failed setting up UVD run queue.\n");
 		return r;
@@ -394,6 +401,55 @@ static u64 amdgpu_uvd_get_addr_from_ctx(struct amdgpu_uvd_cs_ctx *ctx)
 	return addr;
 }
 
+/**
+ * amdgpu_uvd_cs_collect - collect relocation addresses
+ *
+ * @ctx: UVD parser context
+ *
+ * Remember the address of each relocation, so that all of them can be
+ * resolved with a single walk over the VA tree.
+ */
+static int amdgpu_uvd_cs_collect(struct amdgpu_uvd_cs_ctx *ctx)
+{
+	uint64_t addr = amdgpu_uvd_get_addr_from_ctx(ctx);
+
+	ctx->addrs[ctx->num_addrs++] = addr / AMDGPU_GPU_PAGE_SIZE;
+	return 0;
+}
+
+static int amdgpu_uvd_cmp_addr(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * amdgpu_uvd_cs_find_mapping - find the BO of a relocation
+ *
+ * @ctx: UVD parser context
+ * @addr: VM address of the relocation
+ * @bo: resulting BO of the mapping found
+ * @mapping: resulting mapping
+ *
+ * Look the address up in the mappings resolved by amdgpu_uvd_cs_resolve().
+ */
+static int amdgpu_uvd_cs_find_mapping(struct amdgpu_uvd_cs_ctx *ctx,
+				      uint64_t addr, struct amdgpu_bo **bo,
+				      struct amdgpu_bo_va_mapping **mapping)
+{
+	uint64_t *found;
+
+	addr /= AMDGPU_GPU_PAGE_SIZE;
+	found = bsearch(&addr, ctx->addrs, ctx->num_addrs, sizeof(addr),
+			amdgpu_uvd_cmp_addr);
+	if (!found)
+		return -EINVAL;
+
+	*mapping = ctx->mappings[found - ctx->addrs];
+	return amdgpu_cs_bind_mapping(ctx->parser, *mapping, bo);
+}
+
 /**
  * amdgpu_uvd_cs_pass1 - first parsing round
  *
@@ -410,7 +466,7 @@ static int amdgpu_uvd_cs_pass1(struct amdgpu_uvd_cs_ctx *ctx)
 	uint64_t addr = amdgpu_uvd_get_addr_from_ctx(ctx);
 	int r = 0;
 
-	r = amdgpu_cs_find_mapping(ctx->parser, addr, &bo, &mapping);
+	r = amdgpu_uvd_cs_find_mapping(ctx, addr, &bo, &mapping);
 	if (r) {
 		DRM_ERROR("Can't find BO for addr 0x%08Lx\n", addr);
 		return r;
@@ -737,7 +793,7 @@ static int amdgpu_uvd_cs_pass2(struct amdgpu_uvd_cs_ctx *ctx)
 	uint64_t addr = amdgpu_uvd_get_addr_from_ctx(ctx);
 	int r;
 
-	r = amdgpu_cs_find_mapping(ctx->parser, addr, &bo, &mapping);
+	r = amdgpu_uvd_cs_find_mapping(ctx, addr, &bo, &mapping);
 	if (r) {
 		DRM_ERROR("Can't find BO for addr 0x%08Lx\n", addr);
 		return r;
@@ -888,6 +944,45 @@ static int amdgpu_uvd_cs_packets(struct amdgpu_uvd_cs_ctx *ctx,
 	return 0;
 }
 
+/**
+ * amdgpu_uvd_cs_resolve - resolve all relocations of the IB
+ *
+ * @ctx: UVD parser context
+ *
+ * Collect the addresses of all relocations and look them up with a single
+ * walk over the VA tree, instead of one lookup per relocation and pass.
+ */
+static int amdgpu_uvd_cs_resolve(struct amdgpu_uvd_cs_ctx *ctx)
+{
+	struct amdgpu_ib *ib = &ctx->parser->job->ibs[ctx->ib_idx];
+	unsigned i, j;
+	int r;
+
+	/* every relocation takes at least a register write */
+	ctx->addrs = kmalloc_array(ib->length_dw / 2, sizeof(*ctx->addrs),
+				   GFP_KERNEL);
+	ctx->mappings = kmalloc_array(ib->length_dw / 2,
+				      sizeof(*ctx->mappings), GFP_KERNEL);
+	if (!ctx->addrs || !ctx->mappings)
+		return -ENOMEM;
+
+	r = amdgpu_uvd_cs_packets(ctx, amdgpu_uvd_cs_collect);
+	if (r)
+		return r;
+
+	sort(ctx->addrs, ctx->num_addrs, sizeof(*ctx->addrs),
+	     amdgpu_uvd_cmp_addr, NULL);
+
+	for (i = 0, j = 0; i < ctx->num_addrs; ++i)
+		if (!j || ctx->addrs[i] != ctx->addrs[j - 1])
+			ctx->addrs[j++] = ctx->addrs[i];
+	ctx->num_addrs = j;
+
+	amdgpu_cs_find_mappings(ctx->parser, ctx->addrs, ctx->num_addrs,
+				ctx->mappings);
+	return 0;
+}
+
 /**
  * amdgpu_uvd_ring_parse_cs - UVD command submission parser
  *
@@ -921,25 +1016,32 @@ int amdgpu_uvd_ring_parse_cs(struct amdgpu_cs_parser *parser, uint32_t ib_idx)
 	ctx.buf_sizes = buf_sizes;
 	ctx.ib_idx = ib_idx;
 
+	r = amdgpu_uvd_cs_resolve(&ctx);
+	if (r)
+		goto out;
+
 	/* first round only required on chips without UVD 64 bit address support */
 	if (!parser->adev->uvd.address_64_bit) {
 		/* first round, make sure the buffers are actually in the UVD segment */
 		r = amdgpu_uvd_cs_packets(&ctx, amdgpu_uvd_cs_pass1);
 		if (r)
-			return r;
+			goto out;
 	}
 
 	/* second round, patch buffer addresses into the command stream */
 	r = amdgpu_uvd_cs_packets(&ctx, amdgpu_uvd_cs_pass2);
 	if (r)
-		return r;
+		goto out;
 
 	if (!ctx.has_msg_cmd) {
 		DRM_ERROR("UVD-IBs need a msg command!\n");
-		return -EINVAL;
+		r = -EINVAL;
 	}
 
-	return 0;
+out:
+	kfree(ctx.mappings);
+	kfree(ctx.addrs);
+	return r;
 }
 
 static int amdgpu_uvd_send_msg(struct amdgpu_ring *ring, struct amdgpu_bo *bo,
@@ -38,6 +38,7 @@
 #include <drm/amdgpu_drm.h>
 #include "amdgpu.h"
 #include "amdgpu_trace.h"
+#include "amdgpu_vm_pte_plan.h"
 
 /*
  * GPUVM
@@ -68,6 +69,22 @@ INTERVAL_TREE_DEFINE(struct amdgpu_bo_va_mapping, rb, uint64_t, __subtree_last,
 #undef START
 #undef LAST
 
+/**
+ * amdgpu_vm_va_remove - remove a mapping from the VA tree
+ *
+ * @vm: the requested VM
+ * @mapping: mapping to remove
+ *
+ * Remove the mapping and make sure that lookups don't find it in the cache.
+ */
+static void amdgpu_vm_va_remove(struct amdgpu_vm *vm,
+				struct amdgpu_bo_va_mapping *mapping)
+{
+	if (vm->lookup_cache == mapping)
+		vm->lookup_cache = NULL;
+	amdgpu_vm_it_remove(mapping, &vm->va);
+}
+
 /* Local structure. Encapsulate some VM table update parameters to reduce
  * the number of function parameters
  */
@@ -80,6 +97,10 @@ struct amdgpu_pte_update_params {
 	uint64_t src;
 	/* indirect buffer to fill with commands */
 	struct amdgpu_ib *ib;
+	/* hw access flags of the PTEs, without the fragment */
+	uint64_t flags;
+	/* optional batch the commands are collected in */
+	struct amdgpu_vm_update_batch *batch;
 	/* Function which actually does the update */
 	void (*func)(struct amdgpu_pte_update_params *params, uint64_t pe,
 		     uint64_t addr, unsigned count, uint32_t incr,
@@ -155,6 +176,19 @@ void amdgpu_vm_get_pd_bo(struct amdgpu_vm *vm,
 	list_add(&entry->tv.head, validated);
 }
 
+/**
+ * amdgpu_vm_pt_cpu_access - check if the PDs/PTs are written by the CPU
+ *
+ * @vm: requested vm
+ *
+ * Returns true if the PDs/PTs must be CPU accessible and kmapped. Those are
+ * allocated without shadow, the CPU path doesn't update shadows.
+ */
+static bool amdgpu_vm_pt_cpu_access(struct amdgpu_vm *vm)
+{
+	return vm->use_cpu_for_update || vm->cpu_update_adaptive;
+}
+
 /**
  * amdgpu_vm_validate_pt_bos - validate the page table BOs
  *
@@ -170,8 +204,13 @@ int amdgpu_vm_validate_pt_bos(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 			      void *param)
 {
 	struct ttm_bo_global *glob = adev->mman.bdev.glob;
+	int epoch = atomic_read(&vm->evict_epoch);
 	int r;
 
+	/* Nothing was evicted since the last validation */
+	if (epoch == vm->validated_epoch)
+		return 0;
+
 	spin_lock(&vm->status_lock);
 	while (!list_empty(&vm->evicted)) {
 		struct amdgpu_vm_bo_base *bo_base;
@@ -197,7 +236,7 @@ int amdgpu_vm_validate_pt_bos(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 		}
 
 		if (bo->tbo.type == ttm_bo_type_kernel &&
-		    vm->use_cpu_for_update) {
+		    amdgpu_vm_pt_cpu_access(vm)) {
 			r = amdgpu_bo_kmap(bo, NULL);
 			if (r)
 				return r;
@@ -211,6 +250,8 @@ int amdgpu_vm_validate_pt_bos(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 	}
 	spin_unlock(&vm->status_lock);
 
+	/* Evictions in between bumped the epoch again */
+	WRITE_ONCE(vm->validated_epoch, epoch);
 	return 0;
 }
 
@@ -225,6 +266,9 @@ bool amdgpu_vm_ready(struct amdgpu_vm *vm)
 {
 	bool ready;
 
+	if (atomic_read(&vm->evict_epoch) == READ_ONCE(vm->validated_epoch))
+		return true;
+
 	spin_lock(&vm->status_lock);
 	ready = list_empty(&vm->evicted);
 	spin_unlock(&vm->status_lock);
@@ -286,7 +330,7 @@ static int amdgpu_vm_alloc_levels(struct amdgpu_device *adev,
 
 	flags = AMDGPU_GEM_CREATE_VRAM_CONTIGUOUS |
 			AMDGPU_GEM_CREATE_VRAM_CLEARED;
-	if (vm->use_cpu_for_update)
+	if (amdgpu_vm_pt_cpu_access(vm))
 		flags |= AMDGPU_GEM_CREATE_CPU_ACCESS_REQUIRED;
 	else
 		flags |= (AMDGPU_GEM_CREATE_NO_CPU_ACCESS |
@@ -314,7 +358,7 @@ static int amdgpu_vm_alloc_levels(struct amdgpu_device *adev,
 			if (r)
 				return r;
 
-			if (vm->use_cpu_for_update) {
+			if (amdgpu_vm_pt_cpu_access(vm)) {
 				r = amdgpu_bo_kmap(pt, NULL);
 				if (r) {
 					amdgpu_bo_unref(&pt);
@@ -418,6 +462,7 @@ static int amdgpu_vm_grab_reserved_vmid_locked(struct amdgpu_vm *vm,
 	struct amdgpu_vm_id *id = vm->reserved_vmid[vmhub];
 	struct amdgpu_vm_id_manager *id_mgr = &adev->vm_manager.id_mgr[vmhub];
 	struct dma_fence *updates = sync->last_vm_update;
+	uint64_t cpu_updates = atomic64_read(&vm->cpu_update_seq);
 	int r = 0;
 	struct dma_fence *flushed, *tmp;
 	bool needs_flush = vm->use_cpu_for_update;
@@ -426,6 +471,7 @@ static int amdgpu_vm_grab_reserved_vmid_locked(struct amdgpu_vm *vm,
 	if ((amdgpu_vm_had_gpu_reset(adev, id)) ||
 	    (atomic64_read(&id->owner) != vm->client_id) ||
 	    (job->vm_pd_addr != id->pd_gpu_addr) ||
+	    (id->flushed_cpu_updates != cpu_updates) ||
 	    (updates && (!flushed || updates->context != flushed->context ||
 			dma_fence_is_later(updates, flushed))) ||
 	    (!id->last_flush || (id->last_flush->context != fence_context &&
@@ -452,6 +498,7 @@ static int amdgpu_vm_grab_reserved_vmid_locked(struct amdgpu_vm *vm,
 		dma_fence_put(id->flushed_updates);
 		id->flushed_updates = dma_fence_get(updates);
 	}
+	id->flushed_cpu_updates = cpu_updates;
 	id->pd_gpu_addr = job->vm_pd_addr;
 	atomic64_set(&id->owner, vm->client_id);
 	job->vm_needs_flush = needs_flush;
@@ -484,6 +531,7 @@ int amdgpu_vm_grab_id(struct amdgpu_vm *vm, struct amdgpu_ring *ring,
 	struct amdgpu_vm_id_manager *id_mgr = &adev->vm_manager.id_mgr[vmhub];
 	uint64_t fence_context = adev->fence_context + ring->idx;
 	struct dma_fence *updates = sync->last_vm_update;
+	uint64_t cpu_updates = atomic64_read(&vm->cpu_update_seq);
 	struct amdgpu_vm_id *id, *idle;
 	struct dma_fence **fences;
 	unsigned i;
@@ -566,6 +614,10 @@ int amdgpu_vm_grab_id(struct amdgpu_vm *vm, struct amdgpu_ring *ring,
 		if (updates && (!flushed || dma_fence_is_later(updates, flushed)))
 			needs_flush = true;
 
+		/* PTs written by the CPU don't have a fence */
+		if (id->flushed_cpu_updates != cpu_updates)
+			needs_flush = true;
+
 		/* Concurrent flushes are only possible starting with Vega10 */
 		if (adev->asic_type < CHIP_VEGA10 && needs_flush)
 			continue;
@@ -581,6 +633,7 @@ int amdgpu_vm_grab_id(struct amdgpu_vm *vm, struct amdgpu_ring *ring,
 			dma_fence_put(id->flushed_updates);
 			id->flushed_updates = dma_fence_get(updates);
 		}
+		id->flushed_cpu_updates = cpu_updates;
 
 		if (needs_flush)
 			goto needs_flush;
@@ -600,6 +653,7 @@ int amdgpu_vm_grab_id(struct amdgpu_vm *vm, struct amdgpu_ring *ring,
 	id->pd_gpu_addr = job->vm_pd_addr;
 	dma_fence_put(id->flushed_updates);
 	id->flushed_updates = dma_fence_get(updates);
+	id->flushed_cpu_updates = cpu_updates;
 	atomic64_set(&id->owner, vm->client_id);
 
 needs_flush:
@@ -882,9 +936,10 @@ struct amdgpu_bo_va *amdgpu_vm_bo_find(struct amdgpu_vm *vm,
 }
 
 /**
- * amdgpu_vm_do_set_ptes - helper to call the right asic function
+ * amdgpu_vm_emit_set_ptes - helper to call the right asic function
  *
- * @params: see amdgpu_pte_update_params definition
+ * @adev: amdgpu_device pointer
+ * @ib: indirect buffer to fill with commands
  * @pe: addr of the page entry
  * @addr: dst addr to write into pe
  * @count: number of page entries to update
@@ -894,21 +949,81 @@ struct amdgpu_bo_va *amdgpu_vm_bo_find(struct amdgpu_vm *vm,
  * Traces the parameters and calls the right asic functions
  * to setup the page table using the DMA.
  */
+static void amdgpu_vm_emit_set_ptes(struct amdgpu_device *adev,
+				    struct amdgpu_ib *ib,
+				    uint64_t pe, uint64_t addr,
+				    unsigned count, uint32_t incr,
+				    uint64_t flags)
+{
+	trace_amdgpu_vm_set_ptes(pe, addr, count, incr, flags);
+	atomic64_add(count * 8, &adev->vm_manager.sdma_update_bytes);
+
+	if (count < 3) {
+		amdgpu_vm_write_pte(adev, ib, pe, addr | flags, count, incr);
+
+	} else {
+		amdgpu_vm_set_pte_pde(adev, ib, pe, addr, count, incr, flags);
+	}
+}
+
+/**
+ * amdgpu_vm_batch_emit - write the set command kept open for merging
+ *
+ * @adev: amdgpu_device pointer
+ * @batch: batch with the open command
+ */
+static void amdgpu_vm_batch_emit(struct amdgpu_device *adev,
+				 struct amdgpu_vm_update_batch *batch)
+{
+	if (!batch->count)
+		return;
+
+	amdgpu_vm_emit_set_ptes(adev, &batch->job->ibs[0], batch->pe,
+				batch->addr, batch->count, batch->incr,
+				batch->flags);
+	batch->count = 0;
+}
+
+/**
+ * amdgpu_vm_do_set_ptes - set PTEs using the DMA
+ *
+ * @params: see amdgpu_pte_update_params definition
+ * @pe: addr of the page entry
+ * @addr: dst addr to write into pe
+ * @count: number of page entries to update
+ * @incr: increase next addr by incr bytes
+ * @flags: hw access flags
+ *
+ * When updates are batched the command is kept open, so that it can be
+ * merged with an update of the directly following entries.
+ */
 static void amdgpu_vm_do_set_ptes(struct amdgpu_pte_update_params *params,
 				  uint64_t pe, uint64_t addr,
 				  unsigned count, uint32_t incr,
 				  uint64_t flags)
 {
-	trace_amdgpu_vm_set_ptes(pe, addr, count, incr, flags);
+	struct amdgpu_vm_update_batch *batch = params->batch;
 
-	if (count < 3) {
-		amdgpu_vm_write_pte(params->adev, params->ib, pe,
-				    addr | flags, count, incr);
+	if (!batch) {
+		amdgpu_vm_emit_set_ptes(params->adev, params->ib, pe, addr,
+					count, incr, flags);
+		return;
+	}
 
-	} else {
-		amdgpu_vm_set_pte_pde(params->adev, params->ib, pe, addr,
-				      count, incr, flags);
+	if (batch->count && pe == batch->pe + batch->count * 8 &&
+	    addr == batch->addr + batch->count * incr &&
+	    incr == batch->incr && flags == batch->flags &&
+	    batch->count + count <= AMDGPU_VM_PTE_COUNT(params->adev)) {
+		batch->count += count;
+		return;
 	}
+
+	amdgpu_vm_batch_emit(params->adev, batch);
+	batch->pe = pe;
+	batch->addr = addr;
+	batch->count = count;
+	batch->incr = incr;
+	batch->flags = flags;
 }
 
 /**
@@ -930,8 +1045,12 @@ static void amdgpu_vm_do_copy_ptes(struct amdgpu_pte_update_params *params,
 {
 	uint64_t src = (params->src + (addr >> 12) * 8);
 
+	/* keep the order of the commands */
+	if (params->batch)
+		amdgpu_vm_batch_emit(params->adev, params->batch);
 
 	trace_amdgpu_vm_copy_ptes(pe, src, count);
+	atomic64_add(count * 8, &params->adev->vm_manager.sdma_update_bytes);
 
 	amdgpu_vm_copy_pte(params->adev, params->ib, pe, src, count);
 }
@@ -970,7 +1089,10 @@ static uint64_t amdgpu_vm_map_gart(const dma_addr_t *pages_addr, uint64_t addr)
  * @incr: increase next addr by incr bytes
  * @flags: hw access flags
  *
- * Write count number of PT/PD entries directly.
+ * Write count number of PT/PD entries directly through the ASIC specific
+ * GART callback, which knows the address mask of the PTE layout. The PTs
+ * are mapped write combined, so the stores are streamed out without
+ * reading the cache lines. The caller is responsible for flushing the HDP.
  */
 static void amdgpu_vm_cpu_set_ptes(struct amdgpu_pte_update_params *params,
 				   uint64_t pe, uint64_t addr,
@@ -990,6 +1112,8 @@ static void amdgpu_vm_cpu_set_ptes(struct amdgpu_pte_update_params *params,
 					i, value, flags);
 		addr += incr;
 	}
+
+	atomic64_add(count * 8, &params->adev->vm_manager.cpu_update_bytes);
 }
 
 static int amdgpu_vm_wait_pd(struct amdgpu_device *adev, struct amdgpu_vm *vm,
@@ -999,8 +1123,10 @@ static int amdgpu_vm_wait_pd(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 	int r;
 
 	amdgpu_sync_create(&sync);
-	amdgpu_sync_resv(adev, &sync, vm->root.base.bo->tbo.resv, owner);
-	r = amdgpu_sync_wait(&sync, true);
+	r = amdgpu_sync_resv_rcu(adev, &sync, vm->root.base.bo->tbo.resv,
+				 owner);
+	if (!r)
+		r = amdgpu_sync_wait(&sync, true);
 	amdgpu_sync_free(&sync);
 
 	return r;
@@ -1287,27 +1413,23 @@ void amdgpu_vm_get_entry(struct amdgpu_pte_update_params *p, uint64_t addr,
  * @p: see amdgpu_pte_update_params definition
  * @entry: vm_pt entry to check
  * @parent: parent entry
- * @nptes: number of PTEs updated with this operation
+ * @huge: the planner decided to use the PDE as PTE
  * @dst: destination address where the PTEs should point to
  * @flags: access flags fro the PTEs
  *
- * Check if we can update the PD with a huge page.
+ * Update the PD with a huge page or let it point to the PT again.
  */
 static void amdgpu_vm_handle_huge_pages(struct amdgpu_pte_update_params *p,
 					struct amdgpu_vm_pt *entry,
 					struct amdgpu_vm_pt *parent,
-					unsigned nptes, uint64_t dst,
+					bool huge, uint64_t dst,
 					uint64_t flags)
 {
 	bool use_cpu_update = (p->func == amdgpu_vm_cpu_set_ptes);
 	uint64_t pd_addr, pde;
 
 	/* In the case of a mixed PT the PDE must point to it*/
-	if (p->adev->asic_type < CHIP_VEGA10 ||
-	    nptes != AMDGPU_VM_PTE_COUNT(p->adev) ||
-	    p->src ||
-	    !(flags & AMDGPU_PTE_VALID)) {
-
+	if (!huge) {
 		dst = amdgpu_bo_gpu_offset(entry->base.bo);
 		dst = amdgpu_gart_get_vm_pde(p->adev, dst);
 		flags = AMDGPU_PTE_VALID;
@@ -1352,68 +1474,53 @@ static void amdgpu_vm_handle_huge_pages(struct amdgpu_pte_update_params *p,
 }
 
 /**
- * amdgpu_vm_update_ptes - make sure that page tables are valid
+ * amdgpu_vm_update_ptes - execute one planned page table update
  *
- * @params: see amdgpu_pte_update_params definition
- * @vm: requested vm
- * @start: start of GPU address range
- * @end: end of GPU address range
- * @dst: destination address to map to, the next dst inside the function
- * @flags: mapping flags
+ * @data: see amdgpu_pte_update_params definition
+ * @op: operation from the PTE planner, never crosses a page table
  *
- * Update the page tables in the range @start - @end.
- * Returns 0 for success, -EINVAL for failure.
+ * Update the PDE and, unless it is used as huge page, the PTEs for @op.
+ * Returns 0 for success, -ENOENT if the page table isn't allocated.
  */
-static int amdgpu_vm_update_ptes(struct amdgpu_pte_update_params *params,
-				  uint64_t start, uint64_t end,
-				  uint64_t dst, uint64_t flags)
+static int amdgpu_vm_update_ptes(void *data, const struct amdgpu_vm_pte_op *op)
 {
+	struct amdgpu_pte_update_params *params = data;
 	struct amdgpu_device *adev = params->adev;
 	const uint64_t mask = AMDGPU_VM_PTE_COUNT(adev) - 1;
-
-	uint64_t addr, pe_start;
-	struct amdgpu_bo *pt;
-	unsigned nptes;
+	uint64_t flags = params->flags | AMDGPU_PTE_FRAG(op->frag);
 	bool use_cpu_update = (params->func == amdgpu_vm_cpu_set_ptes);
+	struct amdgpu_vm_pt *entry, *parent;
+	uint64_t pe_start;
+	struct amdgpu_bo *pt;
 
-	/* walk over the address space and update the page tables */
-	for (addr = start; addr < end; addr += nptes,
-	     dst += nptes * AMDGPU_GPU_PAGE_SIZE) {
-		struct amdgpu_vm_pt *entry, *parent;
-
-		amdgpu_vm_get_entry(params, addr, &entry, &parent);
-		if (!entry)
-			return -ENOENT;
+	amdgpu_vm_get_entry(params, op->start, &entry, &parent);
+	if (!entry)
+		return -ENOENT;
 
-		if ((addr & ~mask) == (end & ~mask))
-			nptes = end - addr;
-		else
-			nptes = AMDGPU_VM_PTE_COUNT(adev) - (addr & mask);
-
-		amdgpu_vm_handle_huge_pages(params, entry, parent,
-					    nptes, dst, flags);
-		/* We don't need to update PTEs for huge pages */
-		if (entry->addr & AMDGPU_PDE_PTE)
-			continue;
+	amdgpu_vm_handle_huge_pages(params, entry, parent,
+				    op->type == AMDGPU_VM_PTE_OP_PDE,
+				    op->dst, flags);
+	/* We don't need to update PTEs for huge pages */
+	if (entry->addr & AMDGPU_PDE_PTE)
+		return 0;
 
-		pt = entry->base.bo;
-		if (use_cpu_update) {
-			pe_start = (unsigned long)amdgpu_bo_kptr(pt);
-		} else {
-			if (pt->shadow) {
-				pe_start = amdgpu_bo_gpu_offset(pt->shadow);
-				pe_start += (addr & mask) * 8;
-				params->func(params, pe_start, dst, nptes,
-					     AMDGPU_GPU_PAGE_SIZE, flags);
-			}
-			pe_start = amdgpu_bo_gpu_offset(pt);
+	pt = entry->base.bo;
+	if (use_cpu_update) {
+		pe_start = (unsigned long)amdgpu_bo_kptr(pt);
+	} else {
+		if (pt->shadow) {
+			pe_start = amdgpu_bo_gpu_offset(pt->shadow);
+			pe_start += (op->start & mask) * 8;
+			params->func(params, pe_start, op->dst, op->count,
+				     AMDGPU_GPU_PAGE_SIZE, flags);
 		}
-
-		pe_start += (addr & mask) * 8;
-		params->func(params, pe_start, dst, nptes,
-			     AMDGPU_GPU_PAGE_SIZE, flags);
+		pe_start = amdgpu_bo_gpu_offset(pt);
 	}
 
+	pe_start += (op->start & mask) * 8;
+	params->func(params, pe_start, op->dst, op->count,
+		     AMDGPU_GPU_PAGE_SIZE, flags);
+
 	return 0;
 }
 
@@ -1421,16 +1528,16 @@ static int amdgpu_vm_update_ptes(struct amdgpu_pte_update_params *params,
  * amdgpu_vm_frag_ptes - add fragment information to PTEs
  *
  * @params: see amdgpu_pte_update_params definition
- * @vm: requested vm
  * @start: first PTE to handle
- * @end: last PTE to handle
- * @dst: addr those PTEs should point to
+ * @runs: memory those PTEs should point to
+ * @num_runs: number of entries in @runs
  * @flags: hw mapping flags
  * Returns 0 for success, -EINVAL for failure.
  */
 static int amdgpu_vm_frag_ptes(struct amdgpu_pte_update_params	*params,
-				uint64_t start, uint64_t end,
-				uint64_t dst, uint64_t flags)
+				uint64_t start,
+				const struct amdgpu_vm_pte_run *runs,
+				unsigned num_runs, uint64_t flags)
 {
 	/**
 	 * The MC L1 TLB supports variable sized pages, based on a fragment
@@ -1450,40 +1557,317 @@ static int amdgpu_vm_frag_ptes(struct amdgpu_pte_update_params	*params,
 	 * Userspace can support this by aligning virtual base address and
 	 * allocation size to the fragment size.
 	 */
-	unsigned max_frag = params->adev->vm_manager.fragment_size;
-	int r;
+	struct amdgpu_device *adev = params->adev;
+	struct amdgpu_vm_pte_planner planner = {
+		.block_size = adev->vm_manager.block_size,
+		.max_frag = adev->vm_manager.fragment_size,
+		.huge_pages = adev->asic_type >= CHIP_VEGA10,
+		.copy = params->func == amdgpu_vm_do_copy_ptes,
+		.emit = amdgpu_vm_update_ptes,
+		.data = params,
+	};
 
 	/* system pages are non continuously */
-	if (params->src || !(flags & AMDGPU_PTE_VALID))
-		return amdgpu_vm_update_ptes(params, start, end, dst, flags);
-
-	while (start != end) {
-		uint64_t frag_flags, frag_end;
-		unsigned frag;
-
-		/* This intentionally wraps around if no bit is set */
-		frag = min((unsigned)ffs(start) - 1,
-			   (unsigned)fls64(end - start) - 1);
-		if (frag >= max_frag) {
-			frag_flags = AMDGPU_PTE_FRAG(max_frag);
-			frag_end = end & ~((1ULL << max_frag) - 1);
+	if (params->src || !(flags & AMDGPU_PTE_VALID)) {
+		planner.max_frag = 0;
+		planner.huge_pages = false;
+	}
+
+	params->flags = flags;
+	return amdgpu_vm_pte_plan_runs(&planner, start, runs, num_runs);
+}
+
+static void amdgpu_vm_free_mapping(struct amdgpu_device *adev,
+				   struct amdgpu_vm *vm,
+				   struct amdgpu_bo_va_mapping *mapping,
+				   struct dma_fence *fence);
+
+/**
+ * amdgpu_vm_batch_begin - start collecting page table updates
+ *
+ * @vm: requested vm
+ * @batch: batch to collect the updates in
+ *
+ * All SDMA page table updates until amdgpu_vm_batch_commit() are written
+ * into as few jobs as possible.
+ */
+void amdgpu_vm_batch_begin(struct amdgpu_vm *vm,
+			   struct amdgpu_vm_update_batch *batch)
+{
+	memset(batch, 0, sizeof(*batch));
+	INIT_LIST_HEAD(&batch->freed);
+	batch->next_ndw = AMDGPU_VM_BATCH_MIN_NDW;
+	vm->batch = batch;
+}
+
+/**
+ * amdgpu_vm_batch_submit - submit the collected updates
+ *
+ * @adev: amdgpu_device pointer
+ * @vm: requested vm
+ * @batch: batch with the updates
+ *
+ * Submit the job, store its fence for everybody who asked for it and free
+ * the mappings which were cleared.
+ */
+static int amdgpu_vm_batch_submit(struct amdgpu_device *adev,
+				  struct amdgpu_vm *vm,
+				  struct amdgpu_vm_update_batch *batch)
+{
+	struct amdgpu_bo_va_mapping *mapping, *tmp;
+	struct dma_fence *f = NULL;
+	unsigned i;
+	int r = 0;
+
+	if (batch->cpu_dirty) {
+		/* one HDP flush for all CPU updates, before SDMA continues */
+		mb();
+		amdgpu_gart_flush_gpu_tlb(adev, 0);
+		atomic64_inc(&vm->cpu_update_seq);
+		batch->cpu_dirty = false;
+	}
+
+	if (batch->job) {
+		struct amdgpu_ring *ring;
+		struct amdgpu_ib *ib = &batch->job->ibs[0];
+
+		ring = container_of(vm->entity.sched, struct amdgpu_ring,
+				    sched);
+		amdgpu_vm_batch_emit(adev, batch);
+		amdgpu_ring_pad_ib(ring, ib);
+		WARN_ON(ib->length_dw > batch->data_dw);
+		r = amdgpu_job_submit(batch->job, ring, &vm->entity,
+				      AMDGPU_FENCE_OWNER_VM, &f);
+		if (r) {
+			amdgpu_job_free(batch->job);
+			amdgpu_vm_invalidate_level(vm, &vm->root);
 		} else {
-			frag_flags = AMDGPU_PTE_FRAG(frag);
-			frag_end = start + (1 << frag);
+			amdgpu_bo_fence(vm->root.base.bo, f, true);
+			dma_fence_put(vm->last_sdma_update);
+			vm->last_sdma_update = dma_fence_get(f);
 		}
+		batch->job = NULL;
+	}
+
+	for (i = 0; f && i < batch->num_fences; ++i) {
+		dma_fence_put(*batch->fences[i]);
+		*batch->fences[i] = dma_fence_get(f);
+	}
+	batch->num_fences = 0;
 
-		r = amdgpu_vm_update_ptes(params, start, frag_end, dst,
-					  flags | frag_flags);
+	list_for_each_entry_safe(mapping, tmp, &batch->freed, list) {
+		list_del(&mapping->list);
+		amdgpu_vm_free_mapping(adev, vm, mapping, f);
+	}
+
+	if (f) {
+		dma_fence_put(batch->last);
+		batch->last = f;
+	}
+
+	return r;
+}
+
+/**
+ * amdgpu_vm_batch_commit - submit all collected page table updates
+ *
+ * @adev: amdgpu_device pointer
+ * @vm: requested vm
+ * @fence: optional resulting fence (unchanged if no work needed to be done)
+ *
+ * Stop collecting updates and submit what was collected so far, even when
+ * adding an update failed in between.
+ */
+int amdgpu_vm_batch_commit(struct amdgpu_device *adev, struct amdgpu_vm *vm,
+			   struct dma_fence **fence)
+{
+	struct amdgpu_vm_update_batch *batch = vm->batch;
+	int r;
+
+	r = amdgpu_vm_batch_submit(adev, vm, batch);
+	vm->batch = NULL;
+
+	if (fence && batch->last) {
+		dma_fence_put(*fence);
+		*fence = dma_fence_get(batch->last);
+	}
+	dma_fence_put(batch->last);
+	kfree(batch->fences);
+
+	return r;
+}
+
+/**
+ * amdgpu_vm_batch_has_fence - check if a fence is already stored by a batch
+ *
+ * @batch: batch to check
+ * @fence: place to store the fence
+ */
+static bool amdgpu_vm_batch_has_fence(struct amdgpu_vm_update_batch *batch,
+				      struct dma_fence **fence)
+{
+	unsigned i;
+
+	for (i = 0; i < batch->num_fences; ++i)
+		if (batch->fences[i] == fence)
+			return true;
+
+	return false;
+}
+
+/**
+ * amdgpu_vm_batch_grow_fences - make room for more fence slots
+ *
+ * @batch: batch to grow
+ *
+ * Every BO updated in a CS has its own slot, so the array grows instead
+ * of forcing a submission when it is full.
+ */
+static int amdgpu_vm_batch_grow_fences(struct amdgpu_vm_update_batch *batch)
+{
+	unsigned max_fences = max(batch->max_fences * 2,
+				  (unsigned)AMDGPU_VM_BATCH_MIN_FENCES);
+	struct dma_fence ***fences;
+
+	fences = krealloc(batch->fences, max_fences * sizeof(*fences),
+			  GFP_KERNEL);
+	if (!fences)
+		return -ENOMEM;
+
+	batch->fences = fences;
+	batch->max_fences = max_fences;
+	return 0;
+}
+
+/**
+ * amdgpu_vm_batch_reserve - make room for an update in the batch
+ *
+ * @adev: amdgpu_device pointer
+ * @vm: requested vm
+ * @batch: batch to add the update to
+ * @ndw: number of dw for the commands
+ * @ndata: number of dw for PTEs stored at the end of the IB
+ * @fence: optional place to store the fence of the job
+ *
+ * Submit the current job when the update doesn't fit any more and
+ * allocate a new one if necessary.
+ */
+static int amdgpu_vm_batch_reserve(struct amdgpu_device *adev,
+				   struct amdgpu_vm *vm,
+				   struct amdgpu_vm_update_batch *batch,
+				   unsigned ndw, unsigned ndata,
+				   struct dma_fence **fence)
+{
+	bool new_fence = fence && !amdgpu_vm_batch_has_fence(batch, fence);
+	bool full = batch->job &&
+		batch->job->ibs[0].length_dw + ndw + ndata > batch->data_dw;
+	int r;
+
+	if (full) {
+		/* use a bigger IB next time when this one ran full */
+		batch->next_ndw = min(batch->ndw * 2,
+				      (unsigned)AMDGPU_VM_BATCH_MAX_NDW);
+
+		r = amdgpu_vm_batch_submit(adev, vm, batch);
 		if (r)
 			return r;
 
-		dst += (frag_end - start) * AMDGPU_GPU_PAGE_SIZE;
-		start = frag_end;
+		new_fence = fence != NULL;
+	}
+
+	if (new_fence && batch->num_fences == batch->max_fences) {
+		r = amdgpu_vm_batch_grow_fences(batch);
+		if (r)
+			return r;
 	}
 
+	if (!batch->job) {
+		batch->ndw = max(ndw + ndata, batch->next_ndw);
+		r = amdgpu_job_alloc_with_ib(adev, batch->ndw * 4, &batch->job);
+		if (r)
+			return r;
+
+		r = reservation_object_reserve_shared(vm->root.base.bo->tbo.resv);
+		if (r) {
+			amdgpu_job_free(batch->job);
+			batch->job = NULL;
+			return r;
+		}
+
+		batch->data_dw = batch->ndw;
+		batch->synced_vm = false;
+		batch->synced_all = false;
+	}
+
+	if (new_fence)
+		batch->fences[batch->num_fences++] = fence;
+
 	return 0;
 }
 
+/**
+ * amdgpu_vm_cpu_update_possible - check if an update can use the CPU
+ *
+ * @params: see amdgpu_pte_update_params definition
+ * @exclusive: fence the update must wait for, e.g. the move of the BO
+ * @start: start of mapped range
+ * @last: last mapped entry
+ * @flags: flags for the entries
+ *
+ * VMs with adaptive updates write small mappings with the CPU, as long as
+ * the BO isn't still being moved, no SDMA update is pending and all PDs/PTs
+ * involved are currently kmapped in VRAM.
+ */
+static bool amdgpu_vm_cpu_update_possible(struct amdgpu_pte_update_params *params,
+					  struct dma_fence *exclusive,
+					  uint64_t start, uint64_t last,
+					  uint64_t flags)
+{
+	struct amdgpu_device *adev = params->adev;
+	struct amdgpu_vm *vm = params->vm;
+	struct amdgpu_vm_update_batch *batch = vm->batch;
+	const uint64_t mask = AMDGPU_VM_PTE_COUNT(adev) - 1;
+	uint64_t addr;
+
+	/* unmapping syncs to everything, let the SDMA do the waiting */
+	if (!vm->cpu_update_adaptive || !(flags & AMDGPU_PTE_VALID) ||
+	    last - start + 1 > adev->vm_manager.vm_update_cpu_max)
+		return false;
+
+	/* the PTEs must not point to the new location before the move is done */
+	if (exclusive && !dma_fence_is_signaled(exclusive))
+		return false;
+
+	/* the CPU must not overtake SDMA updates */
+	if (batch && (batch->count ||
+		      (batch->job && batch->job->ibs[0].length_dw)))
+		return false;
+
+	if ((vm->last_update && !dma_fence_is_signaled(vm->last_update)) ||
+	    (vm->last_sdma_update &&
+	     !dma_fence_is_signaled(vm->last_sdma_update)))
+		return false;
+
+	for (addr = start; addr <= last; addr = (addr | mask) + 1) {
+		struct amdgpu_vm_pt *entry, *parent;
+		struct amdgpu_bo *bo;
+
+		amdgpu_vm_get_entry(params, addr, &entry, &parent);
+		if (!entry || !entry->base.bo)
+			return false;
+
+		bo = entry->base.bo;
+		if (bo->tbo.mem.mem_type != TTM_PL_VRAM || !amdgpu_bo_kptr(bo))
+			return false;
+
+		bo = parent->base.bo;
+		if (bo->tbo.mem.mem_type != TTM_PL_VRAM || !amdgpu_bo_kptr(bo))
+			return false;
+	}
+
+	return true;
+}
+
 /**
  * amdgpu_vm_bo_update_mapping - update a mapping in the vm page table
  *
@@ -1494,10 +1878,13 @@ static int amdgpu_vm_frag_ptes(struct amdgpu_pte_update_params	*params,
  * @start: start of mapped range
  * @last: last mapped entry
  * @flags: flags for the entries
- * @addr: addr to set the area to
- * @fence: optional resulting fence
+ * @runs: memory to set the area to
+ * @num_runs: number of entries in @runs
+ * @fence: optional place for the resulting fence
  *
- * Fill in the page table entries between @start and @last.
+ * Fill in the page table entries between @start and @last. SDMA updates
+ * are added to the batch of the VM, the fence is stored when it is
+ * submitted.
  * Returns 0 for success, -EINVAL for failure.
  */
 static int amdgpu_vm_bo_update_mapping(struct amdgpu_device *adev,
@@ -1505,15 +1892,16 @@ static int amdgpu_vm_bo_update_mapping(struct amdgpu_device *adev,
 				       dma_addr_t *pages_addr,
 				       struct amdgpu_vm *vm,
 				       uint64_t start, uint64_t last,
-				       uint64_t flags, uint64_t addr,
+				       uint64_t flags,
+				       const struct amdgpu_vm_pte_run *runs,
+				       unsigned num_runs,
 				       struct dma_fence **fence)
 {
-	struct amdgpu_ring *ring;
+	struct amdgpu_vm_update_batch *batch = vm->batch;
 	void *owner = AMDGPU_FENCE_OWNER_VM;
-	unsigned nptes, ncmds, ndw;
-	struct amdgpu_job *job;
+	unsigned nptes, ncmds, ndw, ndata = 0;
 	struct amdgpu_pte_update_params params;
-	struct dma_fence *f = NULL;
+	struct amdgpu_vm_pte_run copy_run;
 	int r;
 
 	memset(&params, 0, sizeof(params));
@@ -1524,7 +1912,9 @@ static int amdgpu_vm_bo_update_mapping(struct amdgpu_device *adev,
 	if (!(flags & AMDGPU_PTE_VALID))
 		owner = AMDGPU_FENCE_OWNER_UNDEFINED;
 
-	if (vm->use_cpu_for_update) {
+	if (vm->use_cpu_for_update ||
+	    amdgpu_vm_cpu_update_possible(&params, exclusive, start, last,
+					  flags)) {
 		/* params.src is used as flag to indicate system Memory */
 		if (pages_addr)
 			params.src = ~0;
@@ -1538,34 +1928,46 @@ static int amdgpu_vm_bo_update_mapping(struct amdgpu_device *adev,
 
 		params.func = amdgpu_vm_cpu_set_ptes;
 		params.pages_addr = pages_addr;
-		return amdgpu_vm_frag_ptes(&params, start, last + 1,
-					   addr, flags);
+		r = amdgpu_vm_frag_ptes(&params, start, runs, num_runs, flags);
+
+		/* the HDP is flushed when the batch is committed */
+		if (batch) {
+			batch->cpu_dirty = true;
+		} else {
+			mb();
+			amdgpu_gart_flush_gpu_tlb(adev, 0);
+			atomic64_inc(&vm->cpu_update_seq);
+		}
+		atomic64_inc(&adev->vm_manager.cpu_update_count);
+		return r;
 	}
 
-	ring = container_of(vm->entity.sched, struct amdgpu_ring, sched);
+	if (WARN_ON(!batch))
+		return -EINVAL;
 
 	nptes = last - start + 1;
 
 	/*
 	 * reserve space for two commands every (1 << BLOCK_SIZE)
-	 *  entries or 2k dwords (whatever is smaller)
+	 *  entries or 2k dwords (whatever is smaller) and each run
          *
          * The second command is for the shadow pagetables.
 	 */
-	ncmds = ((nptes >> min(adev->vm_manager.block_size, 11u)) + 1) * 2;
+	ncmds = ((nptes >> min(adev->vm_manager.block_size, 11u)) +
+		 num_runs) * 2;
 
 	/* padding, etc. */
 	ndw = 64;
 
 	/* one PDE write for each huge page */
-	ndw += ((nptes >> adev->vm_manager.block_size) + 1) * 6;
+	ndw += ((nptes >> adev->vm_manager.block_size) + num_runs) * 6;
 
 	if (pages_addr) {
 		/* copy commands needed */
 		ndw += ncmds * adev->vm_manager.vm_pte_funcs->copy_pte_num_dw;
 
 		/* and also PTEs */
-		ndw += nptes * 2;
+		ndata = nptes * 2;
 
 		params.func = amdgpu_vm_do_copy_ptes;
 
@@ -1573,71 +1975,134 @@ static int amdgpu_vm_bo_update_mapping(struct amdgpu_device *adev,
 		/* set page commands needed */
 		ndw += ncmds * adev->vm_manager.vm_pte_funcs->set_pte_pde_num_dw;
 
-		/* extra commands for begin/end fragments */
+		/* extra commands for begin/end fragments of each run */
 		ndw += 2 * adev->vm_manager.vm_pte_funcs->set_pte_pde_num_dw
-				* adev->vm_manager.fragment_size;
+				* adev->vm_manager.fragment_size * num_runs;
 
 		params.func = amdgpu_vm_do_set_ptes;
 	}
 
-	r = amdgpu_job_alloc_with_ib(adev, ndw * 4, &job);
+	r = amdgpu_vm_batch_reserve(adev, vm, batch, ndw, ndata, fence);
 	if (r)
 		return r;
 
-	params.ib = &job->ibs[0];
+	params.ib = &batch->job->ibs[0];
+	params.batch = batch;
 
 	if (pages_addr) {
 		uint64_t *pte;
-		unsigned i;
+		unsigned i, j;
 
 		/* Put the PTEs at the end of the IB. */
-		i = ndw - nptes * 2;
-		pte= (uint64_t *)&(job->ibs->ptr[i]);
-		params.src = job->ibs->gpu_addr + i * 4;
-
-		for (i = 0; i < nptes; ++i) {
-			pte[i] = amdgpu_vm_map_gart(pages_addr, addr + i *
-						    AMDGPU_GPU_PAGE_SIZE);
-			pte[i] |= flags;
+		batch->data_dw -= ndata;
+		i = batch->data_dw;
+		pte= (uint64_t *)&(params.ib->ptr[i]);
+		params.src = params.ib->gpu_addr + i * 4;
+
+		for (i = 0; i < num_runs; ++i) {
+			for (j = 0; j < runs[i].count; ++j) {
+				*pte = amdgpu_vm_map_gart(pages_addr,
+							  runs[i].dst + j *
+							  AMDGPU_GPU_PAGE_SIZE);
+				*pte++ |= flags;
+			}
 		}
-		addr = 0;
-	}
 
-	r = amdgpu_sync_fence(adev, &job->sync, exclusive);
-	if (r)
-		goto error_free;
+		/* from now on the PTEs are copied from the IB */
+		copy_run.dst = 0;
+		copy_run.count = nptes;
+		runs = &copy_run;
+		num_runs = 1;
+	}
 
-	r = amdgpu_sync_resv(adev, &job->sync, vm->root.base.bo->tbo.resv,
-			     owner);
+	r = amdgpu_sync_fence(adev, &batch->job->sync, exclusive);
 	if (r)
-		goto error_free;
+		goto error;
 
-	r = reservation_object_reserve_shared(vm->root.base.bo->tbo.resv);
-	if (r)
-		goto error_free;
+	/* syncing to everything includes the VM updates */
+	if (!batch->synced_all &&
+	    (owner != AMDGPU_FENCE_OWNER_VM || !batch->synced_vm)) {
+		r = amdgpu_sync_resv(adev, &batch->job->sync,
+				     vm->root.base.bo->tbo.resv, owner);
+		if (r)
+			goto error;
 
-	r = amdgpu_vm_frag_ptes(&params, start, last + 1, addr, flags);
-	if (r)
-		goto error_free;
+		if (owner == AMDGPU_FENCE_OWNER_VM)
+			batch->synced_vm = true;
+		else
+			batch->synced_all = true;
+	}
 
-	amdgpu_ring_pad_ib(ring, params.ib);
-	WARN_ON(params.ib->length_dw > ndw);
-	r = amdgpu_job_submit(job, ring, &vm->entity,
-			      AMDGPU_FENCE_OWNER_VM, &f);
+	r = amdgpu_vm_frag_ptes(&params, start, runs, num_runs, flags);
 	if (r)
-		goto error_free;
+		goto error;
 
-	amdgpu_bo_fence(vm->root.base.bo, f, true);
-	dma_fence_put(*fence);
-	*fence = f;
+	atomic64_inc(&adev->vm_manager.sdma_update_count);
 	return 0;
 
-error_free:
-	amdgpu_job_free(job);
+error:
 	amdgpu_vm_invalidate_level(vm, &vm->root);
 	return r;
 }
 
+/**
+ * amdgpu_vm_bo_update_nodes - update a mapping backed by VRAM nodes
+ *
+ * @adev: amdgpu_device pointer
+ * @exclusive: fence we need to sync to
+ * @pages_addr: DMA addresses to use for mapping
+ * @vm: requested vm
+ * @mapping: mapped range to update
+ * @flags: HW flags for the mapping
+ * @base: MC address of the start of the memory the nodes are in
+ * @nodes: first drm_mm_node backing the mapping
+ * @pfn: offset of the mapping into the first node
+ * @fence: optional resulting fence
+ *
+ * Hand all the nodes backing the mapping to the planner as one update.
+ * Returns 0 for success, negative error code for failure.
+ */
+static int amdgpu_vm_bo_update_nodes(struct amdgpu_device *adev,
+				     struct dma_fence *exclusive,
+				     dma_addr_t *pages_addr,
+				     struct amdgpu_vm *vm,
+				     struct amdgpu_bo_va_mapping *mapping,
+				     uint64_t flags, uint64_t base,
+				     struct drm_mm_node *nodes, uint64_t pfn,
+				     struct dma_fence **fence)
+{
+	const uint64_t ratio = PAGE_SIZE / AMDGPU_GPU_PAGE_SIZE;
+	struct amdgpu_vm_pte_run *runs;
+	uint64_t left, offset;
+	unsigned i, num_runs = 0;
+	struct drm_mm_node *node;
+	int r;
+
+	left = mapping->last - mapping->start + 1;
+	for (node = nodes, offset = pfn; left; ++node, offset = 0) {
+		left -= min((node->size - offset) * ratio, left);
+		++num_runs;
+	}
+
+	runs = kmalloc_array(num_runs, sizeof(*runs), GFP_KERNEL);
+	if (!runs)
+		return -ENOMEM;
+
+	left = mapping->last - mapping->start + 1;
+	for (i = 0, node = nodes, offset = pfn; i < num_runs;
+	     ++i, ++node, offset = 0) {
+		runs[i].dst = base + ((node->start + offset) << PAGE_SHIFT);
+		runs[i].count = min((node->size - offset) * ratio, left);
+		left -= runs[i].count;
+	}
+
+	r = amdgpu_vm_bo_update_mapping(adev, exclusive, pages_addr, vm,
+					mapping->start, mapping->last, flags,
+					runs, num_runs, fence);
+	kfree(runs);
+	return r;
+}
+
 /**
  * amdgpu_vm_bo_split_mapping - split a mapping into smaller chunks
  *
@@ -1696,9 +2161,27 @@ static int amdgpu_vm_bo_split_mapping(struct amdgpu_device *adev,
 			pfn -= nodes->size;
 			++nodes;
 		}
+
+		/* The planner merges the physically contiguous nodes, that
+		 * allows bigger fragments and fewer updates.
+		 */
+		if (mem->mem_type == TTM_PL_VRAM ||
+		    mem->mem_type == AMDGPU_PL_DGMA) {
+			uint64_t base = vram_base_offset;
+
+			if (mem->mem_type == AMDGPU_PL_DGMA)
+				base += adev->mman.bdev.man[mem->mem_type].gpu_offset -
+					adev->mman.bdev.man[TTM_PL_VRAM].gpu_offset;
+
+			return amdgpu_vm_bo_update_nodes(adev, exclusive,
+							 pages_addr, vm, mapping,
+							 flags, base, nodes, pfn,
+							 fence);
+		}
 	}
 
 	do {
+		struct amdgpu_vm_pte_run run;
 		uint64_t max_entries;
 		uint64_t addr, last;
 
@@ -1715,14 +2198,6 @@ static int amdgpu_vm_bo_split_mapping(struct amdgpu_device *adev,
 				addr = 0;
 				max_entries = min(max_entries, 16ull * 1024ull);
 				break;
-			case AMDGPU_PL_DGMA:
-				addr += vram_base_offset +
-					adev->mman.bdev.man[mem->mem_type].gpu_offset -
-					adev->mman.bdev.man[TTM_PL_VRAM].gpu_offset;
-				break;
-			case TTM_PL_VRAM:
-				addr += vram_base_offset;
-				break;
 			default:
 				break;
 			}
@@ -1734,15 +2209,17 @@ static int amdgpu_vm_bo_split_mapping(struct amdgpu_device *adev,
 		addr += pfn << PAGE_SHIFT;
 
 		last = min((uint64_t)mapping->last, start + max_entries - 1);
+		run.dst = addr;
+		run.count = last - start + 1;
 		r = amdgpu_vm_bo_update_mapping(adev, exclusive, pages_addr, vm,
-						start, last, flags, addr,
+						start, last, flags, &run, 1,
 						fence);
 		if (r)
 			return r;
 
 		pfn += last - start + 1;
-		if (nodes && nodes->size == pfn) {
-			pfn = 0;
+		while (nodes && pfn && nodes->size <= pfn) {
+			pfn -= nodes->size;
 			++nodes;
 		}
 		start = last + 1;
@@ -1768,6 +2245,7 @@ int amdgpu_vm_bo_update(struct amdgpu_device *adev,
 {
 	struct amdgpu_bo *bo = bo_va->base.bo;
 	struct amdgpu_vm *vm = bo_va->base.vm;
+	struct amdgpu_vm_update_batch batch;
 	struct amdgpu_bo_va_mapping *mapping;
 	dma_addr_t *pages_addr = NULL;
 	struct ttm_mem_reg *mem;
@@ -1776,6 +2254,7 @@ int amdgpu_vm_bo_update(struct amdgpu_device *adev,
 	uint64_t flags;
 	uint64_t vram_base_offset = adev->vm_manager.vram_base_offset;
 	struct amdgpu_device *bo_adev;
+	bool own_batch;
 	int r;
 
 	if (clear || !bo_va->base.bo) {
@@ -1821,19 +2300,28 @@ int amdgpu_vm_bo_update(struct amdgpu_device *adev,
 		list_splice_init(&bo_va->valids, &bo_va->invalids);
 	}
 
+	/* update all mappings with one job if nobody else collects them */
+	own_batch = !vm->batch;
+	if (own_batch)
+		amdgpu_vm_batch_begin(vm, &batch);
+
+	r = 0;
 	list_for_each_entry(mapping, &bo_va->invalids, list) {
 		r = amdgpu_vm_bo_split_mapping(adev, exclusive, pages_addr, vm,
 					       mapping, vram_base_offset, flags,
 					       mem, last_update);
 		if (r)
-			return r;
+			break;
 	}
 
-	if (vm->use_cpu_for_update) {
-		/* Flush HDP */
-		mb();
-		amdgpu_gart_flush_gpu_tlb(adev, 0);
+	if (own_batch) {
+		int r2 = amdgpu_vm_batch_commit(adev, vm, NULL);
+
+		if (!r)
+			r = r2;
 	}
+	if (r)
+		return r;
 
 	spin_lock(&vm->status_lock);
 	list_del_init(&bo_va->base.vm_status);
@@ -1988,7 +2476,9 @@ static void amdgpu_vm_prt_fini(struct amdgpu_device *adev, struct amdgpu_vm *vm)
  * @fence: optional resulting fence (unchanged if no work needed to be done
  * or if an error occurred)
  *
- * Make sure all freed BOs are cleared in the PT.
+ * Make sure all freed BOs are cleared in the PT. The mappings are freed
+ * when the update is submitted. @fence is only set when the updates
+ * aren't collected in a batch started by the caller.
  * Returns 0 for success.
  *
  * PTs have to be reserved and mutex must be locked!
@@ -1997,11 +2487,16 @@ int amdgpu_vm_clear_freed(struct amdgpu_device *adev,
 			  struct amdgpu_vm *vm,
 			  struct dma_fence **fence)
 {
+	struct amdgpu_vm_update_batch batch;
 	struct amdgpu_bo_va_mapping *mapping;
-	struct dma_fence *f = NULL;
-	int r;
+	struct amdgpu_vm_pte_run run;
+	bool own_batch = !vm->batch;
+	int r = 0;
 	uint64_t init_pte_value = 0;
 
+	if (own_batch)
+		amdgpu_vm_batch_begin(vm, &batch);
+
 	while (!list_empty(&vm->freed)) {
 		mapping = list_first_entry(&vm->freed,
 			struct amdgpu_bo_va_mapping, list);
@@ -2010,25 +2505,27 @@ int amdgpu_vm_clear_freed(struct amdgpu_device *adev,
 		if (vm->pte_support_ats)
 			init_pte_value = AMDGPU_PTE_SYSTEM;
 
+		run.dst = 0;
+		run.count = mapping->last - mapping->start + 1;
 		r = amdgpu_vm_bo_update_mapping(adev, NULL, NULL, vm,
 						mapping->start, mapping->last,
-						init_pte_value, 0, &f);
-		amdgpu_vm_free_mapping(adev, vm, mapping, f);
-		if (r) {
-			dma_fence_put(f);
-			return r;
-		}
+						init_pte_value, &run, 1, NULL);
+		if (vm->use_cpu_for_update)
+			amdgpu_vm_free_mapping(adev, vm, mapping, NULL);
+		else
+			list_add_tail(&mapping->list, &vm->batch->freed);
+		if (r)
+			break;
 	}
 
-	if (fence && f) {
-		dma_fence_put(*fence);
-		*fence = f;
-	} else {
-		dma_fence_put(f);
-	}
+	if (own_batch) {
+		int r2 = amdgpu_vm_batch_commit(adev, vm, fence);
 
-	return 0;
+		if (!r)
+			r = r2;
+	}
 
+	return r;
 }
 
 /**
@@ -2046,9 +2543,14 @@ int amdgpu_vm_clear_freed(struct amdgpu_device *adev,
 int amdgpu_vm_handle_moved(struct amdgpu_device *adev,
 			   struct amdgpu_vm *vm)
 {
+	struct amdgpu_vm_update_batch batch;
+	bool own_batch = !vm->batch;
 	bool clear;
 	int r = 0;
 
+	if (own_batch)
+		amdgpu_vm_batch_begin(vm, &batch);
+
 	spin_lock(&vm->status_lock);
 	while (!list_empty(&vm->moved)) {
 		struct amdgpu_bo_va *bo_va;
@@ -2062,12 +2564,20 @@ int amdgpu_vm_handle_moved(struct amdgpu_device *adev,
 
 		r = amdgpu_vm_bo_update(adev, bo_va, clear);
 		if (r)
-			return r;
+			goto out_commit;
 
 		spin_lock(&vm->status_lock);
 	}
 	spin_unlock(&vm->status_lock);
 
+out_commit:
+	if (own_batch) {
+		int r2 = amdgpu_vm_batch_commit(adev, vm, NULL);
+
+		if (!r)
+			r = r2;
+	}
+
 	return r;
 }
 
@@ -2303,7 +2813,7 @@ int amdgpu_vm_bo_unmap(struct amdgpu_device *adev,
 	}
 
 	list_del(&mapping->list);
-	amdgpu_vm_it_remove(mapping, &vm->va);
+	amdgpu_vm_va_remove(vm, mapping);
 	mapping->bo_va = NULL;
 	trace_amdgpu_vm_bo_unmap(bo_va, mapping);
 
@@ -2382,7 +2892,7 @@ int amdgpu_vm_bo_clear_mappings(struct amdgpu_device *adev,
 
 	/* And free them up */
 	list_for_each_entry_safe(tmp, next, &removed, list) {
-		amdgpu_vm_it_remove(tmp, &vm->va);
+		amdgpu_vm_va_remove(vm, tmp);
 		list_del(&tmp->list);
 
 		if (tmp->start < saddr)
@@ -2420,13 +2930,63 @@ int amdgpu_vm_bo_clear_mappings(struct amdgpu_device *adev,
  * amdgpu_vm_bo_lookup_mapping - find mapping by address
  *
  * @vm: the requested VM
+ * @addr: the address in GPU pages
  *
- * Find a mapping by it's address.
+ * Find a mapping by it's address. The last mapping found is cached, since
+ * command streams usually reference the same few BOs over and over again.
  */
 struct amdgpu_bo_va_mapping *amdgpu_vm_bo_lookup_mapping(struct amdgpu_vm *vm,
 							 uint64_t addr)
 {
-	return amdgpu_vm_it_iter_first(&vm->va, addr, addr);
+	struct amdgpu_bo_va_mapping *mapping = vm->lookup_cache;
+
+	if (mapping && mapping->start <= addr && addr <= mapping->last)
+		return mapping;
+
+	mapping = amdgpu_vm_it_iter_first(&vm->va, addr, addr);
+	if (mapping)
+		vm->lookup_cache = mapping;
+
+	return mapping;
+}
+
+/**
+ * amdgpu_vm_bo_lookup_mappings - find the mappings of several addresses
+ *
+ * @vm: the requested VM
+ * @addrs: addresses in GPU pages, sorted in ascending order
+ * @count: number of addresses
+ * @mappings: resulting mappings, NULL where nothing is mapped
+ *
+ * Resolve all the addresses with a single walk over the tree.
+ * Returns the number of addresses which are mapped.
+ */
+unsigned amdgpu_vm_bo_lookup_mappings(struct amdgpu_vm *vm,
+				      const uint64_t *addrs, unsigned count,
+				      struct amdgpu_bo_va_mapping **mappings)
+{
+	struct amdgpu_bo_va_mapping *mapping;
+	unsigned i, found = 0;
+
+	if (!count)
+		return 0;
+
+	mapping = amdgpu_vm_it_iter_first(&vm->va, addrs[0], addrs[count - 1]);
+	for (i = 0; i < count; ++i) {
+		/* mappings don't overlap, so they are sorted by end as well */
+		while (mapping && mapping->last < addrs[i])
+			mapping = amdgpu_vm_it_iter_next(mapping, addrs[i],
+							 addrs[count - 1]);
+
+		if (mapping && mapping->start <= addrs[i]) {
+			mappings[i] = mapping;
+			++found;
+		} else {
+			mappings[i] = NULL;
+		}
+	}
+
+	return found;
 }
 
 /**
@@ -2453,14 +3013,14 @@ void amdgpu_vm_bo_rmv(struct amdgpu_device *adev,
 
 	list_for_each_entry_safe(mapping, next, &bo_va->valids, list) {
 		list_del(&mapping->list);
-		amdgpu_vm_it_remove(mapping, &vm->va);
+		amdgpu_vm_va_remove(vm, mapping);
 		mapping->bo_va = NULL;
 		trace_amdgpu_vm_bo_unmap(bo_va, mapping);
 		list_add(&mapping->list, &vm->freed);
 	}
 	list_for_each_entry_safe(mapping, next, &bo_va->invalids, list) {
 		list_del(&mapping->list);
-		amdgpu_vm_it_remove(mapping, &vm->va);
+		amdgpu_vm_va_remove(vm, mapping);
 		amdgpu_vm_free_mapping(adev, vm, mapping,
 				       bo_va->last_pt_update);
 	}
@@ -2494,6 +3054,7 @@ void amdgpu_vm_bo_invalidate(struct amdgpu_device *adev,
 			else
 				list_move_tail(&bo_base->vm_status,
 					       &vm->evicted);
+			atomic_inc(&vm->evict_epoch);
 			spin_unlock(&bo_base->vm->status_lock);
 			continue;
 		}
@@ -2599,9 +3160,12 @@ int amdgpu_vm_init(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 		vm->reserved_vmid[i] = NULL;
 	spin_lock_init(&vm->status_lock);
 	INIT_LIST_HEAD(&vm->evicted);
+	atomic_set(&vm->evict_epoch, 0);
+	vm->validated_epoch = 0;
 	INIT_LIST_HEAD(&vm->relocated);
 	INIT_LIST_HEAD(&vm->moved);
 	INIT_LIST_HEAD(&vm->freed);
+	vm->batch = NULL;
 
 	/* create scheduler entity for page table updates */
 
@@ -2610,7 +3174,7 @@ int amdgpu_vm_init(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 	ring = adev->vm_manager.vm_pte_rings[ring_instance];
 	rq = &ring->sched.sched_rq[AMD_SCHED_PRIORITY_KERNEL];
 	r = amd_sched_entity_init(&ring->sched, &vm->entity,
-				  rq, amdgpu_sched_jobs);
+				  rq);
 	if (r)
 		return r;
 
@@ -2631,11 +3195,22 @@ int amdgpu_vm_init(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 			 vm->use_cpu_for_update ? "CPU" : "SDMA");
 	WARN_ONCE((vm->use_cpu_for_update & !amdgpu_vm_is_large_bar(adev)),
 		  "CPU update of VM recommended only for large BAR system\n");
+	/* Adaptive VMs allocate their PDs/PTs without shadow, so only use
+	 * them when the page tables don't need to be backed up for GPU reset
+	 * recovery anyway.
+	 */
+	vm->cpu_update_adaptive = !vm->use_cpu_for_update &&
+		adev->vm_manager.vm_update_cpu_max &&
+		amdgpu_vm_is_large_bar(adev) &&
+		!amdgpu_need_backup(adev);
 	vm->last_update = NULL;
+	vm->last_sdma_update = NULL;
+	atomic64_set(&vm->cpu_update_seq, 0);
+	vm->lookup_cache = NULL;
 
 	flags = AMDGPU_GEM_CREATE_VRAM_CONTIGUOUS |
 			AMDGPU_GEM_CREATE_VRAM_CLEARED;
-	if (vm->use_cpu_for_update)
+	if (amdgpu_vm_pt_cpu_access(vm))
 		flags |= AMDGPU_GEM_CREATE_CPU_ACCESS_REQUIRED;
 	else
 		flags |= (AMDGPU_GEM_CREATE_NO_CPU_ACCESS |
@@ -2652,7 +3227,7 @@ int amdgpu_vm_init(struct amdgpu_device *adev, struct amdgpu_vm *vm,
 	list_add_tail(&vm->root.base.bo_list, &vm->root.base.bo->va);
 	INIT_LIST_HEAD(&vm->root.base.vm_status);
 
-	if (vm->use_cpu_for_update) {
+	if (amdgpu_vm_pt_cpu_access(vm)) {
 		r = amdgpu_bo_reserve(vm->root.base.bo, false);
 		if (r)
 			goto error_free_root;
@@ -2772,7 +3347,7 @@ void amdgpu_vm_fini(struct amdgpu_device *adev, struct amdgpu_vm *vm)
 #endif
 	{
 		list_del(&mapping->list);
-		amdgpu_vm_it_remove(mapping, &vm->va);
+		amdgpu_vm_va_remove(vm, mapping);
 		kfree(mapping);
 	}
 	list_for_each_entry_safe(mapping, tmp, &vm->freed, list) {
@@ -2787,10 +3362,47 @@ void amdgpu_vm_fini(struct amdgpu_device *adev, struct amdgpu_vm *vm)
 
 	amdgpu_vm_free_levels(&vm->root);
 	dma_fence_put(vm->last_update);
+	dma_fence_put(vm->last_sdma_update);
 	for (i = 0; i < AMDGPU_MAX_VMHUBS; i++)
 		amdgpu_vm_free_reserved_vmid(adev, vm, i);
 }
 
+#if defined(CONFIG_DEBUG_FS)
+/**
+ * amdgpu_debugfs_vm_update_stats - show which path the PT updates took
+ */
+static int amdgpu_debugfs_vm_update_stats(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = (struct drm_info_node *)m->private;
+	struct drm_device *dev = node->minor->dev;
+	struct amdgpu_device *adev = dev->dev_private;
+	struct amdgpu_vm_manager *mgr = &adev->vm_manager;
+
+	seq_printf(m, "cpu max ptes: %u\n", mgr->vm_update_cpu_max);
+	seq_printf(m, "cpu updates: %lld, bytes: %lld\n",
+		   (long long)atomic64_read(&mgr->cpu_update_count),
+		   (long long)atomic64_read(&mgr->cpu_update_bytes));
+	seq_printf(m, "sdma updates: %lld, bytes: %lld\n",
+		   (long long)atomic64_read(&mgr->sdma_update_count),
+		   (long long)atomic64_read(&mgr->sdma_update_bytes));
+	return 0;
+}
+
+static const struct drm_info_list amdgpu_debugfs_vm_list[] = {
+	{"amdgpu_vm_update_stats", &amdgpu_debugfs_vm_update_stats, 0, NULL},
+};
+#endif
+
+static int amdgpu_debugfs_vm_init(struct amdgpu_device *adev)
+{
+#if defined(CONFIG_DEBUG_FS)
+	return amdgpu_debugfs_add_files(adev, amdgpu_debugfs_vm_list,
+					ARRAY_SIZE(amdgpu_debugfs_vm_list));
+#else
+	return 0;
+#endif
+}
+
 /**
  * amdgpu_vm_manager_init - init the VM manager
  *
@@ -2839,10 +3451,19 @@ void amdgpu_vm_manager_init(struct amdgpu_device *adev)
 			adev->vm_manager.vm_update_mode = 0;
 	} else
 		adev->vm_manager.vm_update_mode = amdgpu_vm_update_mode;
+	adev->vm_manager.vm_update_cpu_max = max(amdgpu_vm_update_cpu_max, 0);
 #else
 	adev->vm_manager.vm_update_mode = 0;
+	adev->vm_manager.vm_update_cpu_max = 0;
 #endif
 
+	atomic64_set(&adev->vm_manager.cpu_update_count, 0);
+	atomic64_set(&adev->vm_manager.cpu_update_bytes, 0);
+	atomic64_set(&adev->vm_manager.sdma_update_count, 0);
+	atomic64_set(&adev->vm_manager.sdma_update_bytes, 0);
+	if (amdgpu_debugfs_vm_init(adev))
+		dev_err(adev->dev, "VM debugfs file creation failed\n");
+
 	adev->vm_manager.n_compute_vms = 0;
 }
 
@@ -25,6 +25,7 @@
 #define __AMDGPU_VM_H__
 
 #include <linux/rbtree.h>
+#include <linux/seqlock.h>
 
 #include "gpu_scheduler.h"
 #include "amdgpu_sync.h"
@@ -119,6 +120,46 @@ struct amdgpu_vm_pt {
 	unsigned			last_entry_used;
 };
 
+/* IB size limits for batched page table updates in dw */
+#define AMDGPU_VM_BATCH_MIN_NDW		1024
+#define AMDGPU_VM_BATCH_MAX_NDW		(16 * 1024)
+/* initial number of fence slots of a batch, grows on demand */
+#define AMDGPU_VM_BATCH_MIN_FENCES	16
+
+/* collects page table updates into a single job */
+struct amdgpu_vm_update_batch {
+	/* job and IB size of the updates collected so far */
+	struct amdgpu_job	*job;
+	unsigned		ndw;
+	/* PTEs copied from system memory are stored from here to the end */
+	unsigned		data_dw;
+	/* size of the next job, grows when a job runs full */
+	unsigned		next_ndw;
+
+	/* already synced to the page table reservation object */
+	bool			synced_vm;
+	bool			synced_all;
+
+	/* set command which is still open for merging */
+	uint64_t		pe;
+	uint64_t		addr;
+	uint64_t		flags;
+	unsigned		count;
+	uint32_t		incr;
+
+	/* mappings to free as soon as the job is submitted */
+	struct list_head	freed;
+	/* places where the fence of the job should be stored */
+	struct dma_fence	***fences;
+	unsigned		num_fences;
+	unsigned		max_fences;
+	/* fence of the last submitted job */
+	struct dma_fence	*last;
+
+	/* PTs were written by the CPU and the HDP needs a flush */
+	bool			cpu_dirty;
+};
+
 struct amdgpu_vm {
 	/* tree of virtual addresses mapped */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
@@ -132,6 +173,11 @@ struct amdgpu_vm {
 
 	/* BOs who needs a validation */
 	struct list_head	evicted;
+	/* incremented on each eviction, validation is only needed when it
+	 * differs from the epoch of the last validation
+	 */
+	atomic_t		evict_epoch;
+	int			validated_epoch;
 
 	/* PT BOs which relocated and their parent need an update */
 	struct list_head	relocated;
@@ -142,6 +188,11 @@ struct amdgpu_vm {
 	/* BO mappings freed, but not yet updated in the PT */
 	struct list_head	freed;
 
+	/* last mapping found by amdgpu_vm_bo_lookup_mapping(), protected
+	 * by the reservation of the root PD just like the VA tree
+	 */
+	struct amdgpu_bo_va_mapping	*lookup_cache;
+
 	/* contains the page directory */
 	struct amdgpu_vm_pt     root;
 	struct dma_fence	*last_update;
@@ -163,8 +214,20 @@ struct amdgpu_vm {
 	/* Flag to indicate if VM tables are updated by CPU or GPU (SDMA) */
 	bool                    use_cpu_for_update;
 
+	/* Small updates are written by the CPU when the PTs allow it */
+	bool			cpu_update_adaptive;
+	/* last SDMA PT update, CPU updates must not overtake it */
+	struct dma_fence	*last_sdma_update;
+	/* number of flushed CPU updates, the VMID needs a flush when it changes */
+	atomic64_t		cpu_update_seq;
+
 	/* Flag to indicate ATS support from PTE for GFX9 */
 	bool			pte_support_ats;
+
+	/* page table updates are collected here, protected by the PD being
+	 * reserved
+	 */
+	struct amdgpu_vm_update_batch	*batch;
 };
 
 struct amdgpu_vm_id {
@@ -176,6 +239,8 @@ struct amdgpu_vm_id {
 	uint64_t		pd_gpu_addr;
 	/* last flushed PD/PT update */
 	struct dma_fence		*flushed_updates;
+	/* last flushed CPU PT update */
+	uint64_t		flushed_cpu_updates;
 
 	uint32_t                current_gpu_reset_count;
 
@@ -227,6 +292,13 @@ struct amdgpu_vm_manager {
 	 * BIT1[= 0] Compute updated by SDMA [= 1] by CPU
 	 */
 	int					vm_update_mode;
+	/* max number of PTEs written by the CPU for adaptive VMs */
+	unsigned				vm_update_cpu_max;
+	/* which path the PT updates took */
+	atomic64_t				cpu_update_count;
+	atomic64_t				cpu_update_bytes;
+	atomic64_t				sdma_update_count;
+	atomic64_t				sdma_update_bytes;
 	/* Number of Compute VMs, used for detecting Compute activity */
 	unsigned                                n_compute_vms;
 };
@@ -255,6 +327,10 @@ void amdgpu_vm_reset_id(struct amdgpu_device *adev, unsigned vmhub,
 void amdgpu_vm_reset_all_ids(struct amdgpu_device *adev);
 int amdgpu_vm_update_directories(struct amdgpu_device *adev,
 				 struct amdgpu_vm *vm);
+void amdgpu_vm_batch_begin(struct amdgpu_vm *vm,
+			   struct amdgpu_vm_update_batch *batch);
+int amdgpu_vm_batch_commit(struct amdgpu_device *adev, struct amdgpu_vm *vm,
+			   struct dma_fence **fence);
 int amdgpu_vm_clear_freed(struct amdgpu_device *adev,
 			  struct amdgpu_vm *vm,
 			  struct dma_fence **fence);
@@ -286,6 +362,9 @@ int amdgpu_vm_bo_clear_mappings(struct amdgpu_device *adev,
 				uint64_t saddr, uint64_t size);
 struct amdgpu_bo_va_mapping *amdgpu_vm_bo_lookup_mapping(struct amdgpu_vm *vm,
 							 uint64_t addr);
+unsigned amdgpu_vm_bo_lookup_mappings(struct amdgpu_vm *vm,
+				      const uint64_t *addrs, unsigned count,
+				      struct amdgpu_bo_va_mapping **mappings);
 void amdgpu_vm_bo_rmv(struct amdgpu_device *adev,
 		      struct amdgpu_bo_va *bo_va);
 void amdgpu_vm_set_fragment_size(struct amdgpu_device *adev,
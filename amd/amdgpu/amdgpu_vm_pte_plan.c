@@ -0,0 +1,165 @@
+/*
+ * Copyright 2017 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "amdgpu_vm_pte_plan.h"
+
+/**
+ * amdgpu_vm_pte_plan_frag - biggest fragment starting at a page
+ *
+ * @start: first page
+ * @end: end of the range
+ * @dst: address the first page points to
+ *
+ * Returns the log2 of the biggest block which still fits into the range
+ * and is naturally aligned both at @start and at @dst.
+ */
+static unsigned amdgpu_vm_pte_plan_frag(uint64_t start, uint64_t end,
+					uint64_t dst)
+{
+	uint64_t dst_pfn = dst >> AMDGPU_VM_PTE_PLAN_PAGE_SHIFT;
+	unsigned align = start ? __builtin_ctzll(start) : 63;
+	unsigned dst_align = dst_pfn ? __builtin_ctzll(dst_pfn) : 63;
+	unsigned size = 63 - __builtin_clzll(end - start);
+
+	if (dst_align < align)
+		align = dst_align;
+	return align < size ? align : size;
+}
+
+/**
+ * amdgpu_vm_pte_plan - plan the updates for a range of pages
+ *
+ * @planner: page table layout and callback for the operations
+ * @start: first GPU page to update
+ * @end: end of the range
+ * @dst: address the first page should point to
+ *
+ * Split the range into fragments and the fragments at page table
+ * boundaries. Each piece results in one operation, page tables which are
+ * completely covered are replaced by a single PDE when possible. The
+ * destination can span several physically contiguous allocations, so
+ * fragments and PDEs also have to be aligned on the @dst side.
+ *
+ * Returns 0 on success or the first error returned by the callback.
+ */
+int amdgpu_vm_pte_plan(const struct amdgpu_vm_pte_planner *planner,
+		       uint64_t start, uint64_t end, uint64_t dst)
+{
+	const uint64_t mask = (1ULL << planner->block_size) - 1;
+	uint64_t misalign = start ^ (dst >> AMDGPU_VM_PTE_PLAN_PAGE_SHIFT);
+	unsigned max_frag = planner->copy ? 0 : planner->max_frag;
+	struct amdgpu_vm_pte_op op;
+	int r;
+
+	/* Both sides advance together, so no fragment can be bigger than the
+	 * alignment between them. Without that limit a misaligned range would
+	 * be planned as single pages.
+	 */
+	if (misalign && __builtin_ctzll(misalign) < max_frag)
+		max_frag = __builtin_ctzll(misalign);
+
+	while (start < end) {
+		uint64_t frag_end;
+
+		/* The MC L1 TLB supports variable sized pages, use the
+		 * biggest fragment the alignment allows and the biggest
+		 * supported one for everything in the middle.
+		 */
+		op.frag = max_frag ? amdgpu_vm_pte_plan_frag(start, end, dst) : 0;
+		if (!max_frag) {
+			frag_end = end;
+		} else if (op.frag >= max_frag) {
+			op.frag = max_frag;
+			frag_end = end & ~((1ULL << max_frag) - 1);
+		} else {
+			frag_end = start + (1ULL << op.frag);
+		}
+
+		for (; start < frag_end; start += op.count) {
+			uint64_t pt_end = (start | mask) + 1;
+
+			if (pt_end > frag_end)
+				pt_end = frag_end;
+
+			op.start = start;
+			op.count = pt_end - start;
+			op.dst = dst;
+			op.type = planner->copy ? AMDGPU_VM_PTE_OP_COPY :
+				AMDGPU_VM_PTE_OP_PTES;
+			/* the PDE can only point to a naturally aligned block */
+			if (!planner->copy && planner->huge_pages &&
+			    op.count == mask + 1 &&
+			    !((dst >> AMDGPU_VM_PTE_PLAN_PAGE_SHIFT) & mask))
+				op.type = AMDGPU_VM_PTE_OP_PDE;
+
+			r = planner->emit(planner->data, &op);
+			if (r)
+				return r;
+
+			dst += op.count << AMDGPU_VM_PTE_PLAN_PAGE_SHIFT;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * amdgpu_vm_pte_plan_runs - plan the updates for physically split memory
+ *
+ * @planner: page table layout and callback for the operations
+ * @start: first GPU page to update
+ * @runs: pieces of memory the pages should point to, in address order
+ * @num_runs: number of pieces
+ *
+ * Runs which are physically adjacent are planned together, so fragments
+ * and PDEs can span the boundaries between them.
+ *
+ * Returns 0 on success or the first error returned by the callback.
+ */
+int amdgpu_vm_pte_plan_runs(const struct amdgpu_vm_pte_planner *planner,
+			    uint64_t start,
+			    const struct amdgpu_vm_pte_run *runs,
+			    unsigned num_runs)
+{
+	unsigned i = 0;
+	int r;
+
+	while (i < num_runs) {
+		uint64_t dst = runs[i].dst;
+		uint64_t count = runs[i].count;
+
+		for (++i; i < num_runs; ++i) {
+			if (runs[i].dst !=
+			    dst + (count << AMDGPU_VM_PTE_PLAN_PAGE_SHIFT))
+				break;
+			count += runs[i].count;
+		}
+
+		r = amdgpu_vm_pte_plan(planner, start, start + count, dst);
+		if (r)
+			return r;
+
+		start += count;
+	}
+
+	return 0;
+}
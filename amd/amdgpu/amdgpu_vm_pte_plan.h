@@ -0,0 +1,93 @@
+/*
+ * Copyright 2017 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef __AMDGPU_VM_PTE_PLAN_H__
+#define __AMDGPU_VM_PTE_PLAN_H__
+
+/*
+ * The planner only does integer math on page numbers, so it doesn't depend
+ * on anything else in the driver and can be built in userspace as well.
+ */
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#define AMDGPU_VM_PTE_PLAN_PAGE_SHIFT	12
+
+enum amdgpu_vm_pte_op_type {
+	/* write PTEs into a page table */
+	AMDGPU_VM_PTE_OP_PTES,
+	/* point the PDE directly to the memory (PDE as PTE) */
+	AMDGPU_VM_PTE_OP_PDE,
+	/* copy PTEs prepared somewhere else into a page table */
+	AMDGPU_VM_PTE_OP_COPY,
+};
+
+/*
+ * One planned operation, never crosses a page table boundary. For
+ * AMDGPU_VM_PTE_OP_PDE it covers exactly one whole page table.
+ */
+struct amdgpu_vm_pte_op {
+	enum amdgpu_vm_pte_op_type	type;
+	/* first GPU page of the operation */
+	uint64_t			start;
+	/* number of GPU pages */
+	uint64_t			count;
+	/* address the first page points to */
+	uint64_t			dst;
+	/* fragment size in log2 of GPU pages */
+	unsigned			frag;
+};
+
+/* physically contiguous piece of the memory a range should point to */
+struct amdgpu_vm_pte_run {
+	/* address of the first page */
+	uint64_t	dst;
+	/* number of GPU pages */
+	uint64_t	count;
+};
+
+struct amdgpu_vm_pte_planner {
+	/* log2 of the number of PTEs in a page table */
+	unsigned	block_size;
+	/* log2 of the biggest fragment, 0 for no fragments */
+	unsigned	max_frag;
+	/* whole page tables can be replaced by a PDE */
+	bool		huge_pages;
+	/* the PTEs are copied, so no fragments and no PDEs */
+	bool		copy;
+	/* called for each operation in address order */
+	int		(*emit)(void *data, const struct amdgpu_vm_pte_op *op);
+	void		*data;
+};
+
+int amdgpu_vm_pte_plan(const struct amdgpu_vm_pte_planner *planner,
+		       uint64_t start, uint64_t end, uint64_t dst);
+int amdgpu_vm_pte_plan_runs(const struct amdgpu_vm_pte_planner *planner,
+			    uint64_t start,
+			    const struct amdgpu_vm_pte_run *runs,
+			    unsigned num_runs);
+
+#endif
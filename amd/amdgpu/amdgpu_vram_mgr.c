@@ -25,13 +25,479 @@
 #include <drm/drmP.h>
 #include "amdgpu.h"
 
+/* one free tree for each possible block order */
+#define AMDGPU_VRAM_BUDDY_ORDERS	BITS_PER_LONG
+
+struct amdgpu_vram_block {
+	union {
+		struct rb_node rb;
+		/* only used while the block is preallocated */
+		struct list_head link;
+	};
+	unsigned long start;
+	unsigned order;
+};
+
+struct amdgpu_vram_buddy {
+	/* free blocks sorted by start, one tree for each order */
+	struct rb_root free[AMDGPU_VRAM_BUDDY_ORDERS];
+	/* allocated blocks sorted by start */
+	struct rb_root used;
+	unsigned long size;
+};
+
 struct amdgpu_vram_mgr {
 	struct drm_mm mm;
 	spinlock_t lock;
 	atomic64_t usage;
 	atomic64_t vis_usage;
+	bool use_buddy;
+	struct amdgpu_vram_buddy buddy;
 };
 
+/**
+ * amdgpu_vram_buddy_insert - insert a block into a tree
+ *
+ * @root: tree sorted by block start
+ * @block: block to insert
+ */
+static void amdgpu_vram_buddy_insert(struct rb_root *root,
+				     struct amdgpu_vram_block *block)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+
+	while (*link) {
+		struct amdgpu_vram_block *tmp;
+
+		parent = *link;
+		tmp = rb_entry(parent, struct amdgpu_vram_block, rb);
+		if (block->start < tmp->start)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	rb_link_node(&block->rb, parent, link);
+	rb_insert_color(&block->rb, root);
+}
+
+/**
+ * amdgpu_vram_buddy_lower - find the first block starting at or after @start
+ *
+ * @root: tree sorted by block start
+ * @start: first page of interest
+ */
+static struct amdgpu_vram_block *
+amdgpu_vram_buddy_lower(struct rb_root *root, unsigned long start)
+{
+	struct amdgpu_vram_block *found = NULL;
+	struct rb_node *node = root->rb_node;
+
+	while (node) {
+		struct amdgpu_vram_block *tmp;
+
+		tmp = rb_entry(node, struct amdgpu_vram_block, rb);
+		if (tmp->start >= start) {
+			found = tmp;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * amdgpu_vram_buddy_upper - find the last block starting before @end
+ *
+ * @root: tree sorted by block start
+ * @end: first page after the range of interest
+ */
+static struct amdgpu_vram_block *
+amdgpu_vram_buddy_upper(struct rb_root *root, unsigned long end)
+{
+	struct amdgpu_vram_block *found = NULL;
+	struct rb_node *node = root->rb_node;
+
+	while (node) {
+		struct amdgpu_vram_block *tmp;
+
+		tmp = rb_entry(node, struct amdgpu_vram_block, rb);
+		if (tmp->start < end) {
+			found = tmp;
+			node = node->rb_right;
+		} else {
+			node = node->rb_left;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * amdgpu_vram_buddy_lookup - find the block starting exactly at @start
+ *
+ * @root: tree sorted by block start
+ * @start: first page of the block
+ */
+static struct amdgpu_vram_block *
+amdgpu_vram_buddy_lookup(struct rb_root *root, unsigned long start)
+{
+	struct amdgpu_vram_block *block;
+
+	block = amdgpu_vram_buddy_lower(root, start);
+	if (block && block->start == start)
+		return block;
+
+	return NULL;
+}
+
+/**
+ * amdgpu_vram_buddy_free_block - return a block to the free trees
+ *
+ * @buddy: buddy allocator
+ * @block: block which isn't in any tree any more
+ *
+ * Merge the block with its buddy as long as the buddy is free as well.
+ */
+static void amdgpu_vram_buddy_free_block(struct amdgpu_vram_buddy *buddy,
+					 struct amdgpu_vram_block *block)
+{
+	while (block->order < AMDGPU_VRAM_BUDDY_ORDERS - 1) {
+		unsigned long size = 1ul << block->order;
+		struct amdgpu_vram_block *tmp;
+
+		tmp = amdgpu_vram_buddy_lookup(&buddy->free[block->order],
+					       block->start ^ size);
+		if (!tmp)
+			break;
+
+		rb_erase(&tmp->rb, &buddy->free[block->order]);
+		kfree(tmp);
+		block->start &= ~size;
+		++block->order;
+	}
+
+	amdgpu_vram_buddy_insert(&buddy->free[block->order], block);
+}
+
+/**
+ * amdgpu_vram_buddy_find - find a free block for an allocation
+ *
+ * @buddy: buddy allocator
+ * @order: order of the needed block
+ * @fpfn: first allowed page
+ * @lpfn: first page after the allowed range
+ * @topdown: prefer the end of the range
+ * @target: resulting start of the needed block
+ *
+ * Returns the smallest free block which contains a block of @order inside
+ * the allowed range. Only the block at the edge of the range must be looked
+ * at for each order, so this takes O(log n) for each order.
+ */
+static struct amdgpu_vram_block *
+amdgpu_vram_buddy_find(struct amdgpu_vram_buddy *buddy, unsigned order,
+		       unsigned long fpfn, unsigned long lpfn, bool topdown,
+		       unsigned long *target)
+{
+	unsigned long size = 1ul << order;
+	unsigned o;
+
+	fpfn = ALIGN(fpfn, size);
+	lpfn = round_down(lpfn, size);
+	if (fpfn >= lpfn)
+		return NULL;
+
+	for (o = order; o < AMDGPU_VRAM_BUDDY_ORDERS; ++o) {
+		struct rb_root *root = &buddy->free[o];
+		struct amdgpu_vram_block *block;
+		unsigned long start;
+
+		if (RB_EMPTY_ROOT(root))
+			continue;
+
+		if (topdown) {
+			block = amdgpu_vram_buddy_upper(root, lpfn);
+			if (!block)
+				continue;
+
+			start = min(block->start + (1ul << o), lpfn) - size;
+			if (start < block->start) {
+				struct rb_node *prev = rb_prev(&block->rb);
+
+				if (!prev)
+					continue;
+				block = rb_entry(prev, struct amdgpu_vram_block,
+						 rb);
+				start = block->start + (1ul << o) - size;
+			}
+			if (start < fpfn)
+				continue;
+		} else {
+			block = amdgpu_vram_buddy_lower(root, round_down(fpfn,
+							1ul << o));
+			if (!block)
+				continue;
+
+			start = max(block->start, fpfn);
+			if (start >= block->start + (1ul << o)) {
+				struct rb_node *next = rb_next(&block->rb);
+
+				if (!next)
+					continue;
+				block = rb_entry(next, struct amdgpu_vram_block,
+						 rb);
+				start = block->start;
+			}
+			if (start + size > lpfn)
+				continue;
+		}
+
+		*target = start;
+		return block;
+	}
+
+	return NULL;
+}
+
+/**
+ * amdgpu_vram_buddy_piece - order of the next piece of a split block
+ *
+ * @pos: start of the piece
+ * @first: start of the used range
+ * @last: end of the used range
+ * @end: end of the split block
+ *
+ * Returns the order of the biggest naturally aligned piece at @pos which is
+ * either completely inside or completely outside of the used range.
+ */
+static unsigned amdgpu_vram_buddy_piece(unsigned long pos, unsigned long first,
+					unsigned long last, unsigned long end)
+{
+	unsigned long limit = pos < first ? first : pos < last ? last : end;
+	unsigned order = ilog2(limit - pos);
+
+	if (pos)
+		order = min(order, (unsigned)__ffs(pos));
+
+	return order;
+}
+
+/**
+ * amdgpu_vram_buddy_alloc - allocate a range of pages
+ *
+ * @mgr: VRAM manager
+ * @num_pages: number of pages
+ * @alignment: alignment of the range in pages
+ * @fpfn: first allowed page
+ * @lpfn: first page after the allowed range
+ * @topdown: prefer the end of the range
+ * @start: resulting start of the range
+ *
+ * Allocate a block big enough for the range and return the unused parts of
+ * it to the free trees, so that no more than the requested pages are used.
+ * Takes the manager lock, which is dropped to allocate the block structures.
+ */
+static int amdgpu_vram_buddy_alloc(struct amdgpu_vram_mgr *mgr,
+				   unsigned long num_pages,
+				   unsigned long alignment,
+				   unsigned long fpfn, unsigned long lpfn,
+				   bool topdown, unsigned long *start)
+{
+	struct amdgpu_vram_buddy *buddy = &mgr->buddy;
+	struct amdgpu_vram_block *block, *tmp;
+	unsigned long target, pos, end, first, last;
+	unsigned order, count, num_spare = 0;
+	LIST_HEAD(spare);
+	int r = 0;
+
+	if (!alignment)
+		alignment = 1;
+
+	if (is_power_of_2(alignment))
+		order = max(order_base_2(num_pages), ilog2(alignment));
+	else
+		order = order_base_2(num_pages + alignment - 1);
+
+	if (order >= AMDGPU_VRAM_BUDDY_ORDERS)
+		return -ENOSPC;
+
+	spin_lock(&mgr->lock);
+retry:
+	block = amdgpu_vram_buddy_find(buddy, order, fpfn, lpfn, topdown,
+				       &target);
+	if (!block) {
+		r = -ENOSPC;
+		goto out_unlock;
+	}
+
+	end = target + (1ul << order);
+	if (topdown)
+		first = rounddown(end - num_pages, alignment);
+	else
+		first = roundup(target, alignment);
+	last = first + num_pages;
+
+	/* Allocate everything needed upfront so that we don't need to
+	 * unwind the split when we run out of memory. The found block
+	 * itself is reused for the first piece.
+	 */
+	count = block->order - order;
+	for (pos = target; pos < end; ++count)
+		pos += 1ul << amdgpu_vram_buddy_piece(pos, first, last, end);
+
+	if (num_spare < count - 1) {
+		spin_unlock(&mgr->lock);
+		for (; num_spare < count - 1; ++num_spare) {
+			tmp = kmalloc(sizeof(*tmp), GFP_KERNEL);
+			if (!tmp) {
+				r = -ENOMEM;
+				goto out_free;
+			}
+			list_add(&tmp->link, &spare);
+		}
+		spin_lock(&mgr->lock);
+		goto retry;
+	}
+
+	/* split the block until it has the right size */
+	rb_erase(&block->rb, &buddy->free[block->order]);
+	while (block->order > order) {
+		unsigned long size = 1ul << --block->order;
+
+		tmp = list_first_entry(&spare, struct amdgpu_vram_block, link);
+		list_del(&tmp->link);
+
+		tmp->order = block->order;
+		if (target & size) {
+			tmp->start = block->start;
+			block->start += size;
+		} else {
+			tmp->start = block->start + size;
+		}
+		amdgpu_vram_buddy_insert(&buddy->free[tmp->order], tmp);
+	}
+
+	/* Cut the block into naturally aligned pieces which are either
+	 * completely used or completely free.
+	 */
+	for (pos = target, tmp = block; pos < end; pos += 1ul << tmp->order) {
+		if (pos != target) {
+			tmp = list_first_entry(&spare, struct amdgpu_vram_block,
+					       link);
+			list_del(&tmp->link);
+		}
+
+		tmp->start = pos;
+		tmp->order = amdgpu_vram_buddy_piece(pos, first, last, end);
+		if (pos >= first && pos < last)
+			amdgpu_vram_buddy_insert(&buddy->used, tmp);
+		else
+			amdgpu_vram_buddy_insert(&buddy->free[tmp->order],
+						 tmp);
+	}
+
+	*start = first;
+
+out_unlock:
+	spin_unlock(&mgr->lock);
+
+out_free:
+	list_for_each_entry_safe(block, tmp, &spare, link)
+		kfree(block);
+
+	return r;
+}
+
+/**
+ * amdgpu_vram_buddy_free - free a range of pages
+ *
+ * @buddy: buddy allocator
+ * @start: start of the range
+ * @num_pages: number of pages
+ *
+ * Must be called with the manager lock held.
+ */
+static void amdgpu_vram_buddy_free(struct amdgpu_vram_buddy *buddy,
+				   unsigned long start,
+				   unsigned long num_pages)
+{
+	unsigned long end = start + num_pages;
+
+	while (start < end) {
+		struct amdgpu_vram_block *block;
+
+		block = amdgpu_vram_buddy_lookup(&buddy->used, start);
+		if (WARN_ON(!block))
+			break;
+
+		start += 1ul << block->order;
+		rb_erase(&block->rb, &buddy->used);
+		amdgpu_vram_buddy_free_block(buddy, block);
+	}
+}
+
+/**
+ * amdgpu_vram_buddy_init - init the buddy allocator
+ *
+ * @buddy: buddy allocator
+ * @size: number of pages to manage
+ *
+ * Cover the pages with the biggest naturally aligned free blocks possible.
+ */
+static int amdgpu_vram_buddy_init(struct amdgpu_vram_buddy *buddy,
+				  unsigned long size)
+{
+	struct amdgpu_vram_block *block;
+	unsigned long pos;
+	unsigned i;
+
+	for (i = 0; i < AMDGPU_VRAM_BUDDY_ORDERS; ++i)
+		buddy->free[i] = RB_ROOT;
+	buddy->used = RB_ROOT;
+	buddy->size = size;
+
+	for (pos = 0; pos < size; pos += 1ul << block->order) {
+		block = kmalloc(sizeof(*block), GFP_KERNEL);
+		if (!block)
+			return -ENOMEM;
+
+		block->start = pos;
+		block->order = ilog2(size - pos);
+		if (pos)
+			block->order = min(block->order, (unsigned)__ffs(pos));
+		amdgpu_vram_buddy_insert(&buddy->free[block->order], block);
+	}
+
+	return 0;
+}
+
+/**
+ * amdgpu_vram_buddy_fini - tear down the buddy allocator
+ *
+ * @buddy: buddy allocator
+ *
+ * Returns -EBUSY if ranges are still allocated.
+ */
+static int amdgpu_vram_buddy_fini(struct amdgpu_vram_buddy *buddy)
+{
+	struct amdgpu_vram_block *block, *tmp;
+	unsigned i;
+
+	if (!RB_EMPTY_ROOT(&buddy->used))
+		return -EBUSY;
+
+	for (i = 0; i < AMDGPU_VRAM_BUDDY_ORDERS; ++i) {
+		rbtree_postorder_for_each_entry_safe(block, tmp,
+						     &buddy->free[i], rb)
+			kfree(block);
+		buddy->free[i] = RB_ROOT;
+	}
+
+	return 0;
+}
+
 /**
  * amdgpu_vram_mgr_init - init VRAM manager and DRM MM
  *
@@ -44,11 +510,22 @@ static int amdgpu_vram_mgr_init(struct ttm_mem_type_manager *man,
 				unsigned long p_size)
 {
 	struct amdgpu_vram_mgr *mgr;
+	int r;
 
 	mgr = kzalloc(sizeof(*mgr), GFP_KERNEL);
 	if (!mgr)
 		return -ENOMEM;
 
+	mgr->use_buddy = amdgpu_vram_buddy == 1;
+	if (mgr->use_buddy) {
+		r = amdgpu_vram_buddy_init(&mgr->buddy, p_size);
+		if (r) {
+			amdgpu_vram_buddy_fini(&mgr->buddy);
+			kfree(mgr);
+			return r;
+		}
+	}
+
 	drm_mm_init(&mgr->mm, 0, p_size);
 	spin_lock_init(&mgr->lock);
 	man->priv = mgr;
@@ -67,6 +544,9 @@ static int amdgpu_vram_mgr_fini(struct ttm_mem_type_manager *man)
 {
 	struct amdgpu_vram_mgr *mgr = man->priv;
 
+	if (mgr->use_buddy && amdgpu_vram_buddy_fini(&mgr->buddy))
+		return -EBUSY;
+
 	spin_lock(&mgr->lock);
 	if (!drm_mm_clean(&mgr->mm)) {
 		spin_unlock(&mgr->lock);
@@ -101,6 +581,95 @@ static u64 amdgpu_vram_mgr_vis_size(struct amdgpu_device *adev,
 		adev->mc.visible_vram_size : end) - start;
 }
 
+/**
+ * amdgpu_vram_mgr_new_buddy - allocate new ranges with the buddy allocator
+ *
+ * @man: TTM memory type manager
+ * @place: placement flags and restrictions
+ * @mem: the resulting mem object
+ * @nodes: preallocated nodes
+ * @num_nodes: number of nodes
+ * @pages_per_node: maximum size of each node
+ *
+ * The nodes aren't part of the drm_mm, only their start and size are used.
+ */
+static int amdgpu_vram_mgr_new_buddy(struct ttm_mem_type_manager *man,
+				     const struct ttm_place *place,
+				     struct ttm_mem_reg *mem,
+				     struct drm_mm_node *nodes,
+				     unsigned long num_nodes,
+				     unsigned long pages_per_node)
+{
+	struct amdgpu_device *adev = amdgpu_ttm_adev(man->bdev);
+	struct amdgpu_vram_mgr *mgr = man->priv;
+	bool topdown = place->flags & TTM_PL_FLAG_TOPDOWN;
+	unsigned long lpfn, pages_left;
+	uint64_t usage = 0, vis_usage = 0;
+	unsigned i;
+	int r;
+
+	lpfn = place->lpfn;
+	if (!lpfn)
+		lpfn = man->size;
+
+	mem->start = 0;
+	pages_left = mem->num_pages;
+
+	for (i = 0; i < num_nodes; ++i) {
+		unsigned long pages = min(pages_left, pages_per_node);
+		unsigned long alignment = mem->page_alignment;
+		unsigned long start;
+
+		/* Blocks are naturally aligned, so full nodes get the natural
+		 * power of two alignment for free. Aligning to pages_per_node
+		 * itself would need a block twice as big when it isn't a power
+		 * of two, e.g. for contiguous BOs.
+		 */
+		if (pages == pages_per_node &&
+		    (!alignment || is_power_of_2(alignment)))
+			alignment = max(alignment, rounddown_pow_of_two(pages));
+
+		r = amdgpu_vram_buddy_alloc(mgr, pages, alignment,
+					    place->fpfn, lpfn, topdown,
+					    &start);
+		if (unlikely(r))
+			goto error;
+
+		nodes[i].start = start;
+		nodes[i].size = pages;
+		usage += nodes[i].size << PAGE_SHIFT;
+		vis_usage += amdgpu_vram_mgr_vis_size(adev, &nodes[i]);
+
+		/* Calculate a virtual BO start address to easily check if
+		 * everything is CPU accessible.
+		 */
+		start = nodes[i].start + nodes[i].size;
+		if (start > mem->num_pages)
+			start -= mem->num_pages;
+		else
+			start = 0;
+		mem->start = max(mem->start, start);
+		pages_left -= pages;
+	}
+
+	atomic64_add(usage, &mgr->usage);
+	atomic64_add(vis_usage, &mgr->vis_usage);
+
+	mem->mm_node = nodes;
+
+	return 0;
+
+error:
+	spin_lock(&mgr->lock);
+	while (i--)
+		amdgpu_vram_buddy_free(&mgr->buddy, nodes[i].start,
+				       nodes[i].size);
+	spin_unlock(&mgr->lock);
+
+	kfree(nodes);
+	return r == -ENOSPC ? 0 : r;
+}
+
 /**
  * amdgpu_vram_mgr_new - allocate new ranges
  *
@@ -149,6 +718,10 @@ static int amdgpu_vram_mgr_new(struct ttm_mem_type_manager *man,
 	if (!nodes)
 		return -ENOMEM;
 
+	if (mgr->use_buddy)
+		return amdgpu_vram_mgr_new_buddy(man, place, mem, nodes,
+						 num_nodes, pages_per_node);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 11, 0)
 	if (place->flags & TTM_PL_FLAG_TOPDOWN) {
 		sflags = DRM_MM_SEARCH_BELOW;
@@ -245,7 +818,11 @@ static void amdgpu_vram_mgr_del(struct ttm_mem_type_manager *man,
 	spin_lock(&mgr->lock);
 	while (pages) {
 		pages -= nodes->size;
-		drm_mm_remove_node(nodes);
+		if (mgr->use_buddy)
+			amdgpu_vram_buddy_free(&mgr->buddy, nodes->start,
+					       nodes->size);
+		else
+			drm_mm_remove_node(nodes);
 		usage += nodes->size << PAGE_SHIFT;
 		vis_usage += amdgpu_vram_mgr_vis_size(adev, nodes);
 		++nodes;
@@ -304,8 +881,24 @@ static void amdgpu_vram_mgr_debug(struct ttm_mem_type_manager *man,
 #endif
 {
 	struct amdgpu_vram_mgr *mgr = man->priv;
+	unsigned i;
 
 	spin_lock(&mgr->lock);
+	for (i = 0; mgr->use_buddy && i < AMDGPU_VRAM_BUDDY_ORDERS; ++i) {
+		unsigned long count = 0;
+		struct rb_node *node;
+
+		for (node = rb_first(&mgr->buddy.free[i]); node;
+		     node = rb_next(node))
+			++count;
+		if (!count)
+			continue;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+		drm_printf(printer, "order %u: %lu free blocks\n", i, count);
+#else
+		DRM_DEBUG("%sorder %u: %lu free blocks\n", prefix, i, count);
+#endif
+	}
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
 	drm_mm_print(&mgr->mm, printer);
 #else
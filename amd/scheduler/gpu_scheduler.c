@@ -24,6 +24,7 @@
 #include <linux/kthread.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#include <linux/percpu.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
 #include <uapi/linux/sched/types.h>
 #endif
@@ -42,37 +43,135 @@ static void amd_sched_rq_init(struct amd_sched_rq *rq)
 {
 	spin_lock_init(&rq->lock);
 	INIT_LIST_HEAD(&rq->entities);
+	INIT_LIST_HEAD(&rq->ready);
+	init_llist_head(&rq->wakeups);
 	rq->current_entity = NULL;
 }
 
+/**
+ * Put an entity on the ready list of its run queue
+ *
+ * @rq		The run queue, rq->lock must be held.
+ * @entity	The entity to add.
+ *
+ * An entity coming back from idle doesn't keep credit for the time it
+ * didn't use, its virtual runtime starts at the run queue minimum.
+ */
+static void amd_sched_rq_queue_ready(struct amd_sched_rq *rq,
+				     struct amd_sched_entity *entity)
+{
+	if (!list_empty(&entity->ready_list))
+		return;
+
+	entity->vruntime = max(entity->vruntime, rq->min_vruntime);
+	list_add_tail(&entity->ready_list, &rq->ready);
+}
+
 static void amd_sched_rq_add_entity(struct amd_sched_rq *rq,
 				    struct amd_sched_entity *entity)
 {
-	if (!list_empty(&entity->list))
-		return;
 	spin_lock(&rq->lock);
-	list_add_tail(&entity->list, &rq->entities);
+	if (list_empty(&entity->list))
+		list_add_tail(&entity->list, &rq->entities);
+	amd_sched_rq_queue_ready(rq, entity);
 	spin_unlock(&rq->lock);
 }
 
+/**
+ * Move entities unblocked by fence callbacks to the ready list
+ *
+ * @rq		The run queue to update, rq->lock must be held.
+ */
+static void amd_sched_rq_flush_wakeups(struct amd_sched_rq *rq)
+{
+	struct amd_sched_entity *entity, *tmp;
+	struct llist_node *wakeups;
+
+	wakeups = llist_del_all(&rq->wakeups);
+	llist_for_each_entry_safe(entity, tmp, wakeups, wakeup_node) {
+		atomic_set(&entity->wakeup_pending, 0);
+		smp_mb__after_atomic();
+		amd_sched_rq_queue_ready(rq, entity);
+	}
+}
+
+/**
+ * Charge the GPU time of completed jobs to an entity
+ *
+ * @entity	The entity to update, rq->lock must be held.
+ *
+ * Jobs of one entity complete in order, so we can stop at the first
+ * one which is still running.
+ */
+static void amd_sched_entity_update_vruntime(struct amd_sched_entity *entity)
+{
+	struct amd_sched_fence *s_fence, *tmp;
+
+	list_for_each_entry_safe(s_fence, tmp, &entity->inflight, acct) {
+		if (!dma_fence_is_signaled(&s_fence->finished))
+			break;
+
+		smp_rmb();
+		entity->runtime += s_fence->runtime;
+		entity->vruntime += div_u64(s_fence->runtime *
+					    AMD_SCHED_WEIGHT_DEFAULT,
+					    entity->weight);
+		list_del_init(&s_fence->acct);
+		dma_fence_put(&s_fence->finished);
+	}
+}
+
+/* Drop accounting of jobs still in flight when an entity goes away */
+static void amd_sched_entity_drop_inflight(struct amd_sched_entity *entity)
+{
+	struct amd_sched_fence *s_fence, *tmp;
+
+	list_for_each_entry_safe(s_fence, tmp, &entity->inflight, acct) {
+		list_del_init(&s_fence->acct);
+		dma_fence_put(&s_fence->finished);
+	}
+}
+
 static void amd_sched_rq_remove_entity(struct amd_sched_rq *rq,
 				       struct amd_sched_entity *entity)
 {
-	if (list_empty(&entity->list))
-		return;
+	/* a fence callback might still be queueing the entity */
+	while (atomic_read(&entity->wakeup_busy))
+		cpu_relax();
+
 	spin_lock(&rq->lock);
+	amd_sched_rq_flush_wakeups(rq);
+	list_del_init(&entity->ready_list);
 	list_del_init(&entity->list);
+	amd_sched_entity_drop_inflight(entity);
 	if (rq->current_entity == entity)
 		rq->current_entity = NULL;
 	spin_unlock(&rq->lock);
 }
 
+/**
+ * Queue an entity whose dependency was just resolved
+ *
+ * @entity	The pointer to a valid scheduler entity
+ *
+ * Can be called from any context, including fence callbacks.
+ */
+static void amd_sched_entity_queue_wakeup(struct amd_sched_entity *entity)
+{
+	struct amd_sched_rq *rq = entity->rq;
+
+	if (!atomic_xchg(&entity->wakeup_pending, 1))
+		llist_add(&entity->wakeup_node, &rq->wakeups);
+}
+
 /**
  * Select an entity which could provide a job to run
  *
  * @rq		The run queue to check.
  *
  * Try to find a ready entity, returns NULL if none found.
+ * Entities are picked round robin from the ready list, those which
+ * turn out to be idle or blocked are dropped from it.
  */
 static struct amd_sched_entity *
 amd_sched_rq_select_entity(struct amd_sched_rq *rq)
@@ -80,68 +179,130 @@ amd_sched_rq_select_entity(struct amd_sched_rq *rq)
 	struct amd_sched_entity *entity;
 
 	spin_lock(&rq->lock);
+	amd_sched_rq_flush_wakeups(rq);
 
-	entity = rq->current_entity;
-	if (entity) {
-		list_for_each_entry_continue(entity, &rq->entities, list) {
-			if (amd_sched_entity_is_ready(entity)) {
-				rq->current_entity = entity;
-				spin_unlock(&rq->lock);
-				return entity;
-			}
+	while ((entity = list_first_entry_or_null(&rq->ready,
+						  struct amd_sched_entity,
+						  ready_list))) {
+		if (amd_sched_entity_is_ready(entity)) {
+			list_move_tail(&entity->ready_list, &rq->ready);
+			rq->current_entity = entity;
+			break;
 		}
+		list_del_init(&entity->ready_list);
 	}
 
-	list_for_each_entry(entity, &rq->entities, list) {
+	spin_unlock(&rq->lock);
 
-		if (amd_sched_entity_is_ready(entity)) {
-			rq->current_entity = entity;
-			spin_unlock(&rq->lock);
-			return entity;
+	return entity;
+}
+
+/**
+ * Select the ready entity with the least weighted GPU time
+ *
+ * @rq		The run queue to check.
+ *
+ * Returns NULL if no entity is ready. Entities with the same virtual
+ * runtime are still served round robin.
+ */
+static struct amd_sched_entity *
+amd_sched_rq_select_entity_fair(struct amd_sched_rq *rq)
+{
+	struct amd_sched_entity *entity, *tmp, *best = NULL;
+
+	spin_lock(&rq->lock);
+	amd_sched_rq_flush_wakeups(rq);
+
+	list_for_each_entry_safe(entity, tmp, &rq->ready, ready_list) {
+		if (!amd_sched_entity_is_ready(entity)) {
+			list_del_init(&entity->ready_list);
+			continue;
 		}
 
-		if (entity == rq->current_entity)
-			break;
+		amd_sched_entity_update_vruntime(entity);
+		if (!best || entity->vruntime < best->vruntime)
+			best = entity;
+	}
+
+	if (best) {
+		list_move_tail(&best->ready_list, &rq->ready);
+		rq->min_vruntime = max(rq->min_vruntime, best->vruntime);
+		rq->current_entity = best;
 	}
 
 	spin_unlock(&rq->lock);
 
-	return NULL;
+	return best;
+}
+
+/**
+ * Track the GPU time of a job which is about to run
+ *
+ * @entity	The entity the job was popped from
+ * @s_job	The job
+ */
+static void amd_sched_fair_job_begin(struct amd_sched_entity *entity,
+				     struct amd_sched_job *s_job)
+{
+	struct amd_sched_rq *rq = entity->rq;
+
+	spin_lock(&rq->lock);
+	dma_fence_get(&s_job->s_fence->finished);
+	list_add_tail(&s_job->s_fence->acct, &entity->inflight);
+	spin_unlock(&rq->lock);
 }
 
+/**
+ * Scheduling policy used to pick entities inside a run queue, run
+ * queues of different priority are always served strictly in order.
+ */
+struct amd_sched_policy_ops {
+	struct amd_sched_entity *(*select_entity)(struct amd_sched_rq *rq);
+	void (*job_begin)(struct amd_sched_entity *entity,
+			  struct amd_sched_job *s_job);
+};
+
+static const struct amd_sched_policy_ops amd_sched_policies[] = {
+	[AMD_SCHED_POLICY_RR] = {
+		.select_entity = amd_sched_rq_select_entity,
+	},
+	[AMD_SCHED_POLICY_FAIR] = {
+		.select_entity = amd_sched_rq_select_entity_fair,
+		.job_begin = amd_sched_fair_job_begin,
+	},
+};
+
 /**
  * Init a context entity used by scheduler when submit to HW ring.
  *
  * @sched	The pointer to the scheduler
  * @entity	The pointer to a valid amd_sched_entity
  * @rq		The run queue this entity belongs
- * @kernel	If this is an entity for the kernel
- * @jobs	The max number of jobs in the job queue
  *
  * return 0 if succeed. negative error code on failure
 */
 int amd_sched_entity_init(struct amd_gpu_scheduler *sched,
 			  struct amd_sched_entity *entity,
-			  struct amd_sched_rq *rq,
-			  uint32_t jobs)
+			  struct amd_sched_rq *rq)
 {
-	int r;
-
 	if (!(sched && entity && rq))
 		return -EINVAL;
 
 	memset(entity, 0, sizeof(struct amd_sched_entity));
 	INIT_LIST_HEAD(&entity->list);
+	INIT_LIST_HEAD(&entity->ready_list);
+	INIT_LIST_HEAD(&entity->inflight);
+	atomic_set(&entity->wakeup_pending, 0);
+	atomic_set(&entity->wakeup_busy, 0);
+	entity->weight = AMD_SCHED_WEIGHT_DEFAULT;
 	entity->rq = rq;
 	entity->sched = sched;
 
-	spin_lock_init(&entity->queue_lock);
-	r = kfifo_alloc(&entity->job_queue, jobs * sizeof(void *), GFP_KERNEL);
-	if (r)
-		return r;
+	spsc_queue_init(&entity->job_queue);
 
 	atomic_set(&entity->fence_seq, 0);
 	entity->fence_context = kcl_fence_context_alloc(2);
+	entity->dependency_context = kcl_fence_context_alloc(1);
 
 	return 0;
 }
@@ -171,7 +332,7 @@ static bool amd_sched_entity_is_initialized(struct amd_gpu_scheduler *sched,
 static bool amd_sched_entity_is_idle(struct amd_sched_entity *entity)
 {
 	rmb();
-	if (kfifo_is_empty(&entity->job_queue))
+	if (!spsc_queue_count(&entity->job_queue))
 		return true;
 
 	return false;
@@ -186,7 +347,7 @@ static bool amd_sched_entity_is_idle(struct amd_sched_entity *entity)
  */
 static bool amd_sched_entity_is_ready(struct amd_sched_entity *entity)
 {
-	if (kfifo_is_empty(&entity->job_queue))
+	if (!spsc_queue_peek(&entity->job_queue))
 		return false;
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
@@ -222,23 +383,48 @@ void amd_sched_entity_fini(struct amd_gpu_scheduler *sched,
 	wait_event(sched->job_scheduled, amd_sched_entity_is_idle(entity));
 
 	amd_sched_rq_remove_entity(rq, entity);
-	kfifo_free(&entity->job_queue);
+}
+
+/**
+ * Clear the dependency of an entity and queue it for the scheduler
+ *
+ * @entity	The pointer to a valid scheduler entity
+ *
+ * The entity may become idle and be destroyed as soon as the dependency
+ * is cleared, so wakeup_busy keeps amd_sched_entity_fini() waiting until
+ * the entity is on the wakeups list. The entity must not be touched
+ * after this returns.
+ */
+static void amd_sched_entity_resolve_dep(struct amd_sched_entity *entity)
+{
+	atomic_inc(&entity->wakeup_busy);
+	smp_mb__after_atomic();
+
+	entity->dependency_time = ktime_get();
+	entity->dependency = NULL;
+	amd_sched_entity_queue_wakeup(entity);
+
+	smp_mb__before_atomic();
+	atomic_dec(&entity->wakeup_busy);
 }
 
 static void amd_sched_entity_wakeup(struct dma_fence *f, struct dma_fence_cb *cb)
 {
 	struct amd_sched_entity *entity =
 		container_of(cb, struct amd_sched_entity, cb);
-	entity->dependency = NULL;
+	struct amd_gpu_scheduler *sched = entity->sched;
+
+	amd_sched_entity_resolve_dep(entity);
 	dma_fence_put(f);
-	amd_sched_wakeup(entity->sched);
+	amd_sched_wakeup(sched);
 }
 
 static void amd_sched_entity_clear_dep(struct dma_fence *f, struct dma_fence_cb *cb)
 {
 	struct amd_sched_entity *entity =
 		container_of(cb, struct amd_sched_entity, cb);
-	entity->dependency = NULL;
+
+	amd_sched_entity_resolve_dep(entity);
 	dma_fence_put(f);
 }
 
@@ -303,10 +489,14 @@ amd_sched_entity_pop_job(struct amd_sched_entity *entity)
 {
 	struct amd_gpu_scheduler *sched = entity->sched;
 	struct amd_sched_job *sched_job;
+	struct spsc_node *node;
 
-	if (!kfifo_out_peek(&entity->job_queue, &sched_job, sizeof(sched_job)))
+	node = spsc_queue_peek(&entity->job_queue);
+	if (!node)
 		return NULL;
 
+	sched_job = to_amd_sched_job(node);
+
 	while ((entity->dependency = sched->ops->dependency(sched_job)))
 		if (amd_sched_entity_add_dependency_cb(entity))
 			return NULL;
@@ -314,37 +504,6 @@ amd_sched_entity_pop_job(struct amd_sched_entity *entity)
 	return sched_job;
 }
 
-/**
- * Helper to submit a job to the job queue
- *
- * @sched_job		The pointer to job required to submit
- *
- * Returns true if we could submit the job.
- */
-static bool amd_sched_entity_in(struct amd_sched_job *sched_job)
-{
-	struct amd_gpu_scheduler *sched = sched_job->sched;
-	struct amd_sched_entity *entity = sched_job->s_entity;
-	bool added, first = false;
-
-	spin_lock(&entity->queue_lock);
-	added = kfifo_in(&entity->job_queue, &sched_job,
-			sizeof(sched_job)) == sizeof(sched_job);
-
-	if (added && kfifo_len(&entity->job_queue) == sizeof(sched_job))
-		first = true;
-
-	spin_unlock(&entity->queue_lock);
-
-	/* first job wakes up scheduler */
-	if (first) {
-		/* Add the entity to the run queue */
-		amd_sched_rq_add_entity(entity->rq, entity);
-		amd_sched_wakeup(sched);
-	}
-	return added;
-}
-
 /* job_finish is called after hw fence signaled, and
  * the job had already been deleted from ring_mirror_list
  */
@@ -472,17 +631,47 @@ void amd_sched_job_recovery(struct amd_gpu_scheduler *sched)
  *
  * @sched_job		The pointer to job required to submit
  *
- * Returns 0 for success, negative error code otherwise.
+ * The job queue is lockless and unbounded, so this never blocks.
  */
 void amd_sched_entity_push_job(struct amd_sched_job *sched_job)
 {
+	struct amd_gpu_scheduler *sched = sched_job->sched;
 	struct amd_sched_entity *entity = sched_job->s_entity;
 
 	trace_amd_sched_job(sched_job);
+	sched_job->s_fence->push_time = ktime_get();
 	dma_fence_add_callback(&sched_job->s_fence->finished, &sched_job->finish_cb,
 			       amd_sched_job_finish_cb);
-	wait_event(entity->sched->job_scheduled,
-		   amd_sched_entity_in(sched_job));
+
+	/* first job wakes up scheduler */
+	if (spsc_queue_push(&entity->job_queue, &sched_job->queue_node)) {
+		/* Add the entity to the run queue */
+		amd_sched_rq_add_entity(entity->rq, entity);
+		amd_sched_wakeup(sched);
+	}
+}
+
+/**
+ * Set the share of GPU time an entity gets under the fair policy
+ *
+ * @entity	The pointer to a valid scheduler entity
+ * @weight	Relative weight, 0 selects AMD_SCHED_WEIGHT_DEFAULT
+ *
+ * The weight is clamped to AMD_SCHED_WEIGHT_MIN..AMD_SCHED_WEIGHT_MAX.
+ */
+void amd_sched_entity_set_weight(struct amd_sched_entity *entity,
+				 uint32_t weight)
+{
+	struct amd_sched_rq *rq = entity->rq;
+
+	if (!weight)
+		weight = AMD_SCHED_WEIGHT_DEFAULT;
+	weight = clamp_t(uint32_t, weight, AMD_SCHED_WEIGHT_MIN,
+			 AMD_SCHED_WEIGHT_MAX);
+
+	spin_lock(&rq->lock);
+	entity->weight = weight;
+	spin_unlock(&rq->lock);
 }
 
 /* init a sched_job with basic field */
@@ -537,7 +726,7 @@ amd_sched_select_entity(struct amd_gpu_scheduler *sched)
 
 	/* Kernel run queue has higher priority than normal run queue*/
 	for (i = AMD_SCHED_PRIORITY_MAX - 1; i >= AMD_SCHED_PRIORITY_MIN; i--) {
-		entity = amd_sched_rq_select_entity(&sched->sched_rq[i]);
+		entity = sched->policy->select_entity(&sched->sched_rq[i]);
 		if (entity)
 			break;
 	}
@@ -545,11 +734,78 @@ amd_sched_select_entity(struct amd_gpu_scheduler *sched)
 	return entity;
 }
 
+/**
+ * Account one latency sample in the per CPU histogram
+ *
+ * @sched	The pointer to the scheduler
+ * @s_fence	The fence of the job the sample belongs to
+ * @stage	Which part of the job's life was measured
+ * @start	Begin of the interval
+ * @end		End of the interval
+ *
+ * Lockless and safe to call from interrupt context.
+ */
+static void amd_sched_lat_hist_add(struct amd_gpu_scheduler *sched,
+				   struct amd_sched_fence *s_fence,
+				   enum amd_sched_lat_stage stage,
+				   ktime_t start, ktime_t end)
+{
+	s64 us = ktime_us_delta(end, start);
+	unsigned bucket = us > 0 ? fls64(us) : 0;
+
+	bucket = min_t(unsigned, bucket, AMD_SCHED_LAT_BUCKETS - 1);
+	this_cpu_inc(sched->lat_hist->count[s_fence->priority][stage][bucket]);
+}
+
+/**
+ * Sum up a latency histogram over all CPUs
+ *
+ * @sched	The pointer to the scheduler
+ * @priority	Run queue priority to read
+ * @stage	Which part of the job's life to read
+ * @buckets	Array of AMD_SCHED_LAT_BUCKETS entries filled with the counts
+ */
+void amd_sched_lat_hist_read(struct amd_gpu_scheduler *sched,
+			     enum amd_sched_priority priority,
+			     enum amd_sched_lat_stage stage,
+			     u64 *buckets)
+{
+	int cpu, i;
+
+	memset(buckets, 0, sizeof(*buckets) * AMD_SCHED_LAT_BUCKETS);
+	if (!sched->lat_hist)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct amd_sched_lat_hist *hist = per_cpu_ptr(sched->lat_hist, cpu);
+
+		for (i = 0; i < AMD_SCHED_LAT_BUCKETS; ++i)
+			buckets[i] += READ_ONCE(hist->count[priority][stage][i]);
+	}
+}
+
 static void amd_sched_process_job(struct dma_fence *f, struct dma_fence_cb *cb)
 {
 	struct amd_sched_fence *s_fence =
 		container_of(cb, struct amd_sched_fence, cb);
 	struct amd_gpu_scheduler *sched = s_fence->sched;
+	ktime_t now = ktime_get();
+
+	/* Jobs on a ring overlap, only count the time after the previous one */
+	if (ktime_after(sched->last_done, s_fence->start))
+		s_fence->runtime = ktime_to_ns(ktime_sub(now, sched->last_done));
+	else
+		s_fence->runtime = ktime_to_ns(ktime_sub(now, s_fence->start));
+	sched->last_done = now;
+
+	amd_sched_lat_hist_add(sched, s_fence, AMD_SCHED_LAT_QUEUE,
+			       s_fence->push_time, s_fence->ready_time);
+	amd_sched_lat_hist_add(sched, s_fence, AMD_SCHED_LAT_SCHED,
+			       s_fence->ready_time, s_fence->start);
+	amd_sched_lat_hist_add(sched, s_fence, AMD_SCHED_LAT_HW,
+			       s_fence->start, now);
+	amd_sched_lat_hist_add(sched, s_fence, AMD_SCHED_LAT_TOTAL,
+			       s_fence->push_time, now);
 
 	atomic_dec(&sched->hw_rq_count);
 	amd_sched_fence_finished(s_fence);
@@ -569,19 +825,71 @@ static bool amd_sched_blocked(struct amd_gpu_scheduler *sched)
 	return false;
 }
 
+/**
+ * Pop the next job of an entity and hand it to the hardware
+ *
+ * @sched	The pointer to the scheduler
+ * @entity	The entity selected to provide the job
+ *
+ * Returns true if a job was submitted.
+ */
+static bool amd_sched_run_entity(struct amd_gpu_scheduler *sched,
+				 struct amd_sched_entity *entity)
+{
+	struct amd_sched_fence *s_fence;
+	struct amd_sched_job *sched_job;
+	struct dma_fence *fence;
+	int r;
+
+	sched_job = amd_sched_entity_pop_job(entity);
+	if (!sched_job)
+		return false;
+
+	s_fence = sched_job->s_fence;
+	if (ktime_after(entity->dependency_time, s_fence->push_time))
+		s_fence->ready_time = entity->dependency_time;
+	else
+		s_fence->ready_time = s_fence->push_time;
+
+	atomic_inc(&sched->hw_rq_count);
+	amd_sched_job_begin(sched_job);
+	if (sched->policy->job_begin)
+		sched->policy->job_begin(entity, sched_job);
+
+	s_fence->start = ktime_get();
+	fence = sched->ops->run_job(sched_job);
+	amd_sched_fence_scheduled(s_fence);
+	if (fence) {
+		s_fence->parent = dma_fence_get(fence);
+		r = dma_fence_add_callback(fence, &s_fence->cb,
+					   amd_sched_process_job);
+		if (r == -ENOENT)
+			amd_sched_process_job(fence, &s_fence->cb);
+		else if (r)
+			DRM_ERROR("fence add callback failed (%d)\n",
+				  r);
+		dma_fence_put(fence);
+	} else {
+		DRM_ERROR("Failed to run job!\n");
+		amd_sched_process_job(NULL, &s_fence->cb);
+	}
+
+	spsc_queue_pop(&entity->job_queue);
+	wake_up(&sched->job_scheduled);
+
+	return true;
+}
+
 static int amd_sched_main(void *param)
 {
 	struct sched_param sparam = {.sched_priority = 1};
 	struct amd_gpu_scheduler *sched = (struct amd_gpu_scheduler *)param;
-	int r, count;
+	unsigned i;
 
 	sched_setscheduler(current, SCHED_FIFO, &sparam);
 
 	while (!kthread_should_stop()) {
 		struct amd_sched_entity *entity = NULL;
-		struct amd_sched_fence *s_fence;
-		struct amd_sched_job *sched_job;
-		struct dma_fence *fence;
 
 		wait_event_interruptible(sched->wake_up_worker,
 					 (!amd_sched_blocked(sched) &&
@@ -591,36 +899,22 @@ static int amd_sched_main(void *param)
 		if (!entity)
 			continue;
 
-		sched_job = amd_sched_entity_pop_job(entity);
-		if (!sched_job)
-			continue;
-
-		s_fence = sched_job->s_fence;
-
-		atomic_inc(&sched->hw_rq_count);
-		amd_sched_job_begin(sched_job);
+		/*
+		 * Submit as many jobs as the hardware credit and batch size
+		 * allow before going back to sleep, so the backend can kick
+		 * the ring only once for all of them.
+		 */
+		if (sched->ops->begin_batch)
+			sched->ops->begin_batch(sched);
 
-		fence = sched->ops->run_job(sched_job);
-		amd_sched_fence_scheduled(s_fence);
-		if (fence) {
-			s_fence->parent = dma_fence_get(fence);
-			r = dma_fence_add_callback(fence, &s_fence->cb,
-						   amd_sched_process_job);
-			if (r == -ENOENT)
-				amd_sched_process_job(fence, &s_fence->cb);
-			else if (r)
-				DRM_ERROR("fence add callback failed (%d)\n",
-					  r);
-			dma_fence_put(fence);
-		} else {
-			DRM_ERROR("Failed to run job!\n");
-			amd_sched_process_job(NULL, &s_fence->cb);
+		for (i = 0; i < sched->batch_size && entity; ++i) {
+			amd_sched_run_entity(sched, entity);
+			if (i + 1 < sched->batch_size)
+				entity = amd_sched_select_entity(sched);
 		}
 
-		count = kfifo_out(&entity->job_queue, &sched_job,
-				sizeof(sched_job));
-		WARN_ON(count != sizeof(sched_job));
-		wake_up(&sched->job_scheduled);
+		if (sched->ops->end_batch)
+			sched->ops->end_batch(sched);
 	}
 	return 0;
 }
@@ -641,7 +935,9 @@ int amd_sched_init(struct amd_gpu_scheduler *sched,
 {
 	int i;
 	sched->ops = ops;
+	sched->policy = &amd_sched_policies[AMD_SCHED_POLICY_RR];
 	sched->hw_submission_limit = hw_submission;
+	sched->batch_size = 1;
 	sched->name = name;
 	sched->timeout = timeout;
 	for (i = AMD_SCHED_PRIORITY_MIN; i < AMD_SCHED_PRIORITY_MAX; i++)
@@ -653,11 +949,18 @@ int amd_sched_init(struct amd_gpu_scheduler *sched,
 	spin_lock_init(&sched->job_list_lock);
 	atomic_set(&sched->hw_rq_count, 0);
 	atomic64_set(&sched->job_id_count, 0);
+	sched->last_done = ktime_set(0, 0);
+
+	sched->lat_hist = alloc_percpu(struct amd_sched_lat_hist);
+	if (!sched->lat_hist)
+		return -ENOMEM;
 
 	/* Each scheduler will run on a seperate kernel thread */
 	sched->thread = kthread_run(amd_sched_main, sched, sched->name);
 	if (IS_ERR(sched->thread)) {
 		DRM_ERROR("Failed to create scheduler for %s.\n", name);
+		free_percpu(sched->lat_hist);
+		sched->lat_hist = NULL;
 		return PTR_ERR(sched->thread);
 	}
 
@@ -673,4 +976,36 @@ void amd_sched_fini(struct amd_gpu_scheduler *sched)
 {
 	if (sched->thread)
 		kthread_stop(sched->thread);
+	free_percpu(sched->lat_hist);
+	sched->lat_hist = NULL;
+}
+
+/**
+ * Select the policy used to pick entities inside each run queue
+ *
+ * @sched	The pointer to the scheduler
+ * @policy	One of AMD_SCHED_POLICY_*
+ *
+ * Must be called before any entity is attached to the scheduler.
+ */
+void amd_sched_set_policy(struct amd_gpu_scheduler *sched,
+			  enum amd_sched_policy policy)
+{
+	if (WARN_ON(policy >= AMD_SCHED_POLICY_MAX))
+		policy = AMD_SCHED_POLICY_RR;
+
+	sched->policy = &amd_sched_policies[policy];
+}
+
+/**
+ * Set the maximum number of jobs submitted per scheduler wakeup
+ *
+ * @sched	The pointer to the scheduler
+ * @batch_size	Number of jobs, still limited by the hw submission credit
+ */
+void amd_sched_set_batch_size(struct amd_gpu_scheduler *sched,
+			      uint32_t batch_size)
+{
+	sched->batch_size = clamp_t(uint32_t, batch_size, 1,
+				    sched->hw_submission_limit);
 }
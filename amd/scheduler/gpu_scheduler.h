@@ -24,15 +24,19 @@
 #ifndef _GPU_SCHEDULER_H_
 #define _GPU_SCHEDULER_H_
 
-#if (defined OS_NAME_RHEL) && (OS_VERSION_MAJOR == 6)
-#include <linux/kfifo-new.h>
-#else
-#include <linux/kfifo.h>
-#endif
+#include <linux/llist.h>
+#include <drm/spsc_queue.h>
 #include <kcl/kcl_fence.h>
 
 struct amd_gpu_scheduler;
 struct amd_sched_rq;
+struct amd_sched_policy_ops;
+
+/* Share of an entity with the default weight under the fair policy */
+#define AMD_SCHED_WEIGHT_DEFAULT	1024
+/* Weights are clamped to this range around the default */
+#define AMD_SCHED_WEIGHT_MIN		(AMD_SCHED_WEIGHT_DEFAULT / 64)
+#define AMD_SCHED_WEIGHT_MAX		(AMD_SCHED_WEIGHT_DEFAULT * 64)
 
 /**
  * A scheduler entity is a wrapper around a job queue or a group
@@ -42,28 +46,52 @@ struct amd_sched_rq;
 */
 struct amd_sched_entity {
 	struct list_head		list;
+	struct list_head		ready_list;
+	struct llist_node		wakeup_node;
+	atomic_t			wakeup_pending;
+	atomic_t			wakeup_busy;
 	struct amd_sched_rq		*rq;
 	struct amd_gpu_scheduler	*sched;
 
-	spinlock_t			queue_lock;
-	struct kfifo                    job_queue;
+	struct spsc_queue		job_queue;
 
 	atomic_t			fence_seq;
 	uint64_t                        fence_context;
 
+	/* fence arrays merging the dependencies of the jobs, only used by
+	 * the scheduler thread and signaled in job order
+	 */
+	uint64_t			dependency_context;
+	unsigned			dependency_seq;
+
 	struct dma_fence		*dependency;
 	struct dma_fence_cb		cb;
+	ktime_t				dependency_time;
+
+	/* fair share accounting, protected by rq->lock */
+	uint32_t			weight;
+	uint64_t			vruntime;
+	uint64_t			runtime;
+	struct list_head		inflight;
 };
 
 /**
  * Run queue is a set of entities scheduling command submissions for
  * one specific ring. It implements the scheduling policy that selects
  * the next entity to emit commands from.
+ *
+ * Entities which can provide a job are kept on the ready list, so
+ * selection doesn't need to look at idle or blocked entities. Entities
+ * unblocked from fence callbacks are handed over through the lockless
+ * wakeups list and moved to the ready list by the scheduler thread.
 */
 struct amd_sched_rq {
 	spinlock_t		lock;
 	struct list_head	entities;
+	struct list_head	ready;
+	struct llist_head	wakeups;
 	struct amd_sched_entity	*current_entity;
+	uint64_t		min_vruntime;
 };
 
 struct amd_sched_fence {
@@ -74,9 +102,18 @@ struct amd_sched_fence {
 	struct amd_gpu_scheduler	*sched;
 	spinlock_t			lock;
 	void                            *owner;
+	/* GPU time accounting for the fair policy */
+	struct list_head		acct;
+	uint64_t			runtime;
+	/* latency tracking, see enum amd_sched_lat_stage */
+	unsigned			priority;
+	ktime_t				push_time;
+	ktime_t				ready_time;
+	ktime_t				start;
 };
 
 struct amd_sched_job {
+	struct spsc_node		queue_node;
 	struct amd_gpu_scheduler        *sched;
 	struct amd_sched_entity         *s_entity;
 	struct amd_sched_fence          *s_fence;
@@ -101,6 +138,9 @@ static inline struct amd_sched_fence *to_amd_sched_fence(struct dma_fence *f)
 	return NULL;
 }
 
+#define to_amd_sched_job(sched_job)		\
+		container_of((sched_job), struct amd_sched_job, queue_node)
+
 static inline bool amd_sched_invalidate_job(struct amd_sched_job *s_job, int threshold)
 {
 	return (s_job && atomic_inc_return(&s_job->karma) > threshold);
@@ -115,6 +155,15 @@ struct amd_sched_backend_ops {
 	struct dma_fence *(*run_job)(struct amd_sched_job *sched_job);
 	void (*timedout_job)(struct amd_sched_job *sched_job);
 	void (*free_job)(struct amd_sched_job *sched_job);
+	/* optional, bracket the run_job calls of one scheduler wakeup */
+	void (*begin_batch)(struct amd_gpu_scheduler *sched);
+	void (*end_batch)(struct amd_gpu_scheduler *sched);
+};
+
+enum amd_sched_policy {
+	AMD_SCHED_POLICY_RR,
+	AMD_SCHED_POLICY_FAIR,
+	AMD_SCHED_POLICY_MAX
 };
 
 enum amd_sched_priority {
@@ -124,12 +173,32 @@ enum amd_sched_priority {
 	AMD_SCHED_PRIORITY_MAX
 };
 
+/**
+ * Stages of a job's life the scheduler keeps latency histograms for
+*/
+enum amd_sched_lat_stage {
+	AMD_SCHED_LAT_QUEUE,	/* push until dependencies are resolved */
+	AMD_SCHED_LAT_SCHED,	/* dependencies resolved until run_job */
+	AMD_SCHED_LAT_HW,	/* run_job until the hardware fence signals */
+	AMD_SCHED_LAT_TOTAL,	/* push until the hardware fence signals */
+	AMD_SCHED_LAT_MAX
+};
+
+/* Bucket n counts latencies in [2^(n-1), 2^n) us, the last one is open */
+#define AMD_SCHED_LAT_BUCKETS	24
+
+struct amd_sched_lat_hist {
+	u64	count[AMD_SCHED_PRIORITY_MAX][AMD_SCHED_LAT_MAX][AMD_SCHED_LAT_BUCKETS];
+};
+
 /**
  * One scheduler is implemented for each hardware ring
 */
 struct amd_gpu_scheduler {
 	const struct amd_sched_backend_ops	*ops;
+	const struct amd_sched_policy_ops	*policy;
 	uint32_t			hw_submission_limit;
+	uint32_t			batch_size;
 	long				timeout;
 	const char			*name;
 	struct amd_sched_rq		sched_rq[AMD_SCHED_PRIORITY_MAX];
@@ -140,20 +209,31 @@ struct amd_gpu_scheduler {
 	struct task_struct		*thread;
 	struct list_head	ring_mirror_list;
 	spinlock_t			job_list_lock;
+	ktime_t				last_done;
+	struct amd_sched_lat_hist __percpu *lat_hist;
 };
 
 int amd_sched_init(struct amd_gpu_scheduler *sched,
 		   const struct amd_sched_backend_ops *ops,
 		   uint32_t hw_submission, long timeout, const char *name);
 void amd_sched_fini(struct amd_gpu_scheduler *sched);
+void amd_sched_set_policy(struct amd_gpu_scheduler *sched,
+			  enum amd_sched_policy policy);
+void amd_sched_set_batch_size(struct amd_gpu_scheduler *sched,
+			      uint32_t batch_size);
+void amd_sched_lat_hist_read(struct amd_gpu_scheduler *sched,
+			     enum amd_sched_priority priority,
+			     enum amd_sched_lat_stage stage,
+			     u64 *buckets);
 
 int amd_sched_entity_init(struct amd_gpu_scheduler *sched,
 			  struct amd_sched_entity *entity,
-			  struct amd_sched_rq *rq,
-			  uint32_t jobs);
+			  struct amd_sched_rq *rq);
 void amd_sched_entity_fini(struct amd_gpu_scheduler *sched,
 			   struct amd_sched_entity *entity);
 void amd_sched_entity_push_job(struct amd_sched_job *sched_job);
+void amd_sched_entity_set_weight(struct amd_sched_entity *entity,
+				 uint32_t weight);
 
 int amd_sched_fence_slab_init(void);
 void amd_sched_fence_slab_fini(void);
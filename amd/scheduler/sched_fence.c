@@ -59,6 +59,8 @@ struct amd_sched_fence *amd_sched_fence_create(struct amd_sched_entity *entity,
 	fence->owner = owner;
 	fence->sched = entity->sched;
 	spin_lock_init(&fence->lock);
+	INIT_LIST_HEAD(&fence->acct);
+	fence->priority = entity->rq - entity->sched->sched_rq;
 
 	seq = atomic_inc_return(&entity->fence_seq);
 	kcl_fence_init(&fence->scheduled, &amd_sched_fence_ops_scheduled,
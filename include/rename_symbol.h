@@ -1,3 +1,8 @@
+#define __chash_table_copy_in amd__chash_table_copy_in //amd/lib/chash.c:EXPORT_SYMBOL(__chash_table_copy_in);
+#define __chash_table_copy_out amd__chash_table_copy_out //amd/lib/chash.c:EXPORT_SYMBOL(__chash_table_copy_out);
+#define __chash_table_dump_stats amd__chash_table_dump_stats //amd/lib/chash.c:EXPORT_SYMBOL(__chash_table_dump_stats);
+#define chash_table_alloc amdchash_table_alloc //amd/lib/chash.c:EXPORT_SYMBOL(chash_table_alloc);
+#define chash_table_free amdchash_table_free //amd/lib/chash.c:EXPORT_SYMBOL(chash_table_free);
 #define ttm_agp_tt_create amdttm_agp_tt_create //ttm/ttm_agp_backend.c:EXPORT_SYMBOL(ttm_agp_tt_create);
 #define ttm_agp_tt_populate amdttm_agp_tt_populate //ttm/ttm_agp_backend.c:EXPORT_SYMBOL(ttm_agp_tt_populate);
 #define ttm_agp_tt_unpopulate amdttm_agp_tt_unpopulate //ttm/ttm_agp_backend.c:EXPORT_SYMBOL(ttm_agp_tt_unpopulate);
@@ -176,6 +176,11 @@ union drm_amdgpu_bo_list {
 #define AMDGPU_CTX_OP_ALLOC_CTX	1
 #define AMDGPU_CTX_OP_FREE_CTX	2
 #define AMDGPU_CTX_OP_QUERY_STATE	3
+/* hybrid specific: set the GPU time share of the context */
+#define AMDGPU_CTX_OP_SET_SCHED_WEIGHT	0x40
+
+/* default context weight for AMDGPU_CTX_OP_SET_SCHED_WEIGHT */
+#define AMDGPU_CTX_SCHED_WEIGHT_DEFAULT	1024
 
 /* GPU reset status */
 #define AMDGPU_CTX_NO_RESET		0
@@ -192,7 +197,12 @@ struct drm_amdgpu_ctx_in {
 	/** For future use, no flags defined so far */
 	__u32	flags;
 	__u32	ctx_id;
-	__u32	_pad;
+	/**
+	 * AMDGPU_CTX_OP_SET_SCHED_WEIGHT: relative weight, 0 = default.
+	 * Clamped to 1/64 .. 64 times the default, values above the
+	 * default need CAP_SYS_NICE or DRM master.
+	 */
+	__u32	weight;
 };
 
 union drm_amdgpu_ctx_out {
@@ -31,7 +31,7 @@ for sym in $SYMS; do
     echo "void *_kcl_$sym = (void *)0x$addr;" >> amd/amdkcl/symbols.c
 done
 
-find ttm -name '*.c' -exec grep EXPORT_SYMBOL {} + \
+find ttm amd/lib -name '*.c' -exec grep EXPORT_SYMBOL {} + \
     | sort -u \
     | awk -F'[()]' '{print "#define "$2" amd"$2" //"$0}'\
     >> include/rename_symbol.h
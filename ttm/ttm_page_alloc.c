@@ -43,6 +43,7 @@
 #include <linux/seq_file.h> /* for seq_printf */
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/percpu.h>
 
 #include <linux/atomic.h>
 
@@ -63,6 +64,21 @@
 #define FREE_ALL_PAGES			(~0U)
 /* times are in msecs */
 #define PAGE_FREE_INTERVAL		1000
+#define TTM_MAGAZINE_SIZE		64
+#define TTM_MAGAZINE_BATCH		(TTM_MAGAZINE_SIZE / 2)
+
+/**
+ * struct ttm_page_magazine - Per CPU cache in front of a pool.
+ *
+ * @lock: Protects the magazine, only contended when the pool is drained.
+ * @count: Number of pages in the magazine.
+ * @pages: Pages with the caching state of the pool, most recently freed last.
+ */
+struct ttm_page_magazine {
+	spinlock_t		lock;
+	unsigned		count;
+	struct page		*pages[TTM_MAGAZINE_SIZE];
+};
 
 /**
  * struct ttm_page_pool - Pool to reuse recently allocated uc/wc pages.
@@ -74,6 +90,8 @@
  * @list: Pool of free uc/wc pages for fast reuse.
  * @gfp_flags: Flags to pass for alloc_page.
  * @npages: Number of pages in pool.
+ * @magazines: Per CPU magazines, refilled from and drained to the pool in
+ * batches of TTM_MAGAZINE_BATCH pages.
  */
 struct ttm_page_pool {
 	spinlock_t		lock;
@@ -84,6 +102,7 @@ struct ttm_page_pool {
 	char			*name;
 	unsigned long		nfrees;
 	unsigned long		nrefills;
+	struct ttm_page_magazine __percpu *magazines;
 };
 
 /**
@@ -390,6 +409,66 @@ out:
 	return nr_free;
 }
 
+/**
+ * Move the oldest pages of a magazine to the pool.
+ *
+ * Must be called with the magazine lock held and interrupts disabled.
+ */
+static void ttm_page_magazine_flush_locked(struct ttm_page_pool *pool,
+					   struct ttm_page_magazine *mag,
+					   unsigned count)
+{
+	unsigned i;
+
+	spin_lock(&pool->lock);
+	for (i = 0; i < count; ++i)
+		list_add_tail(&mag->pages[i]->lru, &pool->list);
+	pool->npages += count;
+	spin_unlock(&pool->lock);
+
+	mag->count -= count;
+	memmove(mag->pages, &mag->pages[count],
+		mag->count * sizeof(struct page *));
+}
+
+/**
+ * Move the pages of all magazines back to the pool.
+ */
+static void ttm_page_magazine_drain(struct ttm_page_pool *pool)
+{
+	unsigned long irq_flags;
+	int cpu;
+
+	if (!pool->magazines)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct ttm_page_magazine *mag;
+
+		mag = per_cpu_ptr(pool->magazines, cpu);
+		spin_lock_irqsave(&mag->lock, irq_flags);
+		ttm_page_magazine_flush_locked(pool, mag, mag->count);
+		spin_unlock_irqrestore(&mag->lock, irq_flags);
+	}
+}
+
+/**
+ * Number of pages in all magazines of a pool, only a snapshot.
+ */
+static unsigned ttm_page_magazine_count(struct ttm_page_pool *pool)
+{
+	unsigned count = 0;
+	int cpu;
+
+	if (!pool->magazines)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		count += READ_ONCE(per_cpu_ptr(pool->magazines, cpu)->count);
+
+	return count;
+}
+
 /**
  * Callback for mm to request pool to reduce number of page held.
  *
@@ -417,6 +496,7 @@ ttm_pool_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
 		if (shrink_pages == 0)
 			break;
 		pool = &_manager->pools[(i + pool_offset)%NUM_POOLS];
+		ttm_page_magazine_drain(pool);
 		/* OK to use static buffer since global mutex is held. */
 		shrink_pages = ttm_page_pool_free(pool, nr_free, true);
 		freed += nr_free - shrink_pages;
@@ -433,7 +513,8 @@ ttm_pool_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
 	unsigned long count = 0;
 
 	for (i = 0; i < NUM_POOLS; ++i)
-		count += _manager->pools[i].npages;
+		count += _manager->pools[i].npages +
+			ttm_page_magazine_count(&_manager->pools[i]);
 
 	return count;
 }
@@ -678,6 +759,141 @@ out:
 	return count;
 }
 
+/**
+ * Number of pages to free when the pool grew over its limit.
+ *
+ * Must be called with the pool lock held.
+ */
+static unsigned ttm_page_pool_excess_locked(struct ttm_page_pool *pool)
+{
+	unsigned npages = 0;
+
+	if (pool->npages > _manager->options.max_size) {
+		npages = pool->npages - _manager->options.max_size;
+		/* free at least NUM_PAGES_TO_ALLOC number of pages
+		 * to reduce calls to set_memory_wb */
+		if (npages < NUM_PAGES_TO_ALLOC)
+			npages = NUM_PAGES_TO_ALLOC;
+	}
+	return npages;
+}
+
+/**
+ * Take up to 'npages' pages from the magazine of the current CPU.
+ *
+ * @return number of pages taken.
+ */
+static unsigned ttm_page_magazine_get(struct ttm_page_pool *pool,
+				      struct page **pages, unsigned npages)
+{
+	struct ttm_page_magazine *mag;
+	unsigned long irq_flags;
+	unsigned count;
+
+	if (!pool->magazines)
+		return 0;
+
+	mag = get_cpu_ptr(pool->magazines);
+	spin_lock_irqsave(&mag->lock, irq_flags);
+	count = min(npages, mag->count);
+	mag->count -= count;
+	memcpy(pages, &mag->pages[mag->count], count * sizeof(struct page *));
+	spin_unlock_irqrestore(&mag->lock, irq_flags);
+	put_cpu_ptr(pool->magazines);
+
+	return count;
+}
+
+/**
+ * Refill the magazine of the current CPU with a batch of pages.
+ *
+ * Pages are taken from the pool with a single lock round trip, whatever the
+ * pool can't provide is allocated and has its caching changed in one go.
+ */
+static void ttm_page_magazine_refill(struct ttm_page_pool *pool,
+				     int ttm_flags,
+				     enum ttm_caching_state cstate)
+{
+	struct ttm_page_magazine *mag;
+	struct list_head plist, new_pages;
+	unsigned long irq_flags;
+	struct page *p, *tmp;
+	unsigned count;
+
+	INIT_LIST_HEAD(&plist);
+	count = ttm_page_pool_get_pages(pool, &plist, ttm_flags, cstate,
+					TTM_MAGAZINE_BATCH);
+	if (count) {
+		/* keep whatever we got on failure */
+		INIT_LIST_HEAD(&new_pages);
+		ttm_alloc_new_pages(&new_pages, pool->gfp_flags, ttm_flags,
+				    cstate, count);
+		list_splice(&new_pages, &plist);
+	}
+
+	mag = get_cpu_ptr(pool->magazines);
+	spin_lock_irqsave(&mag->lock, irq_flags);
+	list_for_each_entry_safe(p, tmp, &plist, lru) {
+		if (mag->count == TTM_MAGAZINE_SIZE)
+			break;
+		list_del(&p->lru);
+		mag->pages[mag->count++] = p;
+	}
+	spin_unlock_irqrestore(&mag->lock, irq_flags);
+	put_cpu_ptr(pool->magazines);
+
+	/* The magazine was refilled concurrently, give the rest back */
+	if (!list_empty(&plist)) {
+		count = 0;
+		list_for_each_entry(p, &plist, lru)
+			++count;
+
+		spin_lock_irqsave(&pool->lock, irq_flags);
+		list_splice(&plist, &pool->list);
+		pool->npages += count;
+		spin_unlock_irqrestore(&pool->lock, irq_flags);
+	}
+}
+
+/**
+ * Put pages into the magazine of the current CPU.
+ *
+ * When the magazine is full the oldest batch of pages is moved to the pool.
+ */
+static void ttm_page_magazine_put(struct ttm_page_pool *pool,
+				  struct page **pages, unsigned npages)
+{
+	struct ttm_page_magazine *mag;
+	unsigned long irq_flags;
+	unsigned i, nr_free = 0;
+
+	mag = get_cpu_ptr(pool->magazines);
+	spin_lock_irqsave(&mag->lock, irq_flags);
+	for (i = 0; i < npages; i++) {
+		if (!pages[i])
+			continue;
+
+		if (page_count(pages[i]) != 1)
+			pr_err("Erroneous page count. Leaking pages.\n");
+
+		if (mag->count == TTM_MAGAZINE_SIZE) {
+			ttm_page_magazine_flush_locked(pool, mag,
+						       TTM_MAGAZINE_BATCH);
+			spin_lock(&pool->lock);
+			nr_free = ttm_page_pool_excess_locked(pool);
+			spin_unlock(&pool->lock);
+		}
+
+		mag->pages[mag->count++] = pages[i];
+		pages[i] = NULL;
+	}
+	spin_unlock_irqrestore(&mag->lock, irq_flags);
+	put_cpu_ptr(pool->magazines);
+
+	if (nr_free)
+		ttm_page_pool_free(pool, nr_free, false);
+}
+
 /* Put all pages in pages list to correct pool to wait for reuse */
 static void ttm_put_pages(struct page **pages, unsigned npages, int flags,
 			  enum ttm_caching_state cstate)
@@ -699,6 +915,11 @@ static void ttm_put_pages(struct page **pages, unsigned npages, int flags,
 		return;
 	}
 
+	if (pool->magazines) {
+		ttm_page_magazine_put(pool, pages, npages);
+		return;
+	}
+
 	spin_lock_irqsave(&pool->lock, irq_flags);
 	for (i = 0; i < npages; i++) {
 		if (pages[i]) {
@@ -710,14 +931,7 @@ static void ttm_put_pages(struct page **pages, unsigned npages, int flags,
 		}
 	}
 	/* Check that we don't go over the pool limit */
-	npages = 0;
-	if (pool->npages > _manager->options.max_size) {
-		npages = pool->npages - _manager->options.max_size;
-		/* free at least NUM_PAGES_TO_ALLOC number of pages
-		 * to reduce calls to set_memory_wb */
-		if (npages < NUM_PAGES_TO_ALLOC)
-			npages = NUM_PAGES_TO_ALLOC;
-	}
+	npages = ttm_page_pool_excess_locked(pool);
 	spin_unlock_irqrestore(&pool->lock, irq_flags);
 	if (npages)
 		ttm_page_pool_free(pool, npages, false);
@@ -764,10 +978,31 @@ static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 	/* combine zero flag to pool flags */
 	gfp_flags |= pool->gfp_flags;
 
-	/* First we take pages from the pool */
+	/* First we take pages from the per CPU magazine */
+	count = ttm_page_magazine_get(pool, pages, npages);
+	if (pool->magazines && count < npages &&
+	    npages - count <= TTM_MAGAZINE_BATCH) {
+		ttm_page_magazine_refill(pool, flags, cstate);
+		count += ttm_page_magazine_get(pool, pages + count,
+					       npages - count);
+	}
+	npages -= count;
+
+	/* clear the pages coming from the magazine if requested */
+	if (flags & TTM_PAGE_FLAG_ZERO_ALLOC) {
+		for (r = 0; r < count; ++r) {
+			if (PageHighMem(pages[r]))
+				clear_highpage(pages[r]);
+			else
+				clear_page(page_address(pages[r]));
+		}
+	}
+
+	/* Then we take pages from the pool */
 	INIT_LIST_HEAD(&plist);
-	npages = ttm_page_pool_get_pages(pool, &plist, flags, cstate, npages);
-	count = 0;
+	if (npages)
+		npages = ttm_page_pool_get_pages(pool, &plist, flags, cstate,
+						 npages);
 	list_for_each_entry(p, &plist, lru) {
 		pages[count++] = p;
 	}
@@ -813,6 +1048,16 @@ static void ttm_page_pool_init_locked(struct ttm_page_pool *pool, gfp_t flags,
 	pool->npages = pool->nfrees = 0;
 	pool->gfp_flags = flags;
 	pool->name = name;
+
+	/* Without magazines all allocations just go to the pool directly */
+	pool->magazines = alloc_percpu(struct ttm_page_magazine);
+	if (pool->magazines) {
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(pool->magazines,
+						    cpu)->lock);
+	}
 }
 
 int ttm_page_alloc_init(struct ttm_mem_global *glob, unsigned max_pages)
@@ -860,8 +1105,11 @@ void ttm_page_alloc_fini(void)
 	ttm_pool_mm_shrink_fini(_manager);
 
 	/* OK to use static buffer since global mutex is no longer used. */
-	for (i = 0; i < NUM_POOLS; ++i)
+	for (i = 0; i < NUM_POOLS; ++i) {
+		ttm_page_magazine_drain(&_manager->pools[i]);
 		ttm_page_pool_free(&_manager->pools[i], FREE_ALL_PAGES, true);
+		free_percpu(_manager->pools[i].magazines);
+	}
 
 	kobject_put(&_manager->kobj);
 	_manager = NULL;
@@ -970,19 +1218,20 @@ int ttm_page_alloc_debugfs(struct seq_file *m, void *data)
 {
 	struct ttm_page_pool *p;
 	unsigned i;
-	char *h[] = {"pool", "refills", "pages freed", "size"};
+	char *h[] = {"pool", "refills", "pages freed", "size", "magazines"};
 	if (!_manager) {
 		seq_printf(m, "No pool allocator running.\n");
 		return 0;
 	}
-	seq_printf(m, "%6s %12s %13s %8s\n",
-			h[0], h[1], h[2], h[3]);
+	seq_printf(m, "%6s %12s %13s %8s %10s\n",
+			h[0], h[1], h[2], h[3], h[4]);
 	for (i = 0; i < NUM_POOLS; ++i) {
 		p = &_manager->pools[i];
 
-		seq_printf(m, "%6s %12ld %13ld %8d\n",
+		seq_printf(m, "%6s %12ld %13ld %8d %10d\n",
 				p->name, p->nrefills,
-				p->nfrees, p->npages);
+				p->nfrees, p->npages,
+				ttm_page_magazine_count(p));
 	}
 	return 0;
 }